@@ -0,0 +1,294 @@
+/*
+ * animal-arena.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <urcu/system.h>
+#include <urcu/uatomic.h>
+#include "animal-arena.h"
+
+/* Alignment of transparent huge pages. */
+#define HUGE_PAGE_SIZE		(2UL * 1024 * 1024)
+
+/*
+ * Free object. The first object of a batch of the shared list also
+ * links to the next batch and holds the number of objects.
+ */
+struct arena_free {
+	struct arena_free *next;
+	struct arena_free *next_batch;
+	unsigned long nr;
+};
+
+struct arena_cache {
+	struct arena_free *free;	/* free objects */
+	unsigned long nr_free;
+	char *bump, *bump_end;		/* never allocated objects */
+};
+
+struct animal_arena animal_arena;
+
+static
+size_t arena_len;
+
+/*
+ * Bytes carved from the mapping. Once full, the allocators see
+ * arena_full first, so arena_used stays within a batch per thread of
+ * arena_len.
+ */
+static
+unsigned long arena_used;
+
+static
+int arena_full;
+
+static
+unsigned long arena_nr_fallback;
+
+static
+pthread_mutex_t arena_batch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+struct arena_free *arena_batches;
+
+static __thread
+struct arena_cache arena_cache;
+
+static
+void *map_thp(size_t len)
+{
+	char *p, *start;
+	size_t head, tail;
+
+	/* Over-map to align on a huge page. */
+	p = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	start = (char *) (((uintptr_t) p + HUGE_PAGE_SIZE - 1)
+			& ~(HUGE_PAGE_SIZE - 1));
+	head = start - p;
+	tail = HUGE_PAGE_SIZE - head;
+	if (head)
+		munmap(p, head);
+	if (tail)
+		munmap(start + len, tail);
+	if (madvise(start, len, MADV_HUGEPAGE)) {
+		perror("madvise MADV_HUGEPAGE");
+		munmap(start, len);
+		return NULL;
+	}
+	return start;
+}
+
+static
+void *map_hugetlb(size_t len)
+{
+	void *p;
+
+	/* Reserve the huge pages now rather than fail on page fault. */
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap MAP_HUGETLB");
+		return NULL;
+	}
+	return p;
+}
+
+int animal_arena_init(enum animal_arena_type type, size_t obj_size,
+		uint64_t nr)
+{
+	char *start;
+	size_t len;
+
+	if (type == ANIMAL_ARENA_NONE)
+		return 0;
+	/* Objects do not straddle cache lines. */
+	obj_size = (obj_size + CAA_CACHE_LINE_SIZE - 1)
+			& ~((size_t) CAA_CACHE_LINE_SIZE - 1);
+	if (obj_size < sizeof(struct arena_free) || !nr
+			|| nr > ANIMAL_ARENA_MAX_NR)
+		return -1;
+	len = (nr * obj_size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	switch (type) {
+	case ANIMAL_ARENA_THP:
+		start = map_thp(len);
+		break;
+	case ANIMAL_ARENA_HUGETLB:
+		start = map_hugetlb(len);
+		break;
+	default:
+		return -1;
+	}
+	if (!start)
+		return -1;
+	arena_len = len;
+	animal_arena.start = start;
+	animal_arena.end = start + len;
+	animal_arena.obj_size = obj_size;
+	animal_arena.type = type;
+	return 0;
+}
+
+/* Called once all objects are freed, and all threads have exited. */
+void animal_arena_destroy(void)
+{
+	if (animal_arena.type == ANIMAL_ARENA_NONE)
+		return;
+	if (munmap(animal_arena.start, arena_len))
+		abort();
+	memset(&animal_arena, 0, sizeof(animal_arena));
+	arena_batches = NULL;
+	arena_used = 0;
+	arena_full = 0;
+}
+
+static
+void refill_cache(struct arena_cache *cache)
+{
+	struct arena_free *batch = NULL;
+	unsigned long len, offset;
+
+	/* Only freed objects are left once full: skip the lock if none. */
+	if (CMM_LOAD_SHARED(arena_batches)) {
+		pthread_mutex_lock(&arena_batch_lock);
+		batch = arena_batches;
+		if (batch)
+			CMM_STORE_SHARED(arena_batches, batch->next_batch);
+		pthread_mutex_unlock(&arena_batch_lock);
+	}
+	if (batch) {
+		cache->free = batch;
+		cache->nr_free = batch->nr;
+		return;
+	}
+	if (CMM_LOAD_SHARED(arena_full))
+		return;
+
+	len = ANIMAL_ARENA_BATCH * animal_arena.obj_size;
+	offset = uatomic_add_return(&arena_used, len) - len;
+	if (offset + len >= arena_len) {
+		CMM_STORE_SHARED(arena_full, 1);
+		if (offset >= arena_len)
+			return;
+		/* Last objects of the mapping. */
+		len = (arena_len - offset) / animal_arena.obj_size
+				* animal_arena.obj_size;
+	}
+	cache->bump = animal_arena.start + offset;
+	cache->bump_end = cache->bump + len;
+}
+
+void *animal_arena_get(void)
+{
+	struct arena_cache *cache = &arena_cache;
+	struct arena_free *obj;
+	char *p;
+
+	if (!cache->free && cache->bump == cache->bump_end)
+		refill_cache(cache);
+	obj = cache->free;
+	if (obj) {
+		cache->free = obj->next;
+		cache->nr_free--;
+		return obj;
+	}
+	if (cache->bump != cache->bump_end) {
+		p = cache->bump;
+		cache->bump += animal_arena.obj_size;
+		return p;
+	}
+	uatomic_inc(&arena_nr_fallback);
+	return NULL;
+}
+
+/* Move up to ANIMAL_ARENA_BATCH objects of the cache to the shared list. */
+static
+void put_batch(struct arena_cache *cache)
+{
+	struct arena_free *batch, *last;
+	unsigned long nr = 1;
+
+	batch = last = cache->free;
+	while (nr < ANIMAL_ARENA_BATCH && last->next) {
+		last = last->next;
+		nr++;
+	}
+	cache->free = last->next;
+	cache->nr_free -= nr;
+	last->next = NULL;
+	batch->nr = nr;
+
+	pthread_mutex_lock(&arena_batch_lock);
+	batch->next_batch = arena_batches;
+	CMM_STORE_SHARED(arena_batches, batch);
+	pthread_mutex_unlock(&arena_batch_lock);
+}
+
+void animal_arena_put(void *ptr)
+{
+	struct arena_cache *cache = &arena_cache;
+	struct arena_free *obj = ptr;
+
+	obj->next = cache->free;
+	cache->free = obj;
+	if (++cache->nr_free >= 2 * ANIMAL_ARENA_BATCH)
+		put_batch(cache);
+}
+
+void animal_arena_flush(void)
+{
+	struct arena_cache *cache = &arena_cache;
+
+	if (animal_arena.type == ANIMAL_ARENA_NONE)
+		return;
+	while (cache->bump != cache->bump_end) {
+		animal_arena_put(cache->bump);
+		cache->bump += animal_arena.obj_size;
+	}
+	while (cache->free)
+		put_batch(cache);
+}
+
+void get_animal_arena_stats(struct animal_arena_stats *stats)
+{
+	uint64_t used;
+
+	used = uatomic_read(&arena_used);
+	if (used > arena_len)
+		used = arena_len;
+	stats->capacity = animal_arena.obj_size ?
+			arena_len / animal_arena.obj_size : 0;
+	stats->used = animal_arena.obj_size ?
+			used / animal_arena.obj_size : 0;
+	stats->nr_fallback = uatomic_read(&arena_nr_fallback);
+}
+
+const char *animal_arena_type_name(enum animal_arena_type type)
+{
+	switch (type) {
+	case ANIMAL_ARENA_NONE:
+		return "none";
+	case ANIMAL_ARENA_THP:
+		return "thp";
+	case ANIMAL_ARENA_HUGETLB:
+		return "hugetlb";
+	}
+	return "unknown";
+}
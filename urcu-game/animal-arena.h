@@ -0,0 +1,106 @@
+#ifndef ANIMAL_ARENA_H
+#define ANIMAL_ARENA_H
+
+/*
+ * animal-arena.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <urcu/compiler.h>
+
+/*
+ * Animal arena: fixed-size animal objects carved from a single mapping
+ * backed by huge pages, so random lookups over many animals need fewer
+ * TLB entries than with scattered calloc() chunks.
+ *
+ * Each thread keeps a cache of free objects. Objects freed by the
+ * call_rcu thread are handed back to allocating threads in batches of
+ * ANIMAL_ARENA_BATCH objects through a shared list. When the arena is
+ * full, objects come from calloc().
+ */
+
+#define ANIMAL_ARENA_BATCH		64
+#define ANIMAL_ARENA_DEFAULT_NR		(1UL << 24)	/* objects */
+#define ANIMAL_ARENA_MAX_NR		(1ULL << 32)	/* objects */
+
+enum animal_arena_type {
+	ANIMAL_ARENA_NONE,		/* calloc() */
+	ANIMAL_ARENA_THP,		/* transparent huge pages */
+	ANIMAL_ARENA_HUGETLB,		/* hugetlbfs pages, reserved */
+};
+
+struct animal_arena_stats {
+	uint64_t capacity;		/* objects */
+	uint64_t used;			/* objects carved from the mapping */
+	uint64_t nr_fallback;		/* calloc() when arena full */
+};
+
+struct animal_arena {
+	char *start, *end;		/* mapping */
+	size_t obj_size;
+	enum animal_arena_type type;
+};
+
+extern struct animal_arena animal_arena;
+
+/*
+ * Map an arena of "nr" objects of "obj_size" bytes. Returns 0 on
+ * success, -1 on error.
+ */
+int animal_arena_init(enum animal_arena_type type, size_t obj_size,
+		uint64_t nr);
+void animal_arena_destroy(void);
+
+/* Arena object, or NULL when the arena is full. */
+void *animal_arena_get(void);
+void animal_arena_put(void *obj);
+/* Return the cache of the current thread, before it exits. */
+void animal_arena_flush(void);
+void get_animal_arena_stats(struct animal_arena_stats *stats);
+const char *animal_arena_type_name(enum animal_arena_type type);
+
+static inline
+int animal_arena_contains(void *obj)
+{
+	return (char *) obj >= animal_arena.start
+		&& (char *) obj < animal_arena.end;
+}
+
+/* Returns zeroed memory of "size" bytes, at most the object size. */
+static inline
+void *animal_arena_alloc(size_t size)
+{
+	void *obj;
+
+	if (caa_likely(animal_arena.type == ANIMAL_ARENA_NONE))
+		return calloc(1, size);
+	obj = animal_arena_get();
+	if (caa_unlikely(!obj))
+		return calloc(1, size);
+	memset(obj, 0, size);
+	return obj;
+}
+
+static inline
+void animal_arena_free(void *obj)
+{
+	if (animal_arena_contains(obj))
+		animal_arena_put(obj);
+	else
+		free(obj);
+}
+
+#endif /* ANIMAL_ARENA_H */
@@ -0,0 +1,125 @@
+/*
+ * animal-array.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdlib.h>
+#include <urcu.h>
+#include "urcu-game.h"
+#include "animal-array.h"
+#include "mem-account.h"
+#include "rcu-prof.h"
+
+/* Number of slots migrated per RCU read-side critical section. */
+#define MIGRATE_CHUNK	4096
+
+static
+size_t array_bytes(uint64_t island_size)
+{
+	return sizeof(struct animal_array)
+		+ island_size * sizeof(struct animal *);
+}
+
+static
+struct animal_array *alloc_array(uint64_t island_size)
+{
+	struct animal_array *array;
+
+	if (island_size > ANIMAL_ARRAY_MAX_SIZE)
+		island_size = ANIMAL_ARRAY_MAX_SIZE;
+	array = calloc(1, array_bytes(island_size));
+	if (!array)
+		abort();
+	array->size = island_size;
+	mem_account_sync(MEM_INDEX, array_bytes(island_size));
+	return array;
+}
+
+static
+void free_array(struct animal_array *array)
+{
+	if (!array)
+		return;
+	mem_account_sync(MEM_INDEX, -(long) array_bytes(array->size));
+	free(array);
+}
+
+void animal_array_init(struct island *island, uint64_t island_size)
+{
+	rcu_set_pointer(&island->animal_array, alloc_array(island_size));
+}
+
+/*
+ * No other thread accesses the new slot until the old one is marked as
+ * moved, so it can be stored before trying to mark the old one.
+ */
+static
+void migrate_slot(struct animal_array *old, struct animal_array *new,
+		uint64_t key)
+{
+	struct animal *animal, *prev;
+
+	animal = CMM_LOAD_SHARED(old->slots[key]);
+	for (;;) {
+		CMM_STORE_SHARED(new->slots[key], animal);
+		prev = uatomic_cmpxchg(&old->slots[key], animal,
+				ANIMAL_ARRAY_MOVED);
+		if (prev == animal)
+			break;
+		animal = prev;	/* concurrent add or delete */
+	}
+}
+
+/*
+ * When shrinking, slots beyond the new size need to be empty: they are
+ * not migrated.
+ */
+void animal_array_resize(struct island *island, uint64_t island_size)
+{
+	struct animal_array *old, *new;
+	uint64_t key, nr_keys;
+
+	old = island->animal_array;
+	if (!old)
+		return;
+	new = alloc_array(island_size);
+	if (new->size == old->size) {
+		free_array(new);
+		return;
+	}
+	nr_keys = old->size < new->size ? old->size : new->size;
+	new->old = old;
+	rcu_set_pointer(&island->animal_array, new);
+
+	/*
+	 * Incremental migration: release the RCU read-side lock between
+	 * chunks to let grace periods complete.
+	 */
+	for (key = 0; key < nr_keys; key += MIGRATE_CHUNK) {
+		uint64_t i;
+
+		prof_rcu_read_lock();
+		for (i = key; i < key + MIGRATE_CHUNK && i < nr_keys; i++)
+			migrate_slot(old, new, i);
+		prof_rcu_read_unlock();
+	}
+	rcu_set_pointer(&new->old, NULL);
+	prof_synchronize_rcu();
+	free_array(old);
+}
+
+void animal_array_destroy(struct island *island)
+{
+	free_array(island->animal_array);
+	island->animal_array = NULL;
+}
@@ -0,0 +1,141 @@
+#ifndef ANIMAL_ARRAY_H
+#define ANIMAL_ARRAY_H
+
+/*
+ * animal-array.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+#include <assert.h>
+#include <urcu.h>
+#include <urcu/compiler.h>
+#include <urcu/uatomic.h>
+#include "urcu-game.h"
+
+/*
+ * Dense "all animals" index: an array of animal pointers indexed by
+ * key, alternative to the "all animals" hash table for bounded key
+ * spaces. Insertion and removal are a cmpxchg on the key slot, lookup
+ * is a single load.
+ *
+ * Each island has its own array, published with RCU. Resizing the
+ * island publishes a new array which points to the previous one while
+ * its slots are incrementally migrated: each slot is owned by the old
+ * array until it is marked ANIMAL_ARRAY_MOVED, and by the new array
+ * afterwards. The old array is freed after migration, once a grace
+ * period has elapsed.
+ *
+ * Accessors need to be called within RCU read-side critical section.
+ */
+
+/* Largest island size with the array index (2GB array). */
+#define ANIMAL_ARRAY_MAX_SIZE	(1ULL << 28)
+
+#define ANIMAL_ARRAY_MOVED	((struct animal *) 0x1UL)
+
+struct animal_array {
+	uint64_t size;
+	struct animal_array *old;	/* being migrated, or NULL */
+	struct animal *slots[];
+};
+
+/*
+ * Return the slot owning "key", or NULL if key is beyond the array.
+ */
+static inline
+struct animal **animal_array_slot(struct island *island, uint64_t key)
+{
+	struct animal_array *array = rcu_dereference(island->animal_array);
+	struct animal_array *old;
+
+	old = rcu_dereference(array->old);
+	if (caa_unlikely(old) && key < old->size) {
+		struct animal **slot = &old->slots[key];
+
+		if (CMM_LOAD_SHARED(*slot) != ANIMAL_ARRAY_MOVED)
+			return slot;
+	}
+	if (key >= array->size)
+		return NULL;
+	return &array->slots[key];
+}
+
+static inline
+struct animal *animal_array_lookup(struct island *island, uint64_t key)
+{
+	struct animal **slot = animal_array_slot(island, key);
+	struct animal *animal;
+
+	if (!slot)
+		return NULL;
+	animal = rcu_dereference(*slot);
+	if (animal == ANIMAL_ARRAY_MOVED)	/* migrated concurrently */
+		animal = animal_array_lookup(island, key);
+	return animal;
+}
+
+/*
+ * Returns 1 if added, 0 if the key is already used, or beyond the
+ * array size.
+ */
+static inline
+int animal_array_add_unique(struct island *island, uint64_t key,
+		struct animal *animal)
+{
+	for (;;) {
+		struct animal **slot = animal_array_slot(island, key);
+		struct animal *old;
+
+		if (!slot)
+			return 0;
+		old = rcu_cmpxchg_pointer(slot, NULL, animal);
+		if (old == NULL)
+			return 1;
+		if (old != ANIMAL_ARRAY_MOVED)
+			return 0;
+		/* Slot migrated concurrently: retry in new array. */
+	}
+}
+
+static inline
+void animal_array_del(struct island *island, uint64_t key,
+		struct animal *animal)
+{
+	for (;;) {
+		struct animal **slot = animal_array_slot(island, key);
+		struct animal *old;
+
+		assert(slot);
+		old = uatomic_cmpxchg(slot, animal, NULL);
+		if (old == animal)
+			return;
+		assert(old == ANIMAL_ARRAY_MOVED);
+		/* Slot migrated concurrently: retry in new array. */
+	}
+}
+
+void animal_array_init(struct island *island, uint64_t island_size);
+
+/*
+ * Grow or shrink the array to cover a new island size. Called from the
+ * resize thread only, outside of RCU read-side critical section.
+ */
+void animal_array_resize(struct island *island, uint64_t island_size);
+
+/*
+ * Called after all threads using the array have been joined.
+ */
+void animal_array_destroy(struct island *island);
+
+#endif /* ANIMAL_ARRAY_H */
@@ -0,0 +1,61 @@
+/*
+ * animal-lock.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdlib.h>
+#include "animal-lock.h"
+
+__thread struct animal_lock_stats *animal_lock_stats;
+
+#ifndef ANIMAL_LOCK_MUTEX
+
+/*
+ * Spin with exponential backoff while the lock is held, then park.
+ * Once parked, the lock is always taken in the CONTENDED state, since
+ * other waiters may remain: the unlock then wakes one of them.
+ * Source: Ulrich Drepper, "Futexes Are Tricky", 2011 (mutex #2).
+ */
+void animal_lock_slow(struct animal_lock *lock)
+{
+	unsigned int spin = 0, backoff = 1, i;
+	int32_t state;
+
+	for (;;) {
+		state = CMM_LOAD_SHARED(lock->state);
+		if (state == ANIMAL_LOCK_FREE
+				&& uatomic_cmpxchg(&lock->state, ANIMAL_LOCK_FREE,
+					ANIMAL_LOCK_LOCKED) == ANIMAL_LOCK_FREE)
+			goto acquired;
+		if (state == ANIMAL_LOCK_CONTENDED
+				|| spin >= ANIMAL_LOCK_SPIN_MAX)
+			break;
+		for (i = 0; i < backoff; i++)
+			caa_cpu_relax();
+		spin += backoff;
+		if (backoff < ANIMAL_LOCK_BACKOFF_MAX)
+			backoff <<= 1;
+	}
+
+	while (uatomic_xchg(&lock->state, ANIMAL_LOCK_CONTENDED)
+			!= ANIMAL_LOCK_FREE) {
+		animal_lock_stats_inc(nr_park);
+		(void) futex_async(&lock->state, FUTEX_WAIT,
+				ANIMAL_LOCK_CONTENDED, NULL, NULL, 0);
+	}
+acquired:
+	CMM_STORE_SHARED(lock->nr_contended, lock->nr_contended + 1);
+	animal_lock_stats_inc(nr_contended);
+}
+
+#endif /* ANIMAL_LOCK_MUTEX */
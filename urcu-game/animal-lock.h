@@ -0,0 +1,173 @@
+#ifndef ANIMAL_LOCK_H
+#define ANIMAL_LOCK_H
+
+/*
+ * animal-lock.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <urcu/compiler.h>
+#include <urcu/system.h>
+#include <urcu/uatomic.h>
+#include <urcu/futex.h>
+
+/*
+ * Animal lock. Critical sections on animals are a handful of
+ * instructions long, so a contended lock is first spun on, with
+ * exponential backoff, before parking the thread on a futex.
+ *
+ * Build with -DANIMAL_LOCK_MUTEX to use pthread mutexes instead, for
+ * comparison. Statistics are collected in both cases.
+ */
+
+/* Maximum number of busy-wait iterations before parking. */
+#define ANIMAL_LOCK_SPIN_MAX		4096
+/* Maximum number of pause instructions between two attempts. */
+#define ANIMAL_LOCK_BACKOFF_MAX		256
+
+/*
+ * Per-thread lock statistics. Only updated by the owner thread, read
+ * concurrently by other threads.
+ */
+struct animal_lock_stats {
+	uint64_t nr_acquire;		/* lock acquisitions */
+	uint64_t nr_contended;		/* lock was held on first attempt */
+	uint64_t nr_park;		/* sleeps on futex */
+};
+
+/*
+ * Statistics of the current thread, set by threads which account their
+ * lock usage, NULL otherwise.
+ */
+extern __thread struct animal_lock_stats *animal_lock_stats;
+
+#define animal_lock_stats_inc(field)					\
+	do {								\
+		struct animal_lock_stats *__stats = animal_lock_stats;	\
+									\
+		if (__stats)						\
+			CMM_STORE_SHARED(__stats->field,		\
+				__stats->field + 1);			\
+	} while (0)
+
+#ifndef ANIMAL_LOCK_MUTEX
+
+enum animal_lock_state {
+	ANIMAL_LOCK_FREE = 0,
+	ANIMAL_LOCK_LOCKED = 1,
+	ANIMAL_LOCK_CONTENDED = 2,	/* locked, with possible waiters */
+};
+
+struct animal_lock {
+	int32_t state;
+	uint32_t nr_contended;		/* protected by the lock itself */
+};
+
+void animal_lock_slow(struct animal_lock *lock);
+
+static inline
+void animal_lock_init(struct animal_lock *lock)
+{
+	lock->state = ANIMAL_LOCK_FREE;
+	lock->nr_contended = 0;
+}
+
+static inline
+void animal_lock(struct animal_lock *lock)
+{
+	animal_lock_stats_inc(nr_acquire);
+	if (caa_likely(uatomic_cmpxchg(&lock->state, ANIMAL_LOCK_FREE,
+			ANIMAL_LOCK_LOCKED) == ANIMAL_LOCK_FREE))
+		return;
+	animal_lock_slow(lock);
+}
+
+/*
+ * Returns 1 with the lock held, or 0 without waiting if it is held:
+ * the caller then takes it with animal_lock(). Only a success counts
+ * as acquisition.
+ */
+static inline
+int animal_trylock(struct animal_lock *lock)
+{
+	if (uatomic_cmpxchg(&lock->state, ANIMAL_LOCK_FREE,
+			ANIMAL_LOCK_LOCKED) != ANIMAL_LOCK_FREE)
+		return 0;
+	animal_lock_stats_inc(nr_acquire);
+	return 1;
+}
+
+static inline
+void animal_unlock(struct animal_lock *lock)
+{
+	if (uatomic_xchg(&lock->state, ANIMAL_LOCK_FREE)
+			== ANIMAL_LOCK_CONTENDED)
+		(void) futex_async(&lock->state, FUTEX_WAKE, 1,
+				NULL, NULL, 0);
+}
+
+#else /* ANIMAL_LOCK_MUTEX */
+
+struct animal_lock {
+	pthread_mutex_t mutex;
+	uint32_t nr_contended;		/* protected by the lock itself */
+};
+
+static inline
+void animal_lock_init(struct animal_lock *lock)
+{
+	pthread_mutex_init(&lock->mutex, NULL);
+	lock->nr_contended = 0;
+}
+
+static inline
+void animal_lock(struct animal_lock *lock)
+{
+	animal_lock_stats_inc(nr_acquire);
+	if (caa_likely(!pthread_mutex_trylock(&lock->mutex)))
+		return;
+	pthread_mutex_lock(&lock->mutex);
+	CMM_STORE_SHARED(lock->nr_contended, lock->nr_contended + 1);
+	animal_lock_stats_inc(nr_contended);
+}
+
+static inline
+int animal_trylock(struct animal_lock *lock)
+{
+	if (pthread_mutex_trylock(&lock->mutex))
+		return 0;
+	animal_lock_stats_inc(nr_acquire);
+	return 1;
+}
+
+static inline
+void animal_unlock(struct animal_lock *lock)
+{
+	pthread_mutex_unlock(&lock->mutex);
+}
+
+#endif /* ANIMAL_LOCK_MUTEX */
+
+/*
+ * Number of times the lock was found held. Approximate when read
+ * without holding the lock.
+ */
+static inline
+uint32_t animal_lock_contended(struct animal_lock *lock)
+{
+	return CMM_LOAD_SHARED(lock->nr_contended);
+}
+
+#endif /* ANIMAL_LOCK_H */
@@ -0,0 +1,566 @@
+/*
+ * bench-core.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+/*
+ * Microbenchmarks of the game primitives, linked against the game
+ * objects. Each benchmark runs at 1, 2, 4, ... up to max_threads
+ * threads, and at the number of online CPUs and max_threads when they
+ * are not powers of 2, with fixed seeds, and prints one line per run in
+ * "key=value" format, so results of different builds can be diffed:
+ *
+ *   bench=<name> index=<lfht|array> threads=<n> ops=<total>
+ *     ns_per_op=<per thread> ops_per_s=<total>
+ *     efficiency=<ops_per_s / (n * ops_per_s at 1)>
+ *
+ * With the "both" index, all benchmarks run with the "all animals"
+ * hash table, then with the array index, for a lookup comparison of
+ * the two on the same island size.
+ *
+ * find_hit looks up keys of a fully populated island, find_miss keys
+ * of an empty island. birth fills an empty island with god-created
+ * animals, each thread on its own keys, and kill finds and kills all
+ * animals of a full island, including the wait for their reclaim by
+ * call_rcu.
+ *
+ * Animals can be allocated from a huge page arena (thp or hugetlb), and
+ * hash table buckets from the liburcu mmap backend (mmap), to compare
+ * against malloc() under "perf stat -e dTLB-load-misses".
+ *
+ * With "perf", each line ends with the per thread counters of
+ * perf-counters.h, per op: <counter>_per_op=. With "lockprof", it ends
+ * with the lock classes taken during the run, per acquisition:
+ * lock_<class>_acquire= lock_<class>_try_fail= lock_<class>_wait_ns=
+ * lock_<class>_hold_ns=.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <urcu.h>
+#include <urcu/wfcqueue.h>
+#include "urcu-game.h"
+#include "urcu-game-config.h"
+#include "worker-thread.h"
+#include "ht-hash.h"
+#include "animal-array.h"
+#include "animal-arena.h"
+#include "mem-account.h"
+#include "perf-counters.h"
+#include "lock-prof.h"
+
+#define BENCH_OPS		(1UL << 20)	/* ops per thread */
+#define BENCH_SEED		42
+#define BENCH_ISLAND_SIZE	(1UL << 18)
+
+/* Globals of the game main program. */
+uint64_t rand_base_seed = BENCH_SEED;
+__thread struct urcu_game_rand thread_rand;
+int verbose, exit_program, clear_screen_enable;
+
+void thread_rand_init(enum rand_stream stream, unsigned long id)
+{
+	uint64_t x = ((uint64_t) stream << 56) ^ id;
+
+	urcu_game_rand_seed(&thread_rand,
+		rand_base_seed ^ urcu_game_rand_splitmix64(&x));
+}
+
+struct bench_thread {
+	pthread_t thread_id;
+	unsigned long id;
+	uint64_t nr_ops;
+	uint64_t sum;			/* keeps results alive */
+	struct perf_stats perf;
+};
+
+struct bench {
+	const char *name;
+	void (*fct)(struct bench_thread *bt);
+	void (*prepare)(void);		/* run before timing, or NULL */
+};
+
+static
+unsigned long nr_threads;
+
+static
+enum animal_index index_type;
+
+static
+uint64_t island_size = BENCH_ISLAND_SIZE;
+
+static
+pthread_barrier_t start_barrier;
+
+/* Populated island, and empty island. */
+static
+struct island *full_island, *empty_island;
+
+static
+void bench_hash(struct bench_thread *bt)
+{
+	uint64_t i;
+
+	for (i = 0; i < BENCH_OPS; i++) {
+		uint64_t key = i;
+
+		bt->sum += hash_u64(&key, BENCH_SEED);
+	}
+	bt->nr_ops = BENCH_OPS;
+}
+
+static
+void bench_config_get(struct bench_thread *bt)
+{
+	uint64_t i;
+
+	for (i = 0; i < BENCH_OPS; i++) {
+		rcu_read_lock();
+		bt->sum += urcu_game_config_get(full_island)->island_size;
+		rcu_read_unlock();
+	}
+	bt->nr_ops = BENCH_OPS;
+}
+
+static
+void find_keys(struct bench_thread *bt, struct island *island)
+{
+	uint64_t i;
+
+	for (i = 0; i < BENCH_OPS; i++) {
+		uint64_t key;
+
+		key = urcu_game_rand_bounded(&thread_rand, island_size);
+		rcu_read_lock();
+		bt->sum += find_animal(island, key) != NULL;
+		rcu_read_unlock();
+	}
+	bt->nr_ops = BENCH_OPS;
+}
+
+static
+void bench_find_hit(struct bench_thread *bt)
+{
+	find_keys(bt, full_island);
+}
+
+static
+void bench_find_miss(struct bench_thread *bt)
+{
+	find_keys(bt, empty_island);
+}
+
+static
+void bench_birth(struct bench_thread *bt)
+{
+	struct animal parent;
+	uint64_t key;
+
+	memset(&parent, 0, sizeof(parent));
+	for (key = bt->id; key < island_size; key += nr_threads) {
+		rcu_read_lock();
+		bt->sum += try_birth(empty_island, &parent, key, 1);
+		rcu_read_unlock();
+		bt->nr_ops++;
+	}
+}
+
+static
+void bench_kill(struct bench_thread *bt)
+{
+	uint64_t key;
+
+	for (key = bt->id; key < island_size; key += nr_threads) {
+		struct animal *animal;
+
+		rcu_read_lock();
+		animal = find_animal(empty_island, key);
+		if (animal) {
+			animal_lock(animal_get_lock(animal));
+			if (!animal->dead)
+				kill_animal(empty_island, animal);
+			animal_unlock(animal_get_lock(animal));
+			bt->sum++;
+		}
+		rcu_read_unlock();
+		bt->nr_ops++;
+	}
+}
+
+/*
+ * Work item round trip through a wait-free queue, as done between
+ * dispatch and worker threads: allocate, enqueue, dequeue, free. Each
+ * thread has its own queue, since a queue has a single consumer.
+ */
+static
+void bench_work_queue(struct bench_thread *bt)
+{
+	struct cds_wfcq_head head;
+	struct cds_wfcq_tail tail;
+	uint64_t i;
+
+	cds_wfcq_init(&head, &tail);
+	for (i = 0; i < BENCH_OPS; i++) {
+		struct urcu_game_work *work;
+		struct cds_wfcq_node *node;
+
+		work = calloc(1, sizeof(*work));
+		if (!work)
+			abort();
+		work->u.encounter.first_key = i;
+		work->enqueue_time = get_time_ns();
+		cds_wfcq_node_init(&work->q_node);
+		(void) cds_wfcq_enqueue(&head, &tail, &work->q_node);
+		node = __cds_wfcq_dequeue_blocking(&head, &tail);
+		work = caa_container_of(node, struct urcu_game_work, q_node);
+		bt->sum += work->u.encounter.first_key;
+		free(work);
+	}
+	bt->nr_ops = BENCH_OPS;
+}
+
+static
+void populate(struct island *island)
+{
+	struct animal parent;
+	uint64_t key;
+
+	memset(&parent, 0, sizeof(parent));
+	rcu_read_lock();
+	for (key = 0; key < island_size; key++) {
+		if (!try_birth(island, &parent, key, 1))
+			abort();
+	}
+	rcu_read_unlock();
+}
+
+static
+void clear_empty_island(void)
+{
+	apocalypse(empty_island);
+	rcu_barrier();
+}
+
+static
+void fill_empty_island(void)
+{
+	clear_empty_island();
+	populate(empty_island);
+}
+
+static
+const struct bench benches[] = {
+	{ "hash_u64",	bench_hash,		NULL },
+	{ "config_get",	bench_config_get,	NULL },
+	{ "find_hit",	bench_find_hit,		NULL },
+	{ "find_miss",	bench_find_miss,	clear_empty_island },
+	{ "birth",	bench_birth,		clear_empty_island },
+	{ "kill",	bench_kill,		fill_empty_island },
+	{ "work_queue",	bench_work_queue,	NULL },
+};
+
+static
+const struct bench *current_bench;
+
+static
+void *bench_thread_fct(void *data)
+{
+	struct bench_thread *bt = data;
+	struct perf_counters pc;
+
+	rcu_register_thread();
+	thread_rand_init(RAND_STREAM_WORKER, bt->id);
+	if (perf_counters_enable)
+		perf_counters_open(&pc);
+	pthread_barrier_wait(&start_barrier);
+	if (perf_counters_enable)
+		perf_counters_read(&pc, NULL, 0);
+	current_bench->fct(bt);
+	if (perf_counters_enable) {
+		perf_counters_read(&pc, &bt->perf, bt->nr_ops);
+		perf_counters_close(&pc);
+	}
+	mem_account_flush();
+	animal_arena_flush();
+	rcu_unregister_thread();
+	return NULL;
+}
+
+static
+void print_lock_prof(const struct lock_prof_stats *start)
+{
+	struct lock_prof_stats prof;
+	unsigned int i;
+
+	get_lock_prof_stats(&prof);
+	lock_prof_stats_sub(&prof, start);
+	for (i = 0; i < NR_LOCK_CLASSES; i++) {
+		struct lock_class_stats *cs = &prof.classes[i];
+		const char *name = lock_class_name(i);
+
+		if (!cs->nr_acquire)
+			continue;
+		printf(" lock_%s_acquire=%" PRIu64 " lock_%s_try_fail=%"
+			PRIu64 " lock_%s_wait_ns=%.1f lock_%s_hold_ns=%.1f",
+			name, cs->nr_acquire, name, cs->nr_try_fail,
+			name, (double) cs->wait_time / cs->nr_acquire,
+			name, (double) cs->hold_time / cs->nr_acquire);
+	}
+}
+
+/*
+ * Returns the throughput, in ops/s. Thread creation is not accounted.
+ */
+static
+double run_bench(const struct bench *bench, unsigned long nr,
+		double base_ops_per_s)
+{
+	struct bench_thread *threads;
+	struct perf_stats perf;
+	struct lock_prof_stats start_lock_prof;
+	uint64_t start, duration, nr_ops = 0;
+	double ops_per_s;
+	unsigned long i;
+	unsigned int j;
+
+	if (bench->prepare)
+		bench->prepare();
+	threads = calloc(nr, sizeof(*threads));
+	if (!threads)
+		abort();
+	if (lock_prof_enable)
+		get_lock_prof_stats(&start_lock_prof);
+	current_bench = bench;
+	nr_threads = nr;
+	if (pthread_barrier_init(&start_barrier, NULL, nr + 1))
+		abort();
+	for (i = 0; i < nr; i++) {
+		threads[i].id = i;
+		if (pthread_create(&threads[i].thread_id, NULL,
+				bench_thread_fct, &threads[i]))
+			abort();
+	}
+	pthread_barrier_wait(&start_barrier);
+	start = get_time_ns();
+	memset(&perf, 0, sizeof(perf));
+	for (i = 0; i < nr; i++) {
+		if (pthread_join(threads[i].thread_id, NULL))
+			abort();
+		nr_ops += threads[i].nr_ops;
+		for (j = 0; j < NR_PERF_COUNTERS; j++) {
+			perf.count[j] += threads[i].perf.count[j];
+			perf.nr_ops[j] += threads[i].perf.nr_ops[j];
+		}
+	}
+	/* Killed animals are only reclaimed after a grace period. */
+	if (bench->fct == bench_kill)
+		rcu_barrier();
+	duration = get_time_ns() - start;
+	if (pthread_barrier_destroy(&start_barrier))
+		abort();
+	free(threads);
+
+	ops_per_s = duration ? (double) nr_ops * 1e9 / duration : 0.0;
+	if (!base_ops_per_s)
+		base_ops_per_s = ops_per_s;
+	printf("bench=%s index=%s threads=%lu ops=%" PRIu64
+		" ns_per_op=%.1f ops_per_s=%.0f efficiency=%.2f",
+		bench->name,
+		index_type == ANIMAL_INDEX_ARRAY ? "array" : "lfht", nr, nr_ops,
+		nr_ops ? (double) duration * nr / nr_ops : 0.0,
+		ops_per_s,
+		base_ops_per_s ? ops_per_s / (nr * base_ops_per_s) : 0.0);
+	for (j = 0; perf_counters_enable && j < NR_PERF_COUNTERS; j++) {
+		const char *name = perf_counter_name(j);
+
+		if (!name)
+			continue;
+		printf(" %s_per_op=%.2f", name, perf_stats_per_op(&perf, j));
+	}
+	if (lock_prof_enable)
+		print_lock_prof(&start_lock_prof);
+	printf("\n");
+	fflush(stdout);
+	return ops_per_s;
+}
+
+static
+void set_island_size(struct island *island, uint64_t size)
+{
+	struct urcu_game_config *new_config;
+	uint64_t evicted, rehomed, key_limit;
+
+	new_config = urcu_game_config_update_begin(island);
+	if (!new_config)
+		abort();
+	new_config->island_size = size;
+	urcu_game_config_update_end(island, new_config);
+	/* Wait for the resize thread to cover the new keys. */
+	for (;;) {
+		get_island_resize_stats(island, &evicted, &rehomed,
+			&key_limit);
+		if (key_limit == size)
+			break;
+		poll(NULL, 0, 10);
+	}
+}
+
+/*
+ * Thread count following "nr": the next power of 2, or the number of
+ * online CPUs or max_threads if lower. Returns 0 after max_threads.
+ */
+static
+unsigned long next_nr_threads(unsigned long nr, unsigned long max_threads,
+		unsigned long nr_cpus)
+{
+	unsigned long next = 1;
+
+	while (next <= nr)
+		next <<= 1;
+	if (nr_cpus > nr && nr_cpus < next)
+		next = nr_cpus;
+	if (max_threads > nr && max_threads < next)
+		next = max_threads;
+	return next <= max_threads ? next : 0;
+}
+
+static
+void run_benches(enum animal_index index, unsigned long max_threads,
+		int ht_mmap)
+{
+	unsigned long nr, nr_cpus;
+	unsigned int i;
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	index_type = index;
+	if (create_islands(2, index, 1, ht_mmap))
+		abort();
+	full_island = &islands[0];
+	empty_island = &islands[1];
+	if (create_resize_thread())
+		abort();
+	set_island_size(full_island, island_size);
+	set_island_size(empty_island, island_size);
+	populate(full_island);
+
+	for (i = 0; i < sizeof(benches) / sizeof(*benches); i++) {
+		double base = 0;
+
+		for (nr = 1; nr; nr = next_nr_threads(nr, max_threads,
+				nr_cpus)) {
+			double ops_per_s;
+
+			ops_per_s = run_bench(&benches[i], nr, base);
+			if (nr == 1)
+				base = ops_per_s;
+		}
+	}
+
+	CMM_STORE_SHARED(exit_program, 1);
+	if (join_resize_thread() || destroy_islands())
+		abort();
+	CMM_STORE_SHARED(exit_program, 0);
+}
+
+int main(int argc, char **argv)
+{
+	enum animal_index index = ANIMAL_INDEX_LFHT;
+	enum animal_arena_type arena_type = ANIMAL_ARENA_NONE;
+	unsigned long max_threads;
+	int ht_mmap = 0, both = 0;
+
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (argc > 1)
+		max_threads = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		island_size = strtoull(argv[2], NULL, 0);
+	if (argc > 3) {
+		if (!strcmp(argv[3], "array"))
+			index = ANIMAL_INDEX_ARRAY;
+		else if (!strcmp(argv[3], "both"))
+			both = 1;
+		else if (strcmp(argv[3], "lfht"))
+			max_threads = 0;
+	}
+	if (argc > 4) {
+		if (!strcmp(argv[4], "thp"))
+			arena_type = ANIMAL_ARENA_THP;
+		else if (!strcmp(argv[4], "hugetlb"))
+			arena_type = ANIMAL_ARENA_HUGETLB;
+		else if (strcmp(argv[4], "none"))
+			max_threads = 0;
+	}
+	if (argc > 5) {
+		if (!strcmp(argv[5], "mmap"))
+			ht_mmap = 1;
+		else if (strcmp(argv[5], "default"))
+			max_threads = 0;
+	}
+	if (argc > 6) {
+		if (!strcmp(argv[6], "perf"))
+			perf_counters_enable = 1;
+		else if (strcmp(argv[6], "noperf"))
+			max_threads = 0;
+	}
+	if (argc > 7) {
+		if (!strcmp(argv[7], "lockprof"))
+			lock_prof_enable = 1;
+		else if (strcmp(argv[7], "nolockprof"))
+			max_threads = 0;
+	}
+	if ((index == ANIMAL_INDEX_ARRAY || both)
+			&& island_size > ANIMAL_ARRAY_MAX_SIZE)
+		island_size = 0;
+	if (!max_threads || !island_size) {
+		fprintf(stderr, "Usage: %s [max_threads] [island_size]"
+			" [lfht|array|both] [none|thp|hugetlb] [default|mmap]"
+			" [noperf|perf] [nolockprof|lockprof]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	rcu_register_thread();
+	thread_rand_init(RAND_STREAM_MAIN, 0);
+	if (perf_counters_enable)
+		perf_counters_init();
+	/*
+	 * Full island, and birth benchmark on the empty island, per index:
+	 * objects freed by the call_rcu thread stay in its cache.
+	 */
+	if (animal_arena_init(arena_type, sizeof(struct animal),
+			(both ? 4 : 2) * island_size
+			+ ANIMAL_ARENA_BATCH * max_threads))
+		abort();
+	if (species_load(NULL))
+		abort();
+	printf("# island_size=%" PRIu64 " arena=%s buckets=%s"
+		" seed=%d ops_per_thread=%lu\n", island_size,
+		animal_arena_type_name(arena_type),
+		ht_mmap ? "mmap" : "default", BENCH_SEED, BENCH_OPS);
+	if (both) {
+		run_benches(ANIMAL_INDEX_LFHT, max_threads, ht_mmap);
+		run_benches(ANIMAL_INDEX_ARRAY, max_threads, ht_mmap);
+	} else {
+		run_benches(index, max_threads, ht_mmap);
+	}
+
+	animal_arena_destroy();
+	lock_prof_destroy();
+	rcu_unregister_thread();
+	return EXIT_SUCCESS;
+}
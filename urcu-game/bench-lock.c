@@ -0,0 +1,180 @@
+/*
+ * bench-lock.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+/*
+ * Animal lock contention benchmark: threads repeatedly lock random
+ * pairs of animals in increasing key order, as lock_test_pair() does,
+ * for a few instructions. Build as bench-lock (spin-then-park lock) and
+ * bench-lock-mutex (pthread mutex) to compare. Without a thread count,
+ * runs powers of 2 up to 4 threads per online CPU, and one per CPU:
+ * contention only shows when several threads run at once, so compare
+ * on a multi-core host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "animal-lock.h"
+#include "urcu-game-rand.h"
+
+#define NR_OPS		(1UL << 20)	/* pair locks per thread */
+#define BENCH_SEED	42
+
+struct bench_animal {
+	struct animal_lock lock;
+	uint64_t stamina;
+} __attribute__((aligned(64)));
+
+struct bench_thread {
+	pthread_t thread_id;
+	unsigned long id;
+	struct animal_lock_stats stats;
+};
+
+static
+struct bench_animal *animals;
+
+static
+unsigned long nr_animals;
+
+static
+unsigned long nr_cpus;
+
+static
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		abort();
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static
+void *bench_thread_fct(void *data)
+{
+	struct bench_thread *bt = data;
+	struct urcu_game_rand r;
+	unsigned long i;
+
+	animal_lock_stats = &bt->stats;
+	urcu_game_rand_seed(&r, BENCH_SEED + bt->id);
+	for (i = 0; i < NR_OPS; i++) {
+		struct bench_animal *first, *second;
+		struct animal_lock *first_lock, *second_lock, *tmp;
+
+		first = &animals[urcu_game_rand_bounded(&r, nr_animals)];
+		second = &animals[urcu_game_rand_bounded(&r, nr_animals)];
+		first_lock = &first->lock;
+		second_lock = &second->lock;
+		if (first_lock > second_lock) {
+			tmp = first_lock;
+			first_lock = second_lock;
+			second_lock = tmp;
+		}
+		animal_lock(first_lock);
+		if (second_lock != first_lock)
+			animal_lock(second_lock);
+		first->stamina++;
+		second->stamina--;
+		if (second_lock != first_lock)
+			animal_unlock(second_lock);
+		animal_unlock(first_lock);
+	}
+	return NULL;
+}
+
+static
+void run_bench(unsigned long nr_threads)
+{
+	struct bench_thread *threads;
+	struct animal_lock_stats total = { 0 };
+	uint64_t start, duration;
+	unsigned long i;
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		abort();
+	for (i = 0; i < nr_animals; i++)
+		animal_lock_init(&animals[i].lock);
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].id = i;
+		if (pthread_create(&threads[i].thread_id, NULL,
+				bench_thread_fct, &threads[i]))
+			abort();
+	}
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_join(threads[i].thread_id, NULL))
+			abort();
+		total.nr_acquire += threads[i].stats.nr_acquire;
+		total.nr_contended += threads[i].stats.nr_contended;
+		total.nr_park += threads[i].stats.nr_park;
+	}
+	duration = now_ns() - start;
+
+#ifdef ANIMAL_LOCK_MUTEX
+	printf("lock=mutex");
+#else
+	printf("lock=adaptive");
+#endif
+	printf(" lock_bytes=%zu cpus=%lu threads=%lu animals=%lu"
+		" ns_per_pair=%.1f"
+		" acquire=%" PRIu64 " contended=%" PRIu64 " park=%" PRIu64 "\n",
+		sizeof(struct animal_lock), nr_cpus, nr_threads, nr_animals,
+		(double) duration / (NR_OPS * nr_threads),
+		total.nr_acquire, total.nr_contended, total.nr_park);
+	fflush(stdout);
+	free(threads);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long nr_threads = 0, nr;
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (argc > 1)
+		nr_threads = strtoul(argv[1], NULL, 0);
+	nr_animals = 16;
+	if (argc > 2)
+		nr_animals = strtoul(argv[2], NULL, 0);
+	if ((argc > 1 && !nr_threads) || !nr_animals) {
+		fprintf(stderr,
+			"Usage: %s [nr_threads] [nr_animals]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	animals = calloc(nr_animals, sizeof(*animals));
+	if (!animals)
+		abort();
+	if (nr_threads) {
+		run_bench(nr_threads);
+	} else {
+		/* Powers of 2 up to 4 threads per CPU, and one per CPU. */
+		for (nr = 1; nr <= 4 * nr_cpus; nr <<= 1) {
+			if (nr_cpus > nr >> 1 && nr_cpus < nr)
+				run_bench(nr_cpus);
+			run_bench(nr);
+		}
+	}
+	free(animals);
+	return EXIT_SUCCESS;
+}
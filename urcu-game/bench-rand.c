@@ -0,0 +1,201 @@
+/*
+ * bench-rand.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+/*
+ * Compare rand_r() with the game random number generator, for the key
+ * generation patterns used by the game. Single-threaded, fixed seed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include "urcu-game-rand.h"
+
+#define NR_LOOPS	(1UL << 24)
+#define BATCH_LEN	4096
+#define BENCH_SEED	42
+
+/*
+ * Batch generation: URCU_GAME_RAND_LANES independent xoshiro256**
+ * generators, advanced together with GCC vector extensions, which are
+ * lowered to the SIMD instructions available on the target (e.g. SSE2
+ * or AVX2), or to scalar code otherwise. Only benchmarked: without
+ * AVX2, it is slower than urcu_game_rand_bounded(), used by the game.
+ */
+#define URCU_GAME_RAND_LANES	4
+
+typedef uint64_t urcu_game_rand_vec
+	__attribute__((vector_size(URCU_GAME_RAND_LANES * sizeof(uint64_t))));
+
+struct urcu_game_rand_batch {
+	urcu_game_rand_vec s[4];
+};
+
+/* Macro rather than function: avoids passing vectors by value. */
+#define urcu_game_rand_vec_rotl(x, k)	(((x) << (k)) | ((x) >> (64 - (k))))
+
+/*
+ * Seed each lane from the scalar generator "r".
+ */
+static inline
+void urcu_game_rand_batch_seed(struct urcu_game_rand_batch *b,
+		struct urcu_game_rand *r)
+{
+	int i, j;
+
+	for (i = 0; i < URCU_GAME_RAND_LANES; i++) {
+		struct urcu_game_rand lane;
+
+		urcu_game_rand_seed(&lane, urcu_game_rand_u64(r));
+		for (j = 0; j < 4; j++)
+			b->s[j][i] = lane.s[j];
+	}
+}
+
+/*
+ * Generate URCU_GAME_RAND_LANES raw 64-bit values into "out".
+ */
+static inline
+void urcu_game_rand_batch_next(struct urcu_game_rand_batch *b, uint64_t *out)
+{
+	urcu_game_rand_vec *s = b->s, x, result, t;
+
+	/* "* 5" and "* 9" as shift and add: no 64-bit vector multiply. */
+	x = urcu_game_rand_vec_rotl((s[1] << 2) + s[1], 7);
+	result = (x << 3) + x;
+	t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = urcu_game_rand_vec_rotl(s[3], 45);
+	memcpy(out, &result, sizeof(result));
+}
+
+/*
+ * Fill "keys" with "nr" unbiased random values within [0, bound).
+ * Raw values are generated in vector batches, then reduced. The rare
+ * rejected values are replaced from the scalar generator "r".
+ */
+static inline
+void urcu_game_rand_fill_bounded(struct urcu_game_rand_batch *b,
+		struct urcu_game_rand *r, uint64_t *keys, size_t nr,
+		uint64_t bound)
+{
+	uint64_t v[URCU_GAME_RAND_LANES];
+	size_t i, j;
+
+	for (i = 0; i < nr; i += URCU_GAME_RAND_LANES) {
+		urcu_game_rand_batch_next(b, v);
+		for (j = 0; j < URCU_GAME_RAND_LANES && i + j < nr; j++) {
+			if (!urcu_game_rand_reduce(v[j], bound, &keys[i + j]))
+				keys[i + j] = urcu_game_rand_bounded(r, bound);
+		}
+	}
+}
+
+static
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		abort();
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static
+void report(const char *name, uint64_t start, uint64_t max_key,
+		uint64_t sum)
+{
+	uint64_t duration = now_ns() - start;
+
+	printf("%-24s %8.2f ns/key  max_key=%-20" PRIu64 " (checksum %" PRIx64 ")\n",
+		name, (double) duration / NR_LOOPS, max_key, sum);
+}
+
+int main(int argc, char **argv)
+{
+	static uint64_t keys[BATCH_LEN];
+	uint64_t bound = 2400, sum, max, start;
+	struct urcu_game_rand r;
+	struct urcu_game_rand_batch b;
+	unsigned int seed = BENCH_SEED;
+	unsigned long i, j;
+
+	if (argc > 1)
+		bound = strtoull(argv[1], NULL, 0);
+	if (!bound) {
+		fprintf(stderr, "Usage: %s [island_size]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	printf("island_size=%" PRIu64 " keys=%lu\n", bound, NR_LOOPS);
+
+	sum = max = 0;
+	start = now_ns();
+	for (i = 0; i < NR_LOOPS; i++) {
+		uint64_t key = rand_r(&seed) % bound;
+
+		sum += key;
+		if (key > max)
+			max = key;
+	}
+	report("rand_r %", start, max, sum);
+
+	urcu_game_rand_seed(&r, BENCH_SEED);
+	sum = max = 0;
+	start = now_ns();
+	for (i = 0; i < NR_LOOPS; i++) {
+		uint64_t key = urcu_game_rand_u64(&r) % bound;
+
+		sum += key;
+		if (key > max)
+			max = key;
+	}
+	report("xoshiro256** %", start, max, sum);
+
+	urcu_game_rand_seed(&r, BENCH_SEED);
+	sum = max = 0;
+	start = now_ns();
+	for (i = 0; i < NR_LOOPS; i++) {
+		uint64_t key = urcu_game_rand_bounded(&r, bound);
+
+		sum += key;
+		if (key > max)
+			max = key;
+	}
+	report("xoshiro256** bounded", start, max, sum);
+
+	urcu_game_rand_seed(&r, BENCH_SEED);
+	urcu_game_rand_batch_seed(&b, &r);
+	sum = max = 0;
+	start = now_ns();
+	for (i = 0; i < NR_LOOPS; i += BATCH_LEN) {
+		urcu_game_rand_fill_bounded(&b, &r, keys, BATCH_LEN, bound);
+		for (j = 0; j < BATCH_LEN; j++) {
+			sum += keys[j];
+			if (keys[j] > max)
+				max = keys[j];
+		}
+	}
+	report("xoshiro256** batch fill", start, max, sum);
+
+	return EXIT_SUCCESS;
+}
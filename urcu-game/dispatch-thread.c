@@ -14,95 +14,369 @@
  */
 
 #include <unistd.h>
+#include <string.h>
 #include <urcu/system.h>
 #include <urcu.h>
-#include <poll.h>
 #include "urcu-game.h"
 #include "urcu-game-config.h"
+#include "mem-account.h"
 #include "worker-thread.h"
+#include "dispatch-thread.h"
+#include "rcu-prof.h"
+
+/* Adaptive controller batch bounds, per worker per round. */
+#define MIN_BATCH	1
+#define MAX_BATCH	MAX_WQ_LEN
+
+/*
+ * Each dispatch thread owns a contiguous range of the active workers of
+ * the pool, recomputed each round since the pool can be resized.
+ */
+struct dispatch_thread {
+	pthread_t thread_id;
+	unsigned long id;
+	unsigned long first_worker;	/* in the pool of the current round */
+	unsigned long nr_workers;
+	struct dispatch_state state;
+	/* Statistics of owned workers at the previous round. */
+	struct worker_stats last_stats;
+	unsigned long last_generation;	/* of the pool of last_stats */
+} __attribute__((aligned(CAA_CACHE_LINE_SIZE)));
 
 static
-pthread_t dispatch_thread_id;
+struct dispatch_thread *dispatch_threads;
 
 static
-void do_dispatch(void)
+struct dispatch_attr dispatch_attr;
+
+unsigned long get_nr_dispatch_threads(void)
 {
-	struct urcu_game_config *config;
-	unsigned long i, nr_threads;
-	uint64_t island_size;
-	int ret;
+	return dispatch_attr.nr_threads;
+}
+
+void get_dispatch_thread_state(unsigned long thread_nr,
+		struct dispatch_state *state)
+{
+	struct dispatch_state *dstate = &dispatch_threads[thread_nr].state;
 
-	rcu_read_lock();
-	config = urcu_game_config_get();
-	island_size = config->island_size;
-	rcu_read_unlock();
+	state->batch = CMM_LOAD_SHARED(dstate->batch);
+	state->delay = CMM_LOAD_SHARED(dstate->delay);
+	state->q_len = CMM_LOAD_SHARED(dstate->q_len);
+	state->service_time = CMM_LOAD_SHARED(dstate->service_time);
+	state->nr_dispatched = CMM_LOAD_SHARED(dstate->nr_dispatched);
+	state->nr_shed = CMM_LOAD_SHARED(dstate->nr_shed);
+}
 
-	nr_threads = get_nr_worker_threads();
+/*
+ * Aggregate: counters are summed, batch, delay and service time are
+ * averaged, and q_len is the maximum over all dispatch threads.
+ */
+void get_dispatch_state(struct dispatch_state *state)
+{
+	unsigned long i, nr_threads = dispatch_attr.nr_threads;
+
+	memset(state, 0, sizeof(*state));
 	for (i = 0; i < nr_threads; i++) {
-		struct urcu_game_work *work;
+		struct dispatch_state dstate;
 
-		work = calloc(1, sizeof(*work));
-		if (!work)
-			abort();
-		work->first_key = rand_r(&thread_rand_seed) % island_size;
-		work->second_key = rand_r(&thread_rand_seed) % island_size;
-		ret = enqueue_work(i, work);
-		if (ret)
-			abort();
+		get_dispatch_thread_state(i, &dstate);
+		state->batch += dstate.batch;
+		state->delay += dstate.delay;
+		if (dstate.q_len > state->q_len)
+			state->q_len = dstate.q_len;
+		state->service_time += dstate.service_time;
+		state->nr_dispatched += dstate.nr_dispatched;
+		state->nr_shed += dstate.nr_shed;
+	}
+	if (nr_threads) {
+		state->batch /= nr_threads;
+		state->delay /= nr_threads;
+		state->service_time /= nr_threads;
+	}
+}
+
+static
+unsigned long max_q_len(struct dispatch_thread *dt, struct worker_pool *pool)
+{
+	unsigned long i, max = 0;
+
+	for (i = dt->first_worker; i < dt->first_worker + dt->nr_workers; i++) {
+		unsigned long q_len = get_worker_q_len(pool->workers[i]);
+
+		if (q_len > max)
+			max = q_len;
 	}
+	return max;
+}
+
+/*
+ * Sample owned worker queue depth and average work item service time.
+ * No service time sample is taken when owned workers changed since the
+ * previous round. Called with RCU read-side lock held.
+ */
+static
+void sample_workers(struct dispatch_thread *dt, struct worker_pool *pool)
+{
+	struct dispatch_state *state = &dt->state;
+	struct worker_stats stats;
+	uint64_t service_time = state->service_time;
+
+	get_worker_range_stats(pool, dt->first_worker, dt->nr_workers, &stats);
+	if (pool->generation == dt->last_generation
+			&& stats.nr_work > dt->last_stats.nr_work) {
+		uint64_t sample;
+
+		sample = (stats.busy_time - dt->last_stats.busy_time)
+			/ (stats.nr_work - dt->last_stats.nr_work);
+		/* Exponential moving average, weight 1/4. */
+		if (service_time)
+			service_time = (3 * service_time + sample) / 4;
+		else
+			service_time = sample;
+	}
+	dt->last_stats = stats;
+	dt->last_generation = pool->generation;
+
+	CMM_STORE_SHARED(state->q_len, max_q_len(dt, pool));
+	CMM_STORE_SHARED(state->service_time, service_time);
+}
+
+/*
+ * Closed-loop rate control. The batch size follows the queue depth:
+ * it grows slowly while the deepest queue is below target, and is
+ * halved when the target is exceeded. The delay between rounds is the
+ * time the workers need to service one batch, bounded by the configured
+ * step delay.
+ */
+static
+void adapt_dispatch(struct dispatch_thread *dt, unsigned int step_delay)
+{
+	struct dispatch_state *state = &dt->state;
+	unsigned long batch = state->batch;
+	uint64_t delay;
+
+	if (state->q_len > dispatch_attr.target_q_len) {
+		batch /= 2;
+		if (batch < MIN_BATCH)
+			batch = MIN_BATCH;
+	} else if (state->q_len < dispatch_attr.target_q_len / 2) {
+		batch += (batch >> 3) ? batch >> 3 : 1;
+		if (batch > MAX_BATCH)
+			batch = MAX_BATCH;
+	}
+
+	delay = batch * state->service_time / 1000000;
+	if (!delay)
+		delay = 1;
+	if (delay > step_delay)
+		delay = step_delay;
+
+	CMM_STORE_SHARED(state->batch, batch);
+	CMM_STORE_SHARED(state->delay, (unsigned int) delay);
+}
+
+/*
+ * Split the active workers of the pool between dispatch threads. The
+ * pool has at least as many active workers as there are dispatch
+ * threads.
+ */
+static
+void assign_workers(struct dispatch_thread *dt, struct worker_pool *pool)
+{
+	unsigned long nr_threads = dispatch_attr.nr_threads;
+
+	dt->first_worker = dt->id * pool->nr_active / nr_threads;
+	dt->nr_workers = (dt->id + 1) * pool->nr_active / nr_threads
+			- dt->first_worker;
+}
+
+/*
+ * Wait for a slot in the queue of "worker" outside of the RCU read-side
+ * critical section, so that a saturated worker does not delay grace
+ * periods. Returns 0 once "work" is queued, -1 if the pool changed
+ * meanwhile, or on exit: the worker may be retiring, so "work" is not
+ * queued. "*poolp" is updated to the current pool. Called with RCU
+ * read-side lock held.
+ */
+static
+int wait_enqueue_work(struct worker_pool **poolp,
+		struct worker_thread *worker, struct urcu_game_work *work)
+{
+	unsigned long generation = (*poolp)->generation;
+
+	while (try_enqueue_work(worker, work)) {
+		prof_rcu_read_unlock();
+		exit_wait(10);	/* sleep 10ms, or until exit */
+		prof_rcu_read_lock();
+		*poolp = get_worker_pool();
+		if ((*poolp)->generation != generation
+				|| CMM_LOAD_SHARED(exit_program))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Workers owned by a dispatch thread can belong to different islands:
+ * keys are drawn within the island of each worker. The round stops
+ * early if the pool changes while waiting for a queue slot. Called with
+ * RCU read-side lock held: "*poolp" is updated to the current pool.
+ */
+static
+void do_dispatch(struct dispatch_thread *dt, struct worker_pool **poolp)
+{
+	struct dispatch_state *state = &dt->state;
+	struct worker_pool *pool = *poolp;
+	unsigned long i, j, batch;
+	uint64_t nr_dispatched = 0, nr_shed = 0;
+	int ret;
+
+	batch = state->batch;
+	for (i = dt->first_worker; i < dt->first_worker + dt->nr_workers; i++) {
+		struct worker_thread *worker = pool->workers[i];
+		uint64_t island_size;
+
+		island_size = urcu_game_config_get(worker->island)
+				->island_size;
+		for (j = 0; j < batch; j++) {
+			struct urcu_game_work *work;
+
+			work = calloc(1, sizeof(*work));
+			if (!work)
+				abort();
+			mem_account(MEM_WORK, sizeof(*work));
+			work->op = WORK_ENCOUNTER;
+			work->u.encounter.first_key =
+				urcu_game_rand_bounded(&thread_rand,
+					island_size);
+			work->u.encounter.second_key =
+				urcu_game_rand_bounded(&thread_rand,
+					island_size);
+			if (dispatch_attr.load_shedding) {
+				ret = try_enqueue_work(worker, work);
+				if (ret > 0) {
+					/* Overloaded: drop encounter. */
+					mem_account(MEM_WORK,
+						-(long) sizeof(*work));
+					free(work);
+					nr_shed++;
+					continue;
+				}
+			} else if (wait_enqueue_work(poolp, worker, work)) {
+				mem_account(MEM_WORK, -(long) sizeof(*work));
+				free(work);
+				goto end;
+			}
+			nr_dispatched++;
+		}
+	}
+end:
+	CMM_STORE_SHARED(state->nr_dispatched,
+		state->nr_dispatched + nr_dispatched);
+	CMM_STORE_SHARED(state->nr_shed, state->nr_shed + nr_shed);
 }
 
 static
 void *dispatch_thread_fct(void *data)
 {
-	DBG("In user dispatch thread.");
+	struct dispatch_thread *dt = data;
+
+	DBG("In user dispatch thread id=%lu.", dt->id);
 	rcu_register_thread();
 
-	thread_rand_seed = time(NULL);
+	thread_rand_init(RAND_STREAM_DISPATCH, dt->id);
 
 	/* Read keys typed by the user */
 	while (!CMM_LOAD_SHARED(exit_program)) {
 		struct urcu_game_config *config;
-		int step_delay;
+		struct worker_pool *pool;
+		unsigned int step_delay;
 
 		DBG("Dispatch.");
-		do_dispatch();
+		/*
+		 * The pool can be resized concurrently: workers removed
+		 * from it are only stopped after a grace period, so they
+		 * keep draining their queue until then. Waits for a queue
+		 * slot are outside of the read-side critical section, and
+		 * can see a new pool.
+		 */
+		prof_rcu_read_lock();
+		pool = get_worker_pool();
+		assign_workers(dt, pool);
+		do_dispatch(dt, &pool);
+		assign_workers(dt, pool);
 
-		rcu_read_lock();
-		config = urcu_game_config_get();
+		/* Step delay of the island of the first owned worker. */
+		config = urcu_game_config_get(
+				pool->workers[dt->first_worker]->island);
 		step_delay = config->step_delay;
-		rcu_read_unlock();
 
-		/* sleep number of ms */
-		poll(NULL, 0, step_delay);
-	}
+		sample_workers(dt, pool);
+		prof_rcu_read_unlock();
+		if (dispatch_attr.adaptive) {
+			adapt_dispatch(dt, step_delay);
+			step_delay = dt->state.delay;
+		} else {
+			CMM_STORE_SHARED(dt->state.delay, step_delay);
+		}
 
-	/* Send worker thread stop message */
-	stop_worker_threads();
+		/* sleep number of ms, or until exit */
+		exit_wait(step_delay);
+	}
 
+	mem_account_flush();
 	rcu_unregister_thread();
-	DBG("User dispatch thread exiting.");
+	DBG("User dispatch thread id=%lu exiting.", dt->id);
 	return NULL;
 }
 
-int create_dispatch_thread(void)
+int create_dispatch_threads(const struct dispatch_attr *attr)
 {
+	unsigned long i, nr_workers;
 	int err;
 
-	err = pthread_create(&dispatch_thread_id, NULL,
-		dispatch_thread_fct, NULL);
-	if (err)
-		abort();
+	memcpy(&dispatch_attr, attr, sizeof(dispatch_attr));
+
+	nr_workers = get_nr_worker_threads();
+	if (!dispatch_attr.nr_threads || dispatch_attr.nr_threads > nr_workers)
+		return -1;
+	dispatch_threads = calloc(dispatch_attr.nr_threads,
+			sizeof(*dispatch_threads));
+	if (!dispatch_threads)
+		return -1;
+	for (i = 0; i < dispatch_attr.nr_threads; i++) {
+		struct dispatch_thread *dt = &dispatch_threads[i];
+
+		dt->id = i;
+		dt->state.batch = MIN_BATCH;
+		err = pthread_create(&dt->thread_id, NULL,
+			dispatch_thread_fct, dt);
+		if (err)
+			abort();
+	}
 	return 0;
 }
 
-int join_dispatch_thread(void)
+/*
+ * Once all dispatch threads are joined, no other thread pushes into the
+ * worker queues, so the stop message is the last work item received.
+ * Dispatch thread state is kept, since it can still be read by the
+ * output thread.
+ */
+int join_dispatch_threads(void)
 {
-	int ret;
-	void *tret;
+	unsigned long i;
+
+	for (i = 0; i < dispatch_attr.nr_threads; i++) {
+		void *tret;
+		int ret;
 
-	ret = pthread_join(dispatch_thread_id, &tret);
-	if (ret)
-		abort();
+		ret = pthread_join(dispatch_threads[i].thread_id, &tret);
+		if (ret)
+			abort();
+	}
+
+	/* Send worker thread stop message */
+	stop_worker_threads();
 	return 0;
 }
@@ -0,0 +1,57 @@
+#ifndef DISPATCH_THREAD_H
+#define DISPATCH_THREAD_H
+
+/*
+ * dispatch-thread.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+#include "worker-thread.h"
+
+#define DEFAULT_TARGET_Q_LEN	(MAX_WQ_LEN / 4)
+
+struct dispatch_attr {
+	unsigned long nr_threads;	/* number of dispatch threads */
+	int adaptive;			/* closed-loop rate control */
+	int load_shedding;		/* drop encounters on full queue */
+	unsigned long target_q_len;	/* adaptive queue depth target */
+};
+
+/*
+ * Dispatch controller state. Updated by the dispatch thread, can be
+ * read concurrently with get_dispatch_state().
+ */
+struct dispatch_state {
+	unsigned long batch;		/* work items per worker per round */
+	unsigned int delay;		/* delay between rounds, in ms */
+	unsigned long q_len;		/* max queue length at last round */
+	uint64_t service_time;		/* average work item cost, in ns */
+	uint64_t nr_dispatched;		/* work items enqueued */
+	uint64_t nr_shed;		/* work items dropped (overload) */
+};
+
+/*
+ * Worker threads need to be created first: they are split in contiguous
+ * ranges between the dispatch threads.
+ */
+int create_dispatch_threads(const struct dispatch_attr *attr);
+int join_dispatch_threads(void);
+
+unsigned long get_nr_dispatch_threads(void);
+void get_dispatch_thread_state(unsigned long thread_nr,
+		struct dispatch_state *state);
+/* Aggregated state of all dispatch threads. */
+void get_dispatch_state(struct dispatch_state *state);
+
+#endif /* DISPATCH_THREAD_H */
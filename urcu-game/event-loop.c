@@ -0,0 +1,201 @@
+/*
+ * event-loop.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+/*
+ * Interactive mode runs from a single epoll loop: terminal input, the
+ * screen refresh timer and the exit request are its event sources. The
+ * menu is modal: the loop waits while the user is in it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <urcu/system.h>
+#include "urcu-game.h"
+#include "mem-account.h"
+#include "animal-arena.h"
+
+enum event_source {
+	EVENT_INPUT,
+	EVENT_REFRESH,
+	EVENT_EXIT,
+};
+
+#define NR_EVENT_SOURCES	3
+
+unsigned int refresh_period = DEFAULT_REFRESH_PERIOD;
+
+/* Readable once exit is requested, -1 before init_exit_event(). */
+static
+int exit_fd = -1;
+
+int init_exit_event(void)
+{
+	exit_fd = eventfd(0, EFD_CLOEXEC);
+	if (exit_fd < 0) {
+		perror("eventfd");
+		return -1;
+	}
+	return 0;
+}
+
+void request_exit(void)
+{
+	uint64_t one = 1;
+
+	CMM_STORE_SHARED(exit_program, 1);
+	if (exit_fd >= 0 && write(exit_fd, &one, sizeof(one)) < 0)
+		perror("write");
+}
+
+void exit_wait(unsigned int ms)
+{
+	struct pollfd pfd = {
+		.fd = exit_fd,		/* ignored by poll() if -1 */
+		.events = POLLIN,
+	};
+
+	(void) poll(&pfd, 1, (int) ms);
+}
+
+static
+int add_event_source(int epfd, int fd, enum event_source source)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.u32 = source,
+	};
+
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * The first refresh is immediate, then every refresh_period ms.
+ */
+static
+int create_refresh_timer(void)
+{
+	struct itimerspec its = {
+		.it_interval.tv_sec = refresh_period / 1000,
+		.it_interval.tv_nsec = (refresh_period % 1000) * 1000000L,
+		.it_value.tv_nsec = 1,
+	};
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		perror("timerfd_create");
+		return -1;
+	}
+	if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+		perror("timerfd_settime");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static
+void handle_refresh(int timer_fd)
+{
+	uint64_t expirations;
+
+	/* Periods missed while in the menu are skipped. */
+	if (read(timer_fd, &expirations, sizeof(expirations)) < 0
+			&& errno != EAGAIN)
+		perror("read");
+	print_output();
+}
+
+int run_event_loop(void)
+{
+	int epfd, timer_fd, ret = 0;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		ret = -1;
+		goto end;
+	}
+	timer_fd = create_refresh_timer();
+	if (timer_fd < 0) {
+		ret = -1;
+		goto close_epoll;
+	}
+	if (add_event_source(epfd, timer_fd, EVENT_REFRESH)) {
+		perror("epoll_ctl");
+		ret = -1;
+		goto close_timer;
+	}
+	if (exit_fd >= 0 && add_event_source(epfd, exit_fd, EVENT_EXIT)) {
+		perror("epoll_ctl");
+		ret = -1;
+		goto close_timer;
+	}
+	/* Regular files cannot be polled: play without keyboard. */
+	if (add_event_source(epfd, 0, EVENT_INPUT))
+		fprintf(stderr, "Standard input cannot be polled, "
+			"keyboard disabled.\n");
+
+	input_begin();
+	while (!CMM_LOAD_SHARED(exit_program)) {
+		struct epoll_event events[NR_EVENT_SOURCES];
+		int i, nr;
+
+		nr = epoll_wait(epfd, events, NR_EVENT_SOURCES, -1);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			ret = -1;
+			break;
+		}
+		for (i = 0; i < nr; i++) {
+			switch (events[i].data.u32) {
+			case EVENT_INPUT:
+				if (handle_input() < 0) {
+					/* End of input: keep refreshing. */
+					DBG("End of user input.");
+					(void) epoll_ctl(epfd, EPOLL_CTL_DEL,
+						0, NULL);
+				}
+				break;
+			case EVENT_REFRESH:
+				handle_refresh(timer_fd);
+				break;
+			case EVENT_EXIT:
+				break;
+			}
+		}
+	}
+	input_end();
+
+	mem_account_flush();
+	animal_arena_flush();
+close_timer:
+	close(timer_fd);
+close_epoll:
+	close(epfd);
+end:
+	/* Stop the game on error too. */
+	request_exit();
+	DBG("Event loop exiting.");
+	return ret;
+}
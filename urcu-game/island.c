@@ -0,0 +1,226 @@
+/*
+ * island.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <urcu.h>
+#include <urcu/system.h>
+#include <urcu/rculfhash.h>
+#include "urcu-game.h"
+#include "urcu-game-config.h"
+#include "mem-account.h"
+#include "occupancy-map.h"
+#include "animal-array.h"
+#include "lock-prof.h"
+#include "rcu-prof.h"
+
+/*
+ * Maximum number of buckets of hash tables with the mmap backend, which
+ * reserves address space for all of them when the table is created.
+ */
+#define ANIMAL_HT_MMAP_MAX_BUCKETS	(1UL << 24)
+
+struct island *islands;
+unsigned long nr_islands;
+
+/* Bucket memory backend, NULL for the liburcu default. */
+static
+const struct cds_lfht_mm_type *animal_ht_mm;
+
+static
+struct cds_lfht *new_animal_ht(void)
+{
+	struct cds_lfht *ht;
+
+	if (animal_ht_mm)
+		ht = _cds_lfht_new(4096, 1, ANIMAL_HT_MMAP_MAX_BUCKETS,
+			CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING,
+			animal_ht_mm, &rcu_flavor, NULL);
+	else
+		ht = cds_lfht_new(4096, 1, 0,
+			CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING, NULL);
+	if (!ht)
+		abort();
+	return ht;
+}
+
+static
+void init_island(struct island *island, unsigned long id,
+		enum animal_index index, int occupancy_map_enable)
+{
+	struct live_animals *live_animals = &island->live_animals;
+	unsigned int i;
+
+	island->id = id;
+	island->vegetation.flowers = DEFAULT_VEGETATION_FLOWERS;
+	island->vegetation.trees = DEFAULT_VEGETATION_TREES;
+	pthread_mutex_init(&island->vegetation.lock, NULL);
+	pthread_mutex_init(&island->config_mutex, NULL);
+	cds_wfcq_init(&island->migrate_head, &island->migrate_tail);
+
+	init_game_config(island);
+
+	if (occupancy_map_enable)
+		occupancy_map_init(island, DEFAULT_ISLAND_SIZE);
+
+	live_animals->ht_seed = time(NULL);
+	live_animals->index = index;
+	switch (index) {
+	case ANIMAL_INDEX_LFHT:
+		live_animals->all = new_animal_ht();
+		break;
+	case ANIMAL_INDEX_ARRAY:
+		animal_array_init(island, DEFAULT_ISLAND_SIZE);
+		break;
+	}
+	for (i = 0; i < nr_species; i++)
+		live_animals->kind[i] = new_animal_ht();
+}
+
+int create_islands(unsigned long nr, enum animal_index index,
+		int occupancy_map_enable, int ht_mmap)
+{
+	unsigned long i;
+
+	animal_ht_mm = ht_mmap ? &cds_lfht_mm_mmap : NULL;
+	islands = calloc(nr, sizeof(*islands));
+	if (!islands)
+		return -1;
+	for (i = 0; i < nr; i++)
+		init_island(&islands[i], i, index, occupancy_map_enable);
+	nr_islands = nr;
+	return 0;
+}
+
+uint64_t island_max_size(struct island *island)
+{
+	if (island->live_animals.index == ANIMAL_INDEX_ARRAY)
+		return ANIMAL_ARRAY_MAX_SIZE;
+	return UINT64_MAX;
+}
+
+/*
+ * Kill all animals, then free the hash tables. Key-indexed structures
+ * are freed once in-flight call_rcu() work is completed.
+ */
+int destroy_islands(void)
+{
+	unsigned long i;
+	unsigned int j;
+	int err;
+
+	for (i = 0; i < nr_islands; i++) {
+		struct live_animals *live_animals = &islands[i].live_animals;
+
+		apocalypse(&islands[i]);
+
+		for (j = 0; j < nr_species; j++) {
+			err = cds_lfht_destroy(live_animals->kind[j], NULL);
+			if (err)
+				return err;
+		}
+		if (live_animals->all) {
+			err = cds_lfht_destroy(live_animals->all, NULL);
+			if (err)
+				return err;
+		}
+	}
+
+	/*
+	 * Clean exit: ensure in-flight call_rcu() work is completed.
+	 */
+	rcu_barrier();
+
+	for (i = 0; i < nr_islands; i++) {
+		occupancy_map_destroy(&islands[i]);
+		animal_array_destroy(&islands[i]);
+		if (islands[i].config)
+			mem_account_sync(MEM_CONFIG,
+				-(long) sizeof(*islands[i].config));
+		free(islands[i].config);
+	}
+	free(islands);
+	islands = NULL;
+	nr_islands = 0;
+	return 0;
+}
+
+/*
+ * Count the animals of a kind, and track the most contended animal
+ * lock. Called with RCU read-side lock held.
+ */
+static
+uint64_t count_kind(struct cds_lfht *ht, uint32_t *max_lock_contended)
+{
+	struct cds_lfht_iter iter;
+	struct animal *animal;
+	uint64_t count = 0;
+
+	cds_lfht_for_each_entry(ht, &iter, animal, kind_node) {
+		uint32_t contended = animal_lock_contended(
+			animal_get_lock(animal));
+
+		if (contended > *max_lock_contended)
+			*max_lock_contended = contended;
+		count++;
+	}
+	return count;
+}
+
+void get_island_census(struct island *island, struct island_census *census)
+{
+	unsigned int i;
+
+	memset(census->animals, 0, sizeof(census->animals));
+	census->max_lock_contended = 0;
+	prof_rcu_read_lock();
+	for (i = 0; i < nr_species; i++)
+		census->animals[i] = count_kind(island->live_animals.kind[i],
+			&census->max_lock_contended);
+	prof_rcu_read_unlock();
+
+	prof_mutex_lock(&island->vegetation.lock, LOCK_VEGETATION);
+	census->flowers = island->vegetation.flowers;
+	census->trees = island->vegetation.trees;
+	prof_mutex_unlock(&island->vegetation.lock, LOCK_VEGETATION);
+
+	census->nr_emigrated = CMM_LOAD_SHARED(island->nr_emigrated);
+	census->nr_immigrated = CMM_LOAD_SHARED(island->nr_immigrated);
+	census->nr_migrate_lost = CMM_LOAD_SHARED(island->nr_migrate_lost);
+	census->nr_exhausted = CMM_LOAD_SHARED(island->nr_exhausted);
+}
+
+void get_census(struct island_census *census)
+{
+	unsigned long i;
+	unsigned int j;
+
+	memset(census, 0, sizeof(*census));
+	for (i = 0; i < nr_islands; i++) {
+		struct island_census icensus;
+
+		get_island_census(&islands[i], &icensus);
+		for (j = 0; j < nr_species; j++)
+			census->animals[j] += icensus.animals[j];
+		census->flowers += icensus.flowers;
+		census->trees += icensus.trees;
+		census->nr_emigrated += icensus.nr_emigrated;
+		census->nr_immigrated += icensus.nr_immigrated;
+		census->nr_migrate_lost += icensus.nr_migrate_lost;
+		census->nr_exhausted += icensus.nr_exhausted;
+		if (icensus.max_lock_contended > census->max_lock_contended)
+			census->max_lock_contended = icensus.max_lock_contended;
+	}
+}
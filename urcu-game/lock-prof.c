@@ -0,0 +1,414 @@
+/*
+ * lock-prof.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <urcu/list.h>
+#include <urcu/system.h>
+#include "urcu-game.h"
+#include "lock-prof.h"
+
+/*
+ * Contended animal keys of a thread, hashed in HOT_KEY_SLOTS slots. A
+ * key colliding with another one decrements its count, and replaces
+ * it once the count reaches 0, so frequent keys stay.
+ */
+#define HOT_KEY_SLOT_BITS	8
+#define HOT_KEY_SLOTS		(1U << HOT_KEY_SLOT_BITS)
+
+/*
+ * Statistics of a thread, written by that thread only. Freed by
+ * lock_prof_thread_exit(), or lock_prof_destroy().
+ */
+struct lock_prof_thread {
+	struct cds_list_head node;	/* in lock_prof_threads */
+	struct lock_class_stats classes[NR_LOCK_CLASSES];
+	struct hot_lock_key hot_keys[HOT_KEY_SLOTS];
+	/* Same class locks are not nested. */
+	uint64_t acquire_time[NR_LOCK_CLASSES];
+};
+
+int lock_prof_enable;
+
+static
+CDS_LIST_HEAD(lock_prof_threads);
+
+/* Protects lock_prof_threads. */
+static
+pthread_mutex_t lock_prof_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread
+struct lock_prof_thread *thread_prof;
+
+/*
+ * Statistics of threads freed by lock_prof_thread_exit(), protected by
+ * lock_prof_threads_lock.
+ */
+static
+struct lock_class_stats exited_classes[NR_LOCK_CLASSES];
+static
+struct hot_lock_key exited_hot_keys[HOT_KEY_SLOTS];
+
+static const
+char *lock_class_names[NR_LOCK_CLASSES] = {
+	[LOCK_ANIMAL_PAIR] = "animal_pair",
+	[LOCK_ANIMAL_SINGLE] = "animal_single",
+	[LOCK_VEGETATION] = "vegetation",
+	[LOCK_CONFIG] = "config",
+};
+
+static
+struct lock_prof_thread *get_thread_prof(void)
+{
+	struct lock_prof_thread *prof = thread_prof;
+
+	if (caa_likely(prof))
+		return prof;
+	prof = calloc(1, sizeof(*prof));
+	if (!prof)
+		abort();
+	pthread_mutex_lock(&lock_prof_threads_lock);
+	cds_list_add(&prof->node, &lock_prof_threads);
+	pthread_mutex_unlock(&lock_prof_threads_lock);
+	thread_prof = prof;
+	return prof;
+}
+
+static
+void record_hot_key(struct lock_prof_thread *prof, unsigned long island,
+		uint64_t key)
+{
+	struct hot_lock_key *slot;
+	uint64_t hash;
+
+	hash = (key ^ ((uint64_t) island << 48)) * 0x9E3779B97F4A7C15ULL;
+	slot = &prof->hot_keys[hash >> (64 - HOT_KEY_SLOT_BITS)];
+	if (slot->nr_contended && (slot->key != key
+			|| slot->island != island)) {
+		CMM_STORE_SHARED(slot->nr_contended, slot->nr_contended - 1);
+		return;
+	}
+	CMM_STORE_SHARED(slot->key, key);
+	CMM_STORE_SHARED(slot->island, island);
+	CMM_STORE_SHARED(slot->nr_contended, slot->nr_contended + 1);
+}
+
+static
+unsigned int wait_bucket(uint64_t wait)
+{
+	unsigned int bucket = 0;
+
+	while (wait >>= 1)
+		bucket++;
+	return bucket;
+}
+
+/*
+ * "wait_start" is the time of the first failed try, if nr_try_fail is
+ * non-zero.
+ */
+static
+void account_acquire(struct lock_prof_thread *prof, enum lock_class class,
+		unsigned int nr_try_fail, uint64_t wait_start)
+{
+	struct lock_class_stats *stats = &prof->classes[class];
+	uint64_t now = get_time_ns();
+
+	CMM_STORE_SHARED(stats->nr_acquire, stats->nr_acquire + 1);
+	if (nr_try_fail) {
+		uint64_t wait = now - wait_start;
+		unsigned int bucket = wait_bucket(wait);
+
+		CMM_STORE_SHARED(stats->nr_try_fail,
+			stats->nr_try_fail + nr_try_fail);
+		CMM_STORE_SHARED(stats->wait_time, stats->wait_time + wait);
+		CMM_STORE_SHARED(stats->wait[bucket],
+			stats->wait[bucket] + 1);
+	}
+	prof->acquire_time[class] = now;
+}
+
+void lock_prof_animal_pair(unsigned long island,
+		struct animal_lock *first_lock, uint64_t first_key,
+		struct animal_lock *second_lock, uint64_t second_key)
+{
+	struct lock_prof_thread *prof = get_thread_prof();
+	unsigned int nr_try_fail = 0;
+	uint64_t wait_start = 0;
+
+	if (!animal_trylock(first_lock)) {
+		record_hot_key(prof, island, first_key);
+		wait_start = get_time_ns();
+		nr_try_fail++;
+		animal_lock(first_lock);
+	}
+	if (second_lock != first_lock && !animal_trylock(second_lock)) {
+		record_hot_key(prof, island, second_key);
+		if (!nr_try_fail)
+			wait_start = get_time_ns();
+		nr_try_fail++;
+		animal_lock(second_lock);
+	}
+	account_acquire(prof, LOCK_ANIMAL_PAIR, nr_try_fail, wait_start);
+}
+
+void lock_prof_animal_single(unsigned long island, struct animal_lock *lock,
+		uint64_t key)
+{
+	struct lock_prof_thread *prof = get_thread_prof();
+	unsigned int nr_try_fail = 0;
+	uint64_t wait_start = 0;
+
+	if (!animal_trylock(lock)) {
+		record_hot_key(prof, island, key);
+		wait_start = get_time_ns();
+		nr_try_fail++;
+		animal_lock(lock);
+	}
+	account_acquire(prof, LOCK_ANIMAL_SINGLE, nr_try_fail, wait_start);
+}
+
+void lock_prof_mutex_lock(pthread_mutex_t *mutex, enum lock_class class)
+{
+	struct lock_prof_thread *prof = get_thread_prof();
+	unsigned int nr_try_fail = 0;
+	uint64_t wait_start = 0;
+
+	if (pthread_mutex_trylock(mutex)) {
+		wait_start = get_time_ns();
+		nr_try_fail++;
+		pthread_mutex_lock(mutex);
+	}
+	account_acquire(prof, class, nr_try_fail, wait_start);
+}
+
+void lock_prof_release(enum lock_class class)
+{
+	struct lock_prof_thread *prof = get_thread_prof();
+	struct lock_class_stats *stats = &prof->classes[class];
+
+	CMM_STORE_SHARED(stats->hold_time, stats->hold_time
+		+ get_time_ns() - prof->acquire_time[class]);
+}
+
+static
+int compare_hot_keys(const void *a, const void *b)
+{
+	const struct hot_lock_key *ka = a, *kb = b;
+
+	if (ka->island != kb->island)
+		return ka->island < kb->island ? -1 : 1;
+	if (ka->key != kb->key)
+		return ka->key < kb->key ? -1 : 1;
+	return 0;
+}
+
+/* Insert "key" in "stats" hot keys, sorted most contended first. */
+static
+void insert_hot_key(struct lock_prof_stats *stats,
+		const struct hot_lock_key *key)
+{
+	unsigned int i;
+
+	i = stats->nr_hot_keys;
+	if (i == NR_HOT_LOCK_KEYS) {
+		if (key->nr_contended <= stats->hot_keys[i - 1].nr_contended)
+			return;
+		i--;	/* drop the least contended */
+	} else {
+		stats->nr_hot_keys++;
+	}
+	for (; i > 0 && stats->hot_keys[i - 1].nr_contended
+			< key->nr_contended; i--)
+		stats->hot_keys[i] = stats->hot_keys[i - 1];
+	stats->hot_keys[i] = *key;
+}
+
+/* Append the used slots of "slots" to "keys". */
+static
+size_t copy_hot_keys(struct hot_lock_key *keys, struct hot_lock_key *slots)
+{
+	size_t nr_keys = 0, i;
+
+	for (i = 0; i < HOT_KEY_SLOTS; i++) {
+		struct hot_lock_key *slot = &slots[i], *key = &keys[nr_keys];
+
+		key->nr_contended = CMM_LOAD_SHARED(slot->nr_contended);
+		if (!key->nr_contended)
+			continue;
+		key->key = CMM_LOAD_SHARED(slot->key);
+		key->island = CMM_LOAD_SHARED(slot->island);
+		nr_keys++;
+	}
+	return nr_keys;
+}
+
+/*
+ * Keys are summed over threads, by sorting the slots of all threads,
+ * exited ones included. Called with lock_prof_threads_lock held.
+ */
+static
+void merge_hot_keys(struct lock_prof_stats *stats, unsigned long nr_threads)
+{
+	struct lock_prof_thread *prof;
+	struct hot_lock_key *keys, *key;
+	size_t nr_keys, i;
+
+	keys = malloc((nr_threads + 1) * HOT_KEY_SLOTS * sizeof(*keys));
+	if (!keys)
+		abort();
+	nr_keys = copy_hot_keys(keys, exited_hot_keys);
+	cds_list_for_each_entry(prof, &lock_prof_threads, node)
+		nr_keys += copy_hot_keys(&keys[nr_keys], prof->hot_keys);
+	qsort(keys, nr_keys, sizeof(*keys), compare_hot_keys);
+	for (i = 0; i < nr_keys; i++) {
+		key = &keys[i];
+		while (i + 1 < nr_keys && !compare_hot_keys(key, &keys[i + 1]))
+			key->nr_contended += keys[++i].nr_contended;
+		insert_hot_key(stats, key);
+	}
+	free(keys);
+}
+
+/*
+ * Add the class statistics of a thread, possibly running, to "sum".
+ */
+static
+void sum_classes(struct lock_class_stats *sum, struct lock_class_stats *classes)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < NR_LOCK_CLASSES; i++) {
+		struct lock_class_stats *ss = &sum[i], *cs = &classes[i];
+
+		ss->nr_acquire += CMM_LOAD_SHARED(cs->nr_acquire);
+		ss->nr_try_fail += CMM_LOAD_SHARED(cs->nr_try_fail);
+		ss->wait_time += CMM_LOAD_SHARED(cs->wait_time);
+		ss->hold_time += CMM_LOAD_SHARED(cs->hold_time);
+		for (j = 0; j < NR_LOCK_WAIT_BUCKETS; j++)
+			ss->wait[j] += CMM_LOAD_SHARED(cs->wait[j]);
+	}
+}
+
+/*
+ * Slots of the same index hold keys of the same hash: same keys add up,
+ * and otherwise the most contended key stays, with the difference, as
+ * in record_hot_key().
+ */
+static
+void fold_hot_keys(struct hot_lock_key *exited, struct hot_lock_key *slots)
+{
+	unsigned int i;
+
+	for (i = 0; i < HOT_KEY_SLOTS; i++) {
+		struct hot_lock_key *slot = &slots[i], *dest = &exited[i];
+
+		if (!slot->nr_contended)
+			continue;
+		if (dest->key == slot->key && dest->island == slot->island) {
+			dest->nr_contended += slot->nr_contended;
+		} else if (dest->nr_contended >= slot->nr_contended) {
+			dest->nr_contended -= slot->nr_contended;
+		} else {
+			dest->key = slot->key;
+			dest->island = slot->island;
+			dest->nr_contended = slot->nr_contended
+					- dest->nr_contended;
+		}
+	}
+}
+
+void lock_prof_thread_exit(void)
+{
+	struct lock_prof_thread *prof = thread_prof;
+
+	if (!prof)
+		return;
+	pthread_mutex_lock(&lock_prof_threads_lock);
+	sum_classes(exited_classes, prof->classes);
+	fold_hot_keys(exited_hot_keys, prof->hot_keys);
+	cds_list_del(&prof->node);
+	pthread_mutex_unlock(&lock_prof_threads_lock);
+	thread_prof = NULL;
+	free(prof);
+}
+
+void get_lock_prof_stats(struct lock_prof_stats *stats)
+{
+	struct lock_prof_thread *prof;
+	unsigned long nr_threads = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	pthread_mutex_lock(&lock_prof_threads_lock);
+	sum_classes(stats->classes, exited_classes);
+	cds_list_for_each_entry(prof, &lock_prof_threads, node) {
+		sum_classes(stats->classes, prof->classes);
+		nr_threads++;
+	}
+	merge_hot_keys(stats, nr_threads);
+	pthread_mutex_unlock(&lock_prof_threads_lock);
+}
+
+void lock_prof_stats_sub(struct lock_prof_stats *stats,
+		const struct lock_prof_stats *start)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < NR_LOCK_CLASSES; i++) {
+		struct lock_class_stats *cs = &stats->classes[i];
+		const struct lock_class_stats *ss = &start->classes[i];
+
+		cs->nr_acquire -= ss->nr_acquire;
+		cs->nr_try_fail -= ss->nr_try_fail;
+		cs->wait_time -= ss->wait_time;
+		cs->hold_time -= ss->hold_time;
+		for (j = 0; j < NR_LOCK_WAIT_BUCKETS; j++)
+			cs->wait[j] -= ss->wait[j];
+	}
+}
+
+const char *lock_class_name(enum lock_class class)
+{
+	return lock_class_names[class];
+}
+
+uint64_t lock_wait_percentile(const struct lock_class_stats *stats,
+		unsigned int percent)
+{
+	uint64_t total = 0, threshold, count = 0;
+	unsigned int i;
+
+	for (i = 0; i < NR_LOCK_WAIT_BUCKETS; i++)
+		total += stats->wait[i];
+	if (!total)
+		return 0;
+	threshold = (total * percent + 99) / 100;
+	for (i = 0; i < NR_LOCK_WAIT_BUCKETS - 1; i++) {
+		count += stats->wait[i];
+		if (count >= threshold)
+			break;
+	}
+	return (2ULL << i) - 1;
+}
+
+void lock_prof_destroy(void)
+{
+	struct lock_prof_thread *prof, *tmp;
+
+	cds_list_for_each_entry_safe(prof, tmp, &lock_prof_threads, node) {
+		cds_list_del(&prof->node);
+		free(prof);
+	}
+}
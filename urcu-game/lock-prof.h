@@ -0,0 +1,116 @@
+#ifndef LOCK_PROF_H
+#define LOCK_PROF_H
+
+/*
+ * lock-prof.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <urcu/compiler.h>
+#include "animal-lock.h"
+
+/*
+ * Lock contention profiler, enabled with lock_prof_enable. Each lock is
+ * first tried: when held, the failure is counted and the wait timed.
+ * Hold time runs from acquisition to release. Each thread keeps its own
+ * statistics, without atomic operation, merged by readers.
+ */
+enum lock_class {
+	LOCK_ANIMAL_PAIR,		/* two animals of an encounter */
+	LOCK_ANIMAL_SINGLE,
+	LOCK_VEGETATION,		/* island vegetation.lock */
+	LOCK_CONFIG,			/* island config_mutex */
+	NR_LOCK_CLASSES,
+};
+
+/* Wait time histogram, in power of 2 nanoseconds buckets. */
+#define NR_LOCK_WAIT_BUCKETS	64
+
+/* Animal keys reported by contention. */
+#define NR_HOT_LOCK_KEYS	5
+
+struct lock_class_stats {
+	uint64_t nr_acquire;
+	uint64_t nr_try_fail;		/* locks found held */
+	uint64_t wait_time;		/* ns, after failed try */
+	uint64_t hold_time;		/* ns */
+	uint64_t wait[NR_LOCK_WAIT_BUCKETS];	/* of failed tries */
+};
+
+struct hot_lock_key {
+	uint64_t key;
+	uint64_t nr_contended;
+	unsigned long island;
+};
+
+struct lock_prof_stats {
+	struct lock_class_stats classes[NR_LOCK_CLASSES];
+	/* Approximate, since program start, most contended first. */
+	struct hot_lock_key hot_keys[NR_HOT_LOCK_KEYS];
+	unsigned int nr_hot_keys;
+};
+
+/* Set at startup. */
+extern int lock_prof_enable;
+
+/*
+ * Animal locks, taken in the given order. A pair of the same animal is
+ * locked once.
+ */
+void lock_prof_animal_pair(unsigned long island,
+		struct animal_lock *first_lock, uint64_t first_key,
+		struct animal_lock *second_lock, uint64_t second_key);
+void lock_prof_animal_single(unsigned long island, struct animal_lock *lock,
+		uint64_t key);
+void lock_prof_mutex_lock(pthread_mutex_t *mutex, enum lock_class class);
+/* Called before the lock is released. */
+void lock_prof_release(enum lock_class class);
+
+static inline
+void prof_mutex_lock(pthread_mutex_t *mutex, enum lock_class class)
+{
+	if (caa_unlikely(lock_prof_enable))
+		lock_prof_mutex_lock(mutex, class);
+	else
+		pthread_mutex_lock(mutex);
+}
+
+static inline
+void prof_mutex_unlock(pthread_mutex_t *mutex, enum lock_class class)
+{
+	if (caa_unlikely(lock_prof_enable))
+		lock_prof_release(class);
+	pthread_mutex_unlock(mutex);
+}
+
+/* Sum of all threads, including exited ones. */
+void get_lock_prof_stats(struct lock_prof_stats *stats);
+/* Subtract the class statistics of "start", hot keys are kept. */
+void lock_prof_stats_sub(struct lock_prof_stats *stats,
+		const struct lock_prof_stats *start);
+const char *lock_class_name(enum lock_class class);
+/* Upper bound of the histogram bucket, as for worker latency. */
+uint64_t lock_wait_percentile(const struct lock_class_stats *stats,
+		unsigned int percent);
+/*
+ * Fold the statistics of the current thread into the exited threads
+ * sum, and free them. Called by threads exiting before
+ * lock_prof_destroy(), with no profiled lock held.
+ */
+void lock_prof_thread_exit(void);
+/* Called after all threads taking profiled locks have been joined. */
+void lock_prof_destroy(void);
+
+#endif /* LOCK_PROF_H */
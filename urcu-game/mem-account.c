@@ -0,0 +1,81 @@
+/*
+ * mem-account.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <urcu/uatomic.h>
+#include "mem-account.h"
+
+/* Each counter on its own cache line: updated by all threads. */
+struct mem_counter {
+	long bytes;
+	long high;
+} __attribute__((aligned(CAA_CACHE_LINE_SIZE)));
+
+static
+struct mem_counter mem_counters[NR_MEM_CATEGORIES];
+
+__thread long mem_account_delta[NR_MEM_CATEGORIES];
+
+static const
+char *mem_category_names[NR_MEM_CATEGORIES] = {
+	[MEM_ANIMALS] = "animals",
+	[MEM_ANIMALS_RECLAIM] = "animals_reclaim",
+	[MEM_INDEX] = "index",
+	[MEM_WORK] = "work",
+	[MEM_CONFIG] = "config",
+	[MEM_CONFIG_RECLAIM] = "config_reclaim",
+	[MEM_MIGRANTS] = "migrants",
+};
+
+void mem_account_sync(enum mem_category category, long bytes)
+{
+	struct mem_counter *counter = &mem_counters[category];
+	long value, high, old;
+
+	value = uatomic_add_return(&counter->bytes, bytes);
+	high = uatomic_read(&counter->high);
+	while (value > high) {
+		old = uatomic_cmpxchg(&counter->high, high, value);
+		if (old == high)
+			break;
+		high = old;
+	}
+}
+
+void mem_account_flush(void)
+{
+	int i;
+
+	for (i = 0; i < NR_MEM_CATEGORIES; i++) {
+		if (!mem_account_delta[i])
+			continue;
+		mem_account_sync(i, mem_account_delta[i]);
+		mem_account_delta[i] = 0;
+	}
+}
+
+void get_mem_stats(struct mem_stats *stats)
+{
+	int i;
+
+	for (i = 0; i < NR_MEM_CATEGORIES; i++) {
+		stats->bytes[i] = uatomic_read(&mem_counters[i].bytes);
+		stats->high[i] = uatomic_read(&mem_counters[i].high);
+	}
+}
+
+const char *mem_category_name(enum mem_category category)
+{
+	return mem_category_names[category];
+}
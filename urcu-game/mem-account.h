@@ -0,0 +1,73 @@
+#ifndef MEM_ACCOUNT_H
+#define MEM_ACCOUNT_H
+
+/*
+ * mem-account.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+#include <urcu/compiler.h>
+
+/*
+ * Memory accounting, in bytes, by subsystem, with high-water marks.
+ */
+enum mem_category {
+	MEM_ANIMALS,		/* live animals */
+	MEM_ANIMALS_RECLAIM,	/* killed animals waiting for call_rcu */
+	MEM_INDEX,		/* occupancy maps and animal arrays */
+	MEM_WORK,		/* work items queued to workers */
+	MEM_CONFIG,		/* current island configurations */
+	MEM_CONFIG_RECLAIM,	/* replaced configurations, before free */
+	MEM_MIGRANTS,		/* animals travelling between islands */
+	NR_MEM_CATEGORIES,
+};
+
+/*
+ * Frequent updates are batched per thread, and added to the global
+ * counter once they exceed MEM_ACCOUNT_BATCH bytes: counters are exact
+ * within MEM_ACCOUNT_BATCH bytes per thread and category.
+ */
+#define MEM_ACCOUNT_BATCH	(64 * 1024)
+
+struct mem_stats {
+	int64_t bytes[NR_MEM_CATEGORIES];
+	int64_t high[NR_MEM_CATEGORIES];	/* high-water mark */
+};
+
+extern __thread long mem_account_delta[NR_MEM_CATEGORIES];
+
+/* Add "bytes" (may be negative) to the global counter, now. */
+void mem_account_sync(enum mem_category category, long bytes);
+
+/* Add "bytes" (may be negative) to the counter, batched. */
+static inline
+void mem_account(enum mem_category category, long bytes)
+{
+	long delta = mem_account_delta[category] + bytes;
+
+	if (caa_unlikely(delta > MEM_ACCOUNT_BATCH
+			|| delta < -MEM_ACCOUNT_BATCH)) {
+		mem_account_sync(category, delta);
+		delta = 0;
+	}
+	mem_account_delta[category] = delta;
+}
+
+/* Flush the batched updates of the current thread, before it exits. */
+void mem_account_flush(void);
+
+void get_mem_stats(struct mem_stats *stats);
+const char *mem_category_name(enum mem_category category);
+
+#endif /* MEM_ACCOUNT_H */
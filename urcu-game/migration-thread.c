@@ -0,0 +1,140 @@
+/*
+ * migration-thread.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <poll.h>
+#include <urcu.h>
+#include <urcu/system.h>
+#include <urcu/wfcqueue.h>
+#include "urcu-game.h"
+#include "mem-account.h"
+#include "animal-arena.h"
+#include "rcu-prof.h"
+
+/* Polling period of the migration queues, in ms. */
+#define MIGRATION_POLL_DELAY	10
+
+uint64_t migration_rate = DEFAULT_MIGRATION_RATE;
+
+static
+pthread_t migration_thread_id;
+
+/*
+ * Workers of any island can enqueue concurrently: wait-free enqueue.
+ * The migration thread is the only consumer.
+ */
+void migrate_enqueue(struct island *dest, struct migrant *migrant)
+{
+	cds_wfcq_node_init(&migrant->q_node);
+	(void) cds_wfcq_enqueue(&dest->migrate_head, &dest->migrate_tail,
+			&migrant->q_node);
+}
+
+static
+struct migrant *migrate_dequeue(struct island *island)
+{
+	struct cds_wfcq_node *node;
+
+	node = __cds_wfcq_dequeue_blocking(&island->migrate_head,
+			&island->migrate_tail);
+	if (!node)
+		return NULL;
+	return caa_container_of(node, struct migrant, q_node);
+}
+
+/*
+ * Returns the number of migrants handled.
+ */
+static
+unsigned long settle_migrants(struct island *island)
+{
+	struct migrant *migrant;
+	unsigned long nr = 0;
+
+	while ((migrant = migrate_dequeue(island)) != NULL) {
+		int ret;
+
+		prof_rcu_read_lock();
+		ret = immigrate_animal(island, migrant);
+		prof_rcu_read_unlock();
+		if (ret)
+			CMM_STORE_SHARED(island->nr_immigrated,
+				island->nr_immigrated + 1);
+		else
+			CMM_STORE_SHARED(island->nr_migrate_lost,
+				island->nr_migrate_lost + 1);
+		mem_account(MEM_MIGRANTS, -(long) sizeof(*migrant));
+		free(migrant);
+		nr++;
+	}
+	return nr;
+}
+
+static
+void *migration_thread_fct(void *data)
+{
+	DBG("In migration thread.");
+	rcu_register_thread();
+	thread_rand_init(RAND_STREAM_MIGRATION, 0);
+
+	while (!CMM_LOAD_SHARED(exit_program)) {
+		unsigned long i, nr = 0;
+
+		for (i = 0; i < nr_islands; i++)
+			nr += settle_migrants(&islands[i]);
+		if (!nr)
+			poll(NULL, 0, MIGRATION_POLL_DELAY);
+	}
+
+	mem_account_flush();
+	animal_arena_flush();
+	rcu_unregister_thread();
+	DBG("Migration thread exiting.");
+	return NULL;
+}
+
+int create_migration_thread(void)
+{
+	int err;
+
+	err = pthread_create(&migration_thread_id, NULL,
+		migration_thread_fct, NULL);
+	if (err)
+		abort();
+	return 0;
+}
+
+/*
+ * Once workers are joined, nothing is enqueued anymore: free the
+ * migrants still in transit.
+ */
+int join_migration_thread(void)
+{
+	unsigned long i;
+	int ret;
+	void *tret;
+
+	ret = pthread_join(migration_thread_id, &tret);
+	if (ret)
+		abort();
+	for (i = 0; i < nr_islands; i++) {
+		struct migrant *migrant;
+
+		while ((migrant = migrate_dequeue(&islands[i])) != NULL) {
+			mem_account(MEM_MIGRANTS, -(long) sizeof(*migrant));
+			free(migrant);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * occupancy-map.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <urcu.h>
+#include "urcu-game.h"
+#include "occupancy-map.h"
+#include "mem-account.h"
+#include "rcu-prof.h"
+
+static
+size_t map_bytes(uint64_t island_size)
+{
+	uint64_t nr_longs;
+
+	nr_longs = (island_size + OCCUPANCY_BITS_PER_LONG - 1)
+			/ OCCUPANCY_BITS_PER_LONG;
+	return sizeof(struct occupancy_map) + nr_longs * sizeof(unsigned long);
+}
+
+static
+struct occupancy_map *alloc_map(uint64_t island_size)
+{
+	struct occupancy_map *map;
+
+	if (island_size > OCCUPANCY_MAP_MAX_SIZE)
+		island_size = OCCUPANCY_MAP_MAX_SIZE;
+	map = calloc(1, map_bytes(island_size));
+	if (!map)
+		abort();
+	map->size = island_size;
+	mem_account_sync(MEM_INDEX, map_bytes(island_size));
+	return map;
+}
+
+static
+void free_map(struct occupancy_map *map)
+{
+	if (!map)
+		return;
+	mem_account_sync(MEM_INDEX, -(long) map_bytes(map->size));
+	free(map);
+}
+
+void occupancy_map_init(struct island *island, uint64_t island_size)
+{
+	rcu_set_pointer(&island->occupancy_map, alloc_map(island_size));
+}
+
+/*
+ * Bits set in the old map by updaters which had not seen the new map
+ * yet are recovered after a grace period: all updaters then use the new
+ * map, and the old map bits are ORed into it. Until then, the new map
+ * is settling: every key is possibly occupied. Bits cleared in the old
+ * map only can stay set, which are harmless false positives.
+ */
+void occupancy_map_resize(struct island *island, uint64_t island_size)
+{
+	struct occupancy_map *old_map, *new_map;
+	uint64_t nr_longs, nr_keys, i;
+
+	old_map = island->occupancy_map;
+	if (!old_map)
+		return;
+	new_map = alloc_map(island_size);
+	if (new_map->size == old_map->size) {
+		free_map(new_map);
+		return;
+	}
+	nr_keys = old_map->size < new_map->size ?
+			old_map->size : new_map->size;
+	nr_longs = (nr_keys + OCCUPANCY_BITS_PER_LONG - 1)
+			/ OCCUPANCY_BITS_PER_LONG;
+	new_map->settling = 1;
+	memcpy(new_map->bits, old_map->bits, nr_longs * sizeof(unsigned long));
+	rcu_set_pointer(&island->occupancy_map, new_map);
+	prof_synchronize_rcu();
+
+	for (i = 0; i < nr_longs; i++) {
+		unsigned long bits = old_map->bits[i];
+
+		if (bits)
+			uatomic_or(&new_map->bits[i], bits);
+	}
+	cmm_smp_wmb();	/* Write bits before settling. */
+	CMM_STORE_SHARED(new_map->settling, 0);
+	free_map(old_map);
+}
+
+void occupancy_map_destroy(struct island *island)
+{
+	free_map(island->occupancy_map);
+	island->occupancy_map = NULL;
+}
@@ -0,0 +1,101 @@
+#ifndef OCCUPANCY_MAP_H
+#define OCCUPANCY_MAP_H
+
+/*
+ * occupancy-map.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+#include <urcu.h>
+#include <urcu/compiler.h>
+#include <urcu/uatomic.h>
+#include "urcu-game.h"
+
+/*
+ * Occupancy map: one bit per island key, set while an animal lives at
+ * that key. Lets lookups of empty keys skip the hash table.
+ *
+ * The map can only have false positives (bit set for an empty key),
+ * never false negatives for settled animals: the bit is set after the
+ * animal is added to the "all animals" hash table, and cleared before
+ * it is removed. Keys beyond the map size, and all keys of a map still
+ * settling after a resize, are reported as possibly occupied.
+ *
+ * Each island has its own map, published with RCU. All accessors need
+ * to be called within RCU read-side critical section.
+ */
+
+/* Larger islands only track their first keys (512MB map). */
+#define OCCUPANCY_MAP_MAX_SIZE		(1ULL << 32)
+
+#define OCCUPANCY_BITS_PER_LONG		(sizeof(unsigned long) * 8)
+
+struct occupancy_map {
+	uint64_t size;			/* number of keys tracked */
+	int settling;			/* bits not complete yet */
+	unsigned long bits[];
+};
+
+static inline
+int occupancy_map_test(struct island *island, uint64_t key)
+{
+	struct occupancy_map *map = rcu_dereference(island->occupancy_map);
+
+	if (!map || key >= map->size || CMM_LOAD_SHARED(map->settling))
+		return 1;
+	cmm_smp_rmb();	/* Read settling before bits. */
+	return !!(CMM_LOAD_SHARED(map->bits[key / OCCUPANCY_BITS_PER_LONG])
+		& (1UL << (key % OCCUPANCY_BITS_PER_LONG)));
+}
+
+static inline
+void occupancy_map_set(struct island *island, uint64_t key)
+{
+	struct occupancy_map *map = rcu_dereference(island->occupancy_map);
+
+	if (!map || key >= map->size)
+		return;
+	uatomic_or(&map->bits[key / OCCUPANCY_BITS_PER_LONG],
+		1UL << (key % OCCUPANCY_BITS_PER_LONG));
+}
+
+static inline
+void occupancy_map_clear(struct island *island, uint64_t key)
+{
+	struct occupancy_map *map = rcu_dereference(island->occupancy_map);
+
+	if (!map || key >= map->size)
+		return;
+	uatomic_and(&map->bits[key / OCCUPANCY_BITS_PER_LONG],
+		~(1UL << (key % OCCUPANCY_BITS_PER_LONG)));
+}
+
+/*
+ * Create the map. Without map, every key is reported as possibly
+ * occupied.
+ */
+void occupancy_map_init(struct island *island, uint64_t island_size);
+
+/*
+ * Grow or shrink the map to cover a new island size. Called from the
+ * resize thread only, outside of RCU read-side critical section.
+ */
+void occupancy_map_resize(struct island *island, uint64_t island_size);
+
+/*
+ * Called after all threads using the map have been joined.
+ */
+void occupancy_map_destroy(struct island *island);
+
+#endif /* OCCUPANCY_MAP_H */
@@ -0,0 +1,246 @@
+/*
+ * perf-counters.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+#include <urcu/system.h>
+#include <urcu/uatomic.h>
+#include "perf-counters.h"
+
+enum perf_source {
+	PERF_SOURCE_NONE,
+	PERF_SOURCE_EVENT,		/* perf_event_open() */
+	PERF_SOURCE_CPU_CLOCK,		/* thread CPU time, in ns */
+	PERF_SOURCE_RUSAGE,		/* getrusage() context switches */
+};
+
+struct perf_counter_desc {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+	enum perf_source fallback;
+	const char *fallback_name;
+};
+
+static const
+struct perf_counter_desc perf_counter_descs[NR_PERF_COUNTERS] = {
+	[PERF_CYCLES] = {
+		"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+		PERF_SOURCE_CPU_CLOCK, "cpu_ns",
+	},
+	[PERF_INSTRUCTIONS] = {
+		"instructions", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_SOURCE_NONE, NULL,
+	},
+	[PERF_LLC_MISSES] = {
+		"llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,
+		PERF_SOURCE_NONE, NULL,
+	},
+	[PERF_DTLB_MISSES] = {
+		"dtlb_misses", PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_DTLB
+			| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+			| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+		PERF_SOURCE_NONE, NULL,
+	},
+	[PERF_CONTEXT_SWITCHES] = {
+		"context_switches", PERF_TYPE_SOFTWARE,
+		PERF_COUNT_SW_CONTEXT_SWITCHES,
+		PERF_SOURCE_RUSAGE, "context_switches",
+	},
+};
+
+int perf_counters_enable;
+
+/* Set by perf_counters_init(), then read-only. */
+static
+enum perf_source perf_sources[NR_PERF_COUNTERS];
+
+/* Events which failed to open in a thread, reported once. */
+static
+int perf_open_failed[NR_PERF_COUNTERS];
+
+/*
+ * Counts the calling thread on any CPU. Context switches happen in the
+ * kernel: only hardware counters exclude it.
+ */
+static
+int open_event(enum perf_counter counter)
+{
+	const struct perf_counter_desc *desc = &perf_counter_descs[counter];
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = desc->type;
+	attr.config = desc->config;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+			| PERF_FORMAT_TOTAL_TIME_RUNNING;
+	if (desc->type != PERF_TYPE_SOFTWARE) {
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+	}
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1,
+		PERF_FLAG_FD_CLOEXEC);
+}
+
+void perf_counters_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_PERF_COUNTERS; i++) {
+		const struct perf_counter_desc *desc = &perf_counter_descs[i];
+		int fd;
+
+		fd = open_event(i);
+		if (fd >= 0) {
+			close(fd);
+			perf_sources[i] = PERF_SOURCE_EVENT;
+			continue;
+		}
+		perf_sources[i] = desc->fallback;
+		if (desc->fallback != PERF_SOURCE_NONE)
+			fprintf(stderr, "Cannot count %s (%s), counting %s "
+				"instead.\n", desc->name, strerror(errno),
+				desc->fallback_name);
+		else
+			fprintf(stderr, "Cannot count %s (%s).\n",
+				desc->name, strerror(errno));
+	}
+}
+
+/*
+ * Multiplexed events are scaled to their enabled time. Returns -1 if
+ * the counter cannot be read.
+ */
+static
+int read_counter(struct perf_counters *pc, enum perf_counter counter,
+		uint64_t *value)
+{
+	switch (perf_sources[counter]) {
+	case PERF_SOURCE_EVENT:
+	{
+		uint64_t buf[3];	/* value, time enabled, time running */
+
+		if (pc->fd[counter] < 0 || read(pc->fd[counter], buf,
+				sizeof(buf)) != sizeof(buf) || !buf[2])
+			return -1;
+		*value = buf[0];
+		if (buf[2] < buf[1])
+			*value = (double) buf[0] * buf[1] / buf[2];
+		return 0;
+	}
+	case PERF_SOURCE_CPU_CLOCK:
+	{
+		struct timespec ts;
+
+		if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+			return -1;
+		*value = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		return 0;
+	}
+	case PERF_SOURCE_RUSAGE:
+	{
+		struct rusage ru;
+
+		if (getrusage(RUSAGE_THREAD, &ru))
+			return -1;
+		*value = ru.ru_nvcsw + ru.ru_nivcsw;
+		return 0;
+	}
+	default:
+		return -1;
+	}
+}
+
+void perf_counters_open(struct perf_counters *pc)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_PERF_COUNTERS; i++) {
+		pc->fd[i] = -1;
+		pc->last[i] = 0;
+		if (perf_sources[i] != PERF_SOURCE_EVENT)
+			continue;
+		pc->fd[i] = open_event(i);
+		if (pc->fd[i] < 0 && !uatomic_xchg(&perf_open_failed[i], 1))
+			fprintf(stderr, "Cannot count %s in some threads (%s), "
+				"averaging over the other threads.\n",
+				perf_counter_descs[i].name, strerror(errno));
+	}
+	perf_counters_read(pc, NULL, 0);
+}
+
+void perf_counters_close(struct perf_counters *pc)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_PERF_COUNTERS; i++) {
+		if (pc->fd[i] >= 0)
+			close(pc->fd[i]);
+		pc->fd[i] = -1;
+	}
+}
+
+void perf_counters_read(struct perf_counters *pc, struct perf_stats *stats,
+		uint64_t nr_ops)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_PERF_COUNTERS; i++) {
+		uint64_t value;
+
+		if (read_counter(pc, i, &value))
+			continue;
+		if (stats)
+			CMM_STORE_SHARED(stats->nr_ops[i],
+				stats->nr_ops[i] + nr_ops);
+		/* Scaled values may go slightly backwards. */
+		if (value <= pc->last[i])
+			continue;
+		if (stats)
+			CMM_STORE_SHARED(stats->count[i],
+				stats->count[i] + value - pc->last[i]);
+		pc->last[i] = value;
+	}
+}
+
+double perf_stats_per_op(const struct perf_stats *stats,
+		enum perf_counter counter)
+{
+	if (!stats->nr_ops[counter])
+		return 0.0;
+	return (double) stats->count[counter] / stats->nr_ops[counter];
+}
+
+const char *perf_counter_name(enum perf_counter counter)
+{
+	switch (perf_sources[counter]) {
+	case PERF_SOURCE_EVENT:
+		return perf_counter_descs[counter].name;
+	case PERF_SOURCE_NONE:
+		return NULL;
+	default:
+		return perf_counter_descs[counter].fallback_name;
+	}
+}
@@ -0,0 +1,82 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+/*
+ * perf-counters.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+
+/*
+ * Per-thread counters, from perf_event_open() in user-space only. When
+ * hardware counters cannot be opened (perf_event_paranoid, virtual
+ * machine), cycles fall back to the thread CPU time in ns, and context
+ * switches to getrusage(): the other counters are then not counted.
+ */
+enum perf_counter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,	/* last level cache */
+	PERF_DTLB_MISSES,	/* data TLB load misses */
+	PERF_CONTEXT_SWITCHES,
+	NR_PERF_COUNTERS,
+};
+
+/* Counters of a thread, used by that thread only. */
+struct perf_counters {
+	int fd[NR_PERF_COUNTERS];		/* perf event, or -1 */
+	uint64_t last[NR_PERF_COUNTERS];	/* at last read */
+};
+
+/*
+ * Updated by the owner thread with CMM_STORE_SHARED. Operations are
+ * only counted by the counters that could be read: a thread failing to
+ * open an event does not lower the per operation average.
+ */
+struct perf_stats {
+	uint64_t count[NR_PERF_COUNTERS];
+	uint64_t nr_ops[NR_PERF_COUNTERS];	/* operations counted */
+};
+
+extern int perf_counters_enable;
+
+/*
+ * Choose the source of each counter, reporting on stderr those which
+ * fall back to software or are not counted. Called once before the
+ * threads open their counters.
+ */
+void perf_counters_init(void);
+
+/*
+ * Open the counters of the calling thread, and take a first reading.
+ * An event failing to open for this thread is not counted by it.
+ */
+void perf_counters_open(struct perf_counters *pc);
+void perf_counters_close(struct perf_counters *pc);
+
+/*
+ * Add the counts since the previous reading, over "nr_ops" operations,
+ * to "stats", unless it is NULL: this starts a new measured span.
+ */
+void perf_counters_read(struct perf_counters *pc, struct perf_stats *stats,
+		uint64_t nr_ops);
+
+/* Average count per operation, 0 if none was counted. */
+double perf_stats_per_op(const struct perf_stats *stats,
+		enum perf_counter counter);
+
+/* Name of the counter as counted, NULL if not counted. */
+const char *perf_counter_name(enum perf_counter counter);
+
+#endif /* PERF_COUNTERS_H */
@@ -21,99 +21,243 @@
 #include <urcu/rculfhash.h>
 #include "urcu-game.h"
 #include "urcu-game-config.h"
-
-int hide_output;
-/* Protect output to screen */
-pthread_mutex_t print_output_mutex = PTHREAD_MUTEX_INITIALIZER;
+#include "dispatch-thread.h"
+#include "mem-account.h"
+#include "animal-arena.h"
+#include "recent-births.h"
+#include "perf-counters.h"
+#include "lock-prof.h"
+#include "rcu-prof.h"
 
 static
-pthread_t output_thread_id;
+void print_island(struct island *island)
+{
+	struct island_census census;
+	uint64_t island_size, nr_evicted, nr_rehomed, key_limit;
+	unsigned int i;
+
+	prof_rcu_read_lock();
+	island_size = urcu_game_config_get(island)->island_size;
+	prof_rcu_read_unlock();
+	get_island_census(island, &census);
+
+	if (nr_islands > 1)
+		printf("[ Island %lu ]\n", island->id);
+	printf("Island size: %" PRIu64 "\n", island_size);
+	get_island_resize_stats(island, &nr_evicted, &nr_rehomed, &key_limit);
+	if (key_limit < island_size)
+		printf("Island resize in progress (key limit %" PRIu64 ")\n",
+			key_limit);
+	printf("Evicted by island shrink: %" PRIu64 " rehomed, %" PRIu64
+		" killed\n", nr_rehomed, nr_evicted);
+	for (i = 0; i < nr_species; i++)
+		printf("Number of %ss: %" PRIu64 "\n", species_table[i].name,
+			census.animals[i]);
+	printf("Flowers: %" PRIu64 "\n", census.flowers);
+	printf("Trees: %" PRIu64 "\n", census.trees);
+	printf("Most contended animal lock: %u\n", census.max_lock_contended);
+	printf("Exhausted animals reaped by sweep: %" PRIu64 "\n",
+		census.nr_exhausted);
+	if (nr_islands > 1)
+		printf("Migrations: %" PRIu64 " left, %" PRIu64 " arrived, %"
+			PRIu64 " lost\n", census.nr_emigrated,
+			census.nr_immigrated, census.nr_migrate_lost);
+}
 
 static
-void do_print_output(void)
+void print_memory(void)
 {
-	struct animal *animal;
-	struct cds_lfht_iter iter;
-	uint64_t count;
-	struct urcu_game_config *config;
+	struct mem_stats mem;
+	int64_t total = 0;
+	unsigned int i;
 
-	rcu_read_lock();
+	get_mem_stats(&mem);
+	printf("Memory (kB, current/high):");
+	for (i = 0; i < NR_MEM_CATEGORIES; i++) {
+		printf(" %s %" PRId64 "/%" PRId64, mem_category_name(i),
+			mem.bytes[i] >> 10, mem.high[i] >> 10);
+		total += mem.bytes[i];
+	}
+	printf(", total %" PRId64 "\n", total >> 10);
+}
 
-	config = urcu_game_config_get();
+static
+void print_perf(const struct worker_stats *stats)
+{
+	unsigned int i;
 
-	clear_screen();
-	printf("---------------- RCU Island Summary ------------------\n");
-	printf("Island size: %" PRIu64 "\n", config->island_size);
-	count = 0;
-	cds_lfht_for_each_entry(live_animals.gerbil, &iter,
-			animal, kind_node)
-		count++;
-	printf("Number of gerbils: %" PRIu64 "\n", count);
-
-	count = 0;
-	cds_lfht_for_each_entry(live_animals.cat, &iter,
-			animal, kind_node)
-		count++;
-	printf("Number of cats: %" PRIu64 "\n", count);
-
-	count = 0;
-	cds_lfht_for_each_entry(live_animals.snake, &iter,
-			animal, kind_node)
-		count++;
-	printf("Number of snakes: %" PRIu64 "\n", count);
-
-	pthread_mutex_lock(&vegetation.lock);
-	printf("Flowers: %" PRIu64 "\n", vegetation.flowers);
-	printf("Trees: %" PRIu64 "\n", vegetation.trees);
-	pthread_mutex_unlock(&vegetation.lock);
-	printf("-------- (type 'm' for menu, 'q' to quit game) -------\n");
+	if (!perf_counters_enable)
+		return;
+	printf("Per encounter:");
+	for (i = 0; i < NR_PERF_COUNTERS; i++) {
+		const char *name = perf_counter_name(i);
 
-	rcu_read_unlock();
+		if (!name)
+			continue;
+		printf(" %s %.2f", name, perf_stats_per_op(&stats->perf, i));
+	}
+	printf("\n");
 }
 
 static
-void *output_thread_fct(void *data)
+void print_lock_prof(void)
 {
-	DBG("In user output thread.");
-	rcu_register_thread();
+	struct lock_prof_stats prof;
+	unsigned int i;
 
-	/* Read keys typed by the user */
-	while (!CMM_LOAD_SHARED(exit_program)) {
-		if (!CMM_LOAD_SHARED(hide_output)) {
-			pthread_mutex_lock(&print_output_mutex);
-			DBG("Refresh screen.");
+	if (!lock_prof_enable)
+		return;
+	get_lock_prof_stats(&prof);
+	for (i = 0; i < NR_LOCK_CLASSES; i++) {
+		struct lock_class_stats *cs = &prof.classes[i];
 
-			do_print_output();
-
-			fflush(stdout);
-			pthread_mutex_unlock(&print_output_mutex);
-		}
-		sleep(URCU_GAME_REFRESH_PERIOD);
+		if (!cs->nr_acquire)
+			continue;
+		printf("Lock %s: %" PRIu64 " acquired, try failed %.2f%%, "
+			"wait %.1f ns (contended p99 %" PRIu64 " ns), "
+			"hold %.1f ns\n", lock_class_name(i),
+			cs->nr_acquire,
+			100.0 * cs->nr_try_fail / cs->nr_acquire,
+			(double) cs->wait_time / cs->nr_acquire,
+			lock_wait_percentile(cs, 99),
+			(double) cs->hold_time / cs->nr_acquire);
+	}
+	if (!prof.nr_hot_keys)
+		return;
+	printf("Most contended animal keys:");
+	for (i = 0; i < prof.nr_hot_keys; i++) {
+		printf(" %" PRIu64, prof.hot_keys[i].key);
+		if (nr_islands > 1)
+			printf(" of island %lu", prof.hot_keys[i].island);
+		printf(" (%" PRIu64 ")", prof.hot_keys[i].nr_contended);
 	}
+	printf("\n");
+}
+
+static
+void print_rcu_prof(void)
+{
+	struct rcu_prof_stats prof;
 
-	rcu_unregister_thread();
-	DBG("User output thread exiting.");
-	return NULL;
+	if (!rcu_prof_enable)
+		return;
+	get_rcu_prof_stats(&prof);
+	printf("RCU read-side: %" PRIu64 " sections, %.1f ns avg, p99 %"
+		PRIu64 " ns, max %" PRIu64 " ns from %s\n",
+		prof.nr_sections, prof.nr_sections ?
+			(double) prof.section_time / prof.nr_sections : 0.0,
+		rcu_section_percentile(&prof, 99), prof.max_section,
+		prof.max_section_site ? prof.max_section_site : "-");
+	printf("RCU grace periods: %.1f us avg, max %.1f us, %" PRIu64
+		" stalls; synchronize_rcu max %.1f us from %s\n",
+		prof.nr_probes ?
+			(double) prof.probe_time / prof.nr_probes / 1000 : 0.0,
+		(double) prof.max_probe / 1000, prof.nr_stalls,
+		(double) prof.max_synchronize / 1000,
+		prof.max_synchronize_site ? prof.max_synchronize_site : "-");
 }
 
-int create_output_thread(void)
+static
+void print_recent_births(void)
 {
-	int err;
+	struct birth_record records[MAX_RECENT_BIRTHS];
+	unsigned int i, nr;
+	uint64_t now;
 
-	err = pthread_create(&output_thread_id, NULL,
-		output_thread_fct, NULL);
-	if (err)
-		abort();
-	return 0;
+	if (!recent_births_depth)
+		return;
+	nr = get_recent_births(records, MAX_RECENT_BIRTHS);
+	now = get_time_ns();
+	printf("Recent births:");
+	if (!nr)
+		printf(" <none>");
+	printf("\n");
+	for (i = 0; i < nr; i++) {
+		printf("  %s at key %" PRIu64,
+			species_table[records[i].species].name,
+			records[i].key);
+		if (nr_islands > 1)
+			printf(" of island %u", records[i].island);
+		printf(", %.1f s ago\n",
+			now > records[i].time ?
+				(now - records[i].time) / 1e9 : 0.0);
+	}
 }
 
-int join_output_thread(void)
+static
+void do_print_output(void)
 {
-	int ret;
-	void *tret;
+	struct dispatch_state dispatch;
+	struct worker_stats stats;
+	uint64_t nr_lookup, nr_acquire;
+	unsigned long i;
+
+	clear_screen();
+	printf("---------------- RCU Island Summary ------------------\n");
+	for (i = 0; i < nr_islands; i++)
+		print_island(&islands[i]);
+	if (nr_islands > 1) {
+		struct island_census census;
+		unsigned int j;
 
-	ret = pthread_join(output_thread_id, &tret);
-	if (ret)
-		abort();
-	return 0;
+		get_census(&census);
+		printf("[ All %lu islands ]\n", nr_islands);
+		for (j = 0; j < nr_species; j++)
+			printf("%ss: %" PRIu64 ", ", species_table[j].name,
+				census.animals[j]);
+		printf("flowers: %" PRIu64 ", trees: %" PRIu64 "\n",
+			census.flowers, census.trees);
+		printf("Migrations: %" PRIu64 " left, %" PRIu64 " arrived, %"
+			PRIu64 " lost\n", census.nr_emigrated,
+			census.nr_immigrated, census.nr_migrate_lost);
+	}
+
+	get_dispatch_state(&dispatch);
+	printf("Dispatch (%lu threads, %lu workers): batch %lu, delay %u ms, "
+		"max queue %lu, service %" PRIu64 " ns\n",
+		get_nr_dispatch_threads(), get_nr_worker_threads(),
+		dispatch.batch, dispatch.delay, dispatch.q_len,
+		dispatch.service_time);
+	printf("Encounters dispatched: %" PRIu64 ", shed: %" PRIu64 "\n",
+		dispatch.nr_dispatched, dispatch.nr_shed);
+
+	get_worker_stats(&stats);
+	nr_lookup = stats.nr_lookup ? stats.nr_lookup : 1;
+	printf("Lookups: %" PRIu64 " (empty per occupancy map %.1f%%, "
+		"hash table hit %.1f%%, miss %.1f%%)\n",
+		stats.nr_lookup,
+		100.0 * stats.nr_lookup_skip / nr_lookup,
+		100.0 * stats.nr_lookup_hit / nr_lookup,
+		100.0 * (stats.nr_lookup - stats.nr_lookup_skip
+			- stats.nr_lookup_hit) / nr_lookup);
+	nr_acquire = stats.lock.nr_acquire ? stats.lock.nr_acquire : 1;
+	printf("Animal locks: %" PRIu64 " (%.2f per encounter, "
+		"contended %.2f%%, parked %.2f%%)\n",
+		stats.lock.nr_acquire,
+		stats.nr_work ?
+			(double) stats.lock.nr_acquire / stats.nr_work : 0.0,
+		100.0 * stats.lock.nr_contended / nr_acquire,
+		100.0 * stats.lock.nr_park / nr_acquire);
+	print_perf(&stats);
+	print_lock_prof();
+	print_rcu_prof();
+	print_memory();
+	print_recent_births();
+	if (animal_arena.type != ANIMAL_ARENA_NONE) {
+		struct animal_arena_stats arena;
+
+		get_animal_arena_stats(&arena);
+		printf("Animal arena (%s): %" PRIu64 "/%" PRIu64
+			" animals carved, %" PRIu64 " fallback allocations\n",
+			animal_arena_type_name(animal_arena.type),
+			arena.used, arena.capacity, arena.nr_fallback);
+	}
+	printf("-------- (type 'm' for menu, 'q' to quit game) -------\n");
+}
+
+void print_output(void)
+{
+	DBG("Refresh screen.");
+	do_print_output();
+	fflush(stdout);
 }
@@ -0,0 +1,401 @@
+/*
+ * rcu-prof.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <urcu.h>
+#include <urcu/list.h>
+#include <urcu/system.h>
+#include "urcu-game.h"
+#include "rcu-prof.h"
+
+/*
+ * Read-side state and statistics of a thread, written by that thread
+ * only. Freed by rcu_prof_thread_exit(), or rcu_prof_destroy().
+ */
+struct rcu_prof_thread {
+	struct cds_list_head node;	/* in rcu_prof_threads */
+	long tid;
+	unsigned int nesting;		/* read-side lock nesting */
+	uint64_t section_start;		/* ns, 0 outside read-side */
+	const char *section_site;
+	struct rcu_prof_stats stats;	/* without probes */
+};
+
+/* Grace period probe, one queued at a time. */
+struct rcu_probe {
+	struct rcu_head head;
+	uint64_t issue_time;		/* ns, at call_rcu() */
+	uint64_t complete_time;		/* ns, in callback */
+	int pending;
+};
+
+int rcu_prof_enable;
+unsigned int rcu_stall_threshold = DEFAULT_RCU_STALL_THRESHOLD;
+
+static
+CDS_LIST_HEAD(rcu_prof_threads);
+
+/* Protects rcu_prof_threads. */
+static
+pthread_mutex_t rcu_prof_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread
+struct rcu_prof_thread *thread_prof;
+
+static
+pthread_t rcu_watchdog_thread_id;
+
+static
+struct rcu_probe probe;
+
+/* Of threads freed by rcu_prof_thread_exit(), rcu_prof_threads_lock. */
+static
+struct rcu_prof_stats exited_stats;
+
+/* Probe statistics, written by the watchdog thread. */
+static
+struct rcu_prof_stats probe_stats;
+
+static
+struct rcu_prof_thread *get_thread_prof(void)
+{
+	struct rcu_prof_thread *prof = thread_prof;
+
+	if (caa_likely(prof))
+		return prof;
+	prof = calloc(1, sizeof(*prof));
+	if (!prof)
+		abort();
+	prof->tid = syscall(SYS_gettid);
+	pthread_mutex_lock(&rcu_prof_threads_lock);
+	cds_list_add(&prof->node, &rcu_prof_threads);
+	pthread_mutex_unlock(&rcu_prof_threads_lock);
+	thread_prof = prof;
+	return prof;
+}
+
+static
+unsigned int duration_bucket(uint64_t duration)
+{
+	unsigned int bucket = 0;
+
+	while (duration >>= 1)
+		bucket++;
+	return bucket;
+}
+
+/*
+ * Called before rcu_read_lock(): a section found by the watchdog to
+ * start before a probe may block its grace period.
+ */
+void rcu_prof_enter(const char *site)
+{
+	struct rcu_prof_thread *prof = get_thread_prof();
+
+	if (prof->nesting++)
+		return;
+	CMM_STORE_SHARED(prof->section_site, site);
+	cmm_smp_wmb();	/* Write site before start, for the watchdog. */
+	CMM_STORE_SHARED(prof->section_start, get_time_ns());
+}
+
+/* Called after rcu_read_unlock(). */
+void rcu_prof_exit(void)
+{
+	struct rcu_prof_thread *prof = thread_prof;
+	struct rcu_prof_stats *stats = &prof->stats;
+	uint64_t duration;
+	unsigned int bucket;
+
+	if (--prof->nesting)
+		return;
+	duration = get_time_ns() - prof->section_start;
+	CMM_STORE_SHARED(prof->section_start, 0);
+	bucket = duration_bucket(duration);
+	CMM_STORE_SHARED(stats->nr_sections, stats->nr_sections + 1);
+	CMM_STORE_SHARED(stats->section_time,
+		stats->section_time + duration);
+	CMM_STORE_SHARED(stats->sections[bucket],
+		stats->sections[bucket] + 1);
+	if (duration > stats->max_section) {
+		CMM_STORE_SHARED(stats->max_section_site,
+			prof->section_site);
+		CMM_STORE_SHARED(stats->max_section, duration);
+	}
+}
+
+void rcu_prof_synchronize(const char *site)
+{
+	struct rcu_prof_thread *prof = get_thread_prof();
+	struct rcu_prof_stats *stats = &prof->stats;
+	uint64_t start, duration;
+
+	start = get_time_ns();
+	synchronize_rcu();
+	duration = get_time_ns() - start;
+	CMM_STORE_SHARED(stats->nr_synchronize, stats->nr_synchronize + 1);
+	CMM_STORE_SHARED(stats->synchronize_time,
+		stats->synchronize_time + duration);
+	if (duration > stats->max_synchronize) {
+		CMM_STORE_SHARED(stats->max_synchronize_site, site);
+		CMM_STORE_SHARED(stats->max_synchronize, duration);
+	}
+	if (duration >= (uint64_t) rcu_stall_threshold * 1000000)
+		fprintf(stderr, "synchronize_rcu() from %s took %" PRIu64
+			" ms.\n", site, duration / 1000000);
+}
+
+static
+void probe_complete(struct rcu_head *head)
+{
+	struct rcu_probe *p = caa_container_of(head, struct rcu_probe, head);
+
+	CMM_STORE_SHARED(p->complete_time, get_time_ns());
+	cmm_smp_wmb();	/* Write complete_time before pending. */
+	CMM_STORE_SHARED(p->pending, 0);
+}
+
+/*
+ * Readers which entered their critical section before the probe was
+ * queued may hold up its grace period.
+ */
+static
+void report_stall(uint64_t now)
+{
+	struct rcu_prof_thread *prof;
+	int found = 0;
+
+	fprintf(stderr, "RCU grace period stalled for %" PRIu64 " ms.\n",
+		(now - probe.issue_time) / 1000000);
+	pthread_mutex_lock(&rcu_prof_threads_lock);
+	cds_list_for_each_entry(prof, &rcu_prof_threads, node) {
+		uint64_t start = CMM_LOAD_SHARED(prof->section_start);
+		const char *site;
+
+		if (!start || start > probe.issue_time)
+			continue;
+		cmm_smp_rmb();	/* Read start before site. */
+		site = CMM_LOAD_SHARED(prof->section_site);
+		fprintf(stderr, "  Thread %ld in read-side critical section "
+			"for %" PRIu64 " ms, from %s.\n", prof->tid,
+			(now - start) / 1000000, site);
+		found = 1;
+	}
+	pthread_mutex_unlock(&rcu_prof_threads_lock);
+	if (!found)
+		fprintf(stderr, "  No reader found: call_rcu callbacks "
+			"are late.\n");
+}
+
+/* Called once the probe completed. "reported": stall was reported. */
+static
+void account_probe(uint64_t threshold, int reported)
+{
+	uint64_t duration;
+
+	cmm_smp_rmb();	/* Read pending before complete_time. */
+	duration = CMM_LOAD_SHARED(probe.complete_time) - probe.issue_time;
+	CMM_STORE_SHARED(probe_stats.nr_probes, probe_stats.nr_probes + 1);
+	CMM_STORE_SHARED(probe_stats.probe_time,
+		probe_stats.probe_time + duration);
+	if (duration > probe_stats.max_probe)
+		CMM_STORE_SHARED(probe_stats.max_probe, duration);
+	if (reported)
+		fprintf(stderr, "RCU grace period completed after %" PRIu64
+			" ms.\n", duration / 1000000);
+	else if (duration >= threshold)
+		CMM_STORE_SHARED(probe_stats.nr_stalls,
+			probe_stats.nr_stalls + 1);
+}
+
+/*
+ * Queue a probe each period, at most one at a time. A stalled probe
+ * is reported each rcu_stall_threshold ms.
+ */
+static
+void *rcu_watchdog_thread_fct(void *data)
+{
+	uint64_t threshold = (uint64_t) rcu_stall_threshold * 1000000;
+	uint64_t next_report = 0;
+	unsigned int period = rcu_stall_threshold / 4;
+	int reported = 0;
+
+	DBG("In RCU watchdog thread.");
+	rcu_register_thread();
+
+	if (!period)
+		period = 1;
+	while (!CMM_LOAD_SHARED(exit_program)) {
+		uint64_t now = get_time_ns();
+
+		if (!CMM_LOAD_SHARED(probe.pending)) {
+			if (probe.issue_time)
+				account_probe(threshold, reported);
+			probe.issue_time = now;
+			next_report = now + threshold;
+			reported = 0;
+			CMM_STORE_SHARED(probe.pending, 1);
+			call_rcu(&probe.head, probe_complete);
+		} else if (now >= next_report) {
+			if (!reported)
+				CMM_STORE_SHARED(probe_stats.nr_stalls,
+					probe_stats.nr_stalls + 1);
+			report_stall(now);
+			next_report += threshold;
+			reported = 1;
+		}
+		exit_wait(period);
+	}
+	/* The last probe callback may still be queued. */
+	rcu_barrier();
+
+	rcu_unregister_thread();
+	DBG("RCU watchdog thread exiting.");
+	return NULL;
+}
+
+int create_rcu_watchdog_thread(void)
+{
+	int err;
+
+	err = pthread_create(&rcu_watchdog_thread_id, NULL,
+		rcu_watchdog_thread_fct, NULL);
+	if (err)
+		abort();
+	return 0;
+}
+
+int join_rcu_watchdog_thread(void)
+{
+	int ret;
+	void *tret;
+
+	ret = pthread_join(rcu_watchdog_thread_id, &tret);
+	if (ret)
+		abort();
+	return 0;
+}
+
+/*
+ * Add the read-side and synchronize statistics of a thread, possibly
+ * running, to "stats".
+ */
+static
+void sum_thread_stats(struct rcu_prof_stats *stats,
+		struct rcu_prof_stats *ts)
+{
+	unsigned int i;
+	uint64_t max;
+
+	stats->nr_sections += CMM_LOAD_SHARED(ts->nr_sections);
+	stats->section_time += CMM_LOAD_SHARED(ts->section_time);
+	for (i = 0; i < NR_RCU_PROF_BUCKETS; i++)
+		stats->sections[i] += CMM_LOAD_SHARED(ts->sections[i]);
+	max = CMM_LOAD_SHARED(ts->max_section);
+	if (max > stats->max_section) {
+		stats->max_section = max;
+		stats->max_section_site =
+			CMM_LOAD_SHARED(ts->max_section_site);
+	}
+	stats->nr_synchronize += CMM_LOAD_SHARED(ts->nr_synchronize);
+	stats->synchronize_time += CMM_LOAD_SHARED(ts->synchronize_time);
+	max = CMM_LOAD_SHARED(ts->max_synchronize);
+	if (max > stats->max_synchronize) {
+		stats->max_synchronize = max;
+		stats->max_synchronize_site =
+			CMM_LOAD_SHARED(ts->max_synchronize_site);
+	}
+}
+
+void rcu_prof_thread_exit(void)
+{
+	struct rcu_prof_thread *prof = thread_prof;
+
+	if (!prof)
+		return;
+	pthread_mutex_lock(&rcu_prof_threads_lock);
+	sum_thread_stats(&exited_stats, &prof->stats);
+	cds_list_del(&prof->node);
+	pthread_mutex_unlock(&rcu_prof_threads_lock);
+	thread_prof = NULL;
+	free(prof);
+}
+
+void get_rcu_prof_stats(struct rcu_prof_stats *stats)
+{
+	struct rcu_prof_thread *prof;
+
+	memset(stats, 0, sizeof(*stats));
+	pthread_mutex_lock(&rcu_prof_threads_lock);
+	sum_thread_stats(stats, &exited_stats);
+	cds_list_for_each_entry(prof, &rcu_prof_threads, node)
+		sum_thread_stats(stats, &prof->stats);
+	pthread_mutex_unlock(&rcu_prof_threads_lock);
+	stats->nr_probes = CMM_LOAD_SHARED(probe_stats.nr_probes);
+	stats->probe_time = CMM_LOAD_SHARED(probe_stats.probe_time);
+	stats->max_probe = CMM_LOAD_SHARED(probe_stats.max_probe);
+	stats->nr_stalls = CMM_LOAD_SHARED(probe_stats.nr_stalls);
+}
+
+void rcu_prof_stats_sub(struct rcu_prof_stats *stats,
+		const struct rcu_prof_stats *start)
+{
+	unsigned int i;
+
+	stats->nr_sections -= start->nr_sections;
+	stats->section_time -= start->section_time;
+	for (i = 0; i < NR_RCU_PROF_BUCKETS; i++)
+		stats->sections[i] -= start->sections[i];
+	stats->nr_synchronize -= start->nr_synchronize;
+	stats->synchronize_time -= start->synchronize_time;
+	stats->nr_probes -= start->nr_probes;
+	stats->probe_time -= start->probe_time;
+	stats->nr_stalls -= start->nr_stalls;
+}
+
+uint64_t rcu_section_percentile(const struct rcu_prof_stats *stats,
+		unsigned int percent)
+{
+	uint64_t total = 0, threshold, count = 0;
+	unsigned int i;
+
+	for (i = 0; i < NR_RCU_PROF_BUCKETS; i++)
+		total += stats->sections[i];
+	if (!total)
+		return 0;
+	threshold = (total * percent + 99) / 100;
+	for (i = 0; i < NR_RCU_PROF_BUCKETS - 1; i++) {
+		count += stats->sections[i];
+		if (count >= threshold)
+			break;
+	}
+	return (2ULL << i) - 1;
+}
+
+void rcu_prof_destroy(void)
+{
+	struct rcu_prof_thread *prof, *tmp;
+
+	cds_list_for_each_entry_safe(prof, tmp, &rcu_prof_threads, node) {
+		cds_list_del(&prof->node);
+		free(prof);
+	}
+}
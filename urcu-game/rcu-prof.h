@@ -0,0 +1,117 @@
+#ifndef RCU_PROF_H
+#define RCU_PROF_H
+
+/*
+ * rcu-prof.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+#include <urcu.h>
+#include <urcu/compiler.h>
+
+/*
+ * RCU read-side critical section profiler and grace period watchdog,
+ * enabled with rcu_prof_enable. Each thread times its outermost
+ * read-side critical sections and synchronize_rcu() calls, and records
+ * their call site. The watchdog thread queues a call_rcu() probe, and
+ * when it has not completed within rcu_stall_threshold ms, warns on
+ * stderr with the threads and call sites of the read-side critical
+ * sections started before the probe.
+ */
+
+#define DEFAULT_RCU_STALL_THRESHOLD	1000	/* ms */
+
+/* Critical section and grace period histograms, power of 2 ns. */
+#define NR_RCU_PROF_BUCKETS	64
+
+struct rcu_prof_stats {
+	uint64_t nr_sections;		/* outermost read-side sections */
+	uint64_t section_time;		/* ns */
+	uint64_t sections[NR_RCU_PROF_BUCKETS];
+	uint64_t max_section;		/* ns, since program start */
+	const char *max_section_site;
+	uint64_t nr_synchronize;	/* synchronize_rcu() calls */
+	uint64_t synchronize_time;	/* ns */
+	uint64_t max_synchronize;	/* ns, since program start */
+	const char *max_synchronize_site;
+	uint64_t nr_probes;		/* completed call_rcu probes */
+	uint64_t probe_time;		/* ns, from call_rcu to callback */
+	uint64_t max_probe;		/* ns, since program start */
+	uint64_t nr_stalls;		/* probes over threshold */
+};
+
+/* Set at startup. */
+extern int rcu_prof_enable;
+extern unsigned int rcu_stall_threshold;
+
+#define RCU_PROF_STRINGIFY(x)	#x
+#define RCU_PROF_TOSTRING(x)	RCU_PROF_STRINGIFY(x)
+#define RCU_PROF_SITE		__FILE__ ":" RCU_PROF_TOSTRING(__LINE__)
+
+void rcu_prof_enter(const char *site);
+void rcu_prof_exit(void);
+void rcu_prof_synchronize(const char *site);
+
+/* The timed section encloses the read-side critical section. */
+static inline
+void __prof_rcu_read_lock(const char *site)
+{
+	if (caa_unlikely(rcu_prof_enable))
+		rcu_prof_enter(site);
+	rcu_read_lock();
+}
+
+static inline
+void prof_rcu_read_unlock(void)
+{
+	rcu_read_unlock();
+	if (caa_unlikely(rcu_prof_enable))
+		rcu_prof_exit();
+}
+
+static inline
+void __prof_synchronize_rcu(const char *site)
+{
+	if (caa_unlikely(rcu_prof_enable))
+		rcu_prof_synchronize(site);
+	else
+		synchronize_rcu();
+}
+
+/* Record the call site. */
+#define prof_rcu_read_lock()	__prof_rcu_read_lock(RCU_PROF_SITE)
+#define prof_synchronize_rcu()	__prof_synchronize_rcu(RCU_PROF_SITE)
+
+/* Sum of all threads, including exited ones. */
+void get_rcu_prof_stats(struct rcu_prof_stats *stats);
+/* Subtract the counters of "start", maxima are kept. */
+void rcu_prof_stats_sub(struct rcu_prof_stats *stats,
+		const struct rcu_prof_stats *start);
+/* Upper bound of the histogram bucket, as for worker latency. */
+uint64_t rcu_section_percentile(const struct rcu_prof_stats *stats,
+		unsigned int percent);
+
+/*
+ * Fold the statistics of the current thread into the exited threads
+ * sum, and free its state. Called by threads exiting before
+ * rcu_prof_destroy(), outside of read-side critical sections.
+ */
+void rcu_prof_thread_exit(void);
+
+int create_rcu_watchdog_thread(void);
+int join_rcu_watchdog_thread(void);
+/* Called after all threads have been joined. */
+void rcu_prof_destroy(void);
+
+#endif /* RCU_PROF_H */
@@ -0,0 +1,224 @@
+/*
+ * recent-births.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <urcu.h>
+#include <urcu/rculist.h>
+#include <urcu/system.h>
+#include "urcu-game.h"
+#include "recent-births.h"
+#include "rcu-prof.h"
+
+/*
+ * Single writer ring. Record i is stored in records[i % depth], and
+ * "head" is the number of records written. Readers check "head" again
+ * after copying to discard records overwritten meanwhile.
+ */
+struct birth_ring {
+	struct cds_list_head node;	/* in birth_rings, RCU */
+	struct rcu_head rcu_head;
+	uint64_t head;
+	struct birth_record records[];
+};
+
+unsigned int recent_births_depth = DEFAULT_RECENT_BIRTHS;
+
+static
+CDS_LIST_HEAD(birth_rings);
+
+/* Protects birth_rings updates and exited_ring. */
+static
+pthread_mutex_t birth_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread
+struct birth_ring *thread_ring;
+
+/* Most recent births of exited threads, in birth_rings. */
+static
+struct birth_ring *exited_ring;
+
+static
+struct birth_ring *alloc_ring(void)
+{
+	struct birth_ring *ring;
+
+	ring = calloc(1, sizeof(*ring)
+		+ recent_births_depth * sizeof(struct birth_record));
+	if (!ring)
+		abort();
+	return ring;
+}
+
+static
+struct birth_ring *new_ring(void)
+{
+	struct birth_ring *ring = alloc_ring();
+
+	pthread_mutex_lock(&birth_rings_lock);
+	cds_list_add_rcu(&ring->node, &birth_rings);
+	pthread_mutex_unlock(&birth_rings_lock);
+	return ring;
+}
+
+static
+void free_ring(struct rcu_head *head)
+{
+	free(caa_container_of(head, struct birth_ring, rcu_head));
+}
+
+/* Called by the only writer of "ring". */
+static
+void push_record(struct birth_ring *ring, unsigned long island,
+		unsigned int species, uint64_t key, uint64_t time)
+{
+	struct birth_record *record;
+	uint64_t head;
+
+	head = ring->head;
+	/*
+	 * Publish the previous head before overwriting record
+	 * "head - depth", so readers can tell the slot is being written.
+	 */
+	cmm_smp_wmb();
+	record = &ring->records[head % recent_births_depth];
+	CMM_STORE_SHARED(record->key, key);
+	CMM_STORE_SHARED(record->time, time);
+	CMM_STORE_SHARED(record->species, species);
+	CMM_STORE_SHARED(record->island, island);
+	cmm_smp_wmb();	/* Write record before publishing it. */
+	CMM_STORE_SHARED(ring->head, head + 1);
+}
+
+void record_birth(unsigned long island, unsigned int species, uint64_t key)
+{
+	struct birth_ring *ring = thread_ring;
+
+	if (!recent_births_depth)
+		return;
+	if (caa_unlikely(!ring))
+		ring = thread_ring = new_ring();
+	push_record(ring, island, species, key, get_time_ns());
+}
+
+/* Insert "record" in "records", sorted newest first. */
+static
+void insert_record(struct birth_record *records, unsigned int *nr_records,
+		unsigned int nr, const struct birth_record *record)
+{
+	unsigned int i;
+
+	i = *nr_records;
+	if (i == nr) {
+		if (record->time <= records[nr - 1].time)
+			return;
+		i--;	/* drop the oldest */
+	} else {
+		(*nr_records)++;
+	}
+	for (; i > 0 && records[i - 1].time < record->time; i--)
+		records[i] = records[i - 1];
+	records[i] = *record;
+}
+
+static
+void merge_ring(struct birth_ring *ring, struct birth_record *records,
+		unsigned int *nr_records, unsigned int nr)
+{
+	struct birth_record copy[MAX_RECENT_BIRTHS];
+	uint64_t head, start, valid, i;
+
+	head = CMM_LOAD_SHARED(ring->head);
+	cmm_smp_rmb();	/* Read head before records. */
+	start = head > recent_births_depth ? head - recent_births_depth : 0;
+	for (i = start; i < head; i++) {
+		struct birth_record *record;
+
+		record = &ring->records[i % recent_births_depth];
+		copy[i - start].key = CMM_LOAD_SHARED(record->key);
+		copy[i - start].time = CMM_LOAD_SHARED(record->time);
+		copy[i - start].species = CMM_LOAD_SHARED(record->species);
+		copy[i - start].island = CMM_LOAD_SHARED(record->island);
+	}
+	cmm_smp_rmb();	/* Read records before head. */
+	/* The writer may be overwriting record "head - depth". */
+	valid = CMM_LOAD_SHARED(ring->head) + 1;
+	valid = valid > recent_births_depth ? valid - recent_births_depth : 0;
+	for (i = start < valid ? valid : start; i < head; i++)
+		insert_record(records, nr_records, nr, &copy[i - start]);
+}
+
+/*
+ * The most recent births of the exiting thread and of the exited ring
+ * are merged in a new exited ring, which replaces the old one for
+ * readers.
+ */
+void recent_births_thread_exit(void)
+{
+	struct birth_record records[MAX_RECENT_BIRTHS];
+	struct birth_ring *ring = thread_ring, *exited;
+	unsigned int nr_records = 0, i;
+
+	if (!ring)
+		return;
+	exited = alloc_ring();
+	pthread_mutex_lock(&birth_rings_lock);
+	merge_ring(ring, records, &nr_records, recent_births_depth);
+	if (exited_ring)
+		merge_ring(exited_ring, records, &nr_records,
+			recent_births_depth);
+	for (i = nr_records; i > 0; i--)
+		push_record(exited, records[i - 1].island,
+			records[i - 1].species, records[i - 1].key,
+			records[i - 1].time);
+	if (exited_ring) {
+		cds_list_replace_rcu(&exited_ring->node, &exited->node);
+		call_rcu(&exited_ring->rcu_head, free_ring);
+	} else {
+		cds_list_add_rcu(&exited->node, &birth_rings);
+	}
+	exited_ring = exited;
+	cds_list_del_rcu(&ring->node);
+	pthread_mutex_unlock(&birth_rings_lock);
+	thread_ring = NULL;
+	call_rcu(&ring->rcu_head, free_ring);
+}
+
+unsigned int get_recent_births(struct birth_record *records, unsigned int nr)
+{
+	struct birth_ring *ring;
+	unsigned int nr_records = 0;
+
+	if (nr > recent_births_depth)
+		nr = recent_births_depth;
+	if (!nr)
+		return 0;
+	prof_rcu_read_lock();
+	cds_list_for_each_entry_rcu(ring, &birth_rings, node)
+		merge_ring(ring, records, &nr_records, nr);
+	prof_rcu_read_unlock();
+	return nr_records;
+}
+
+void recent_births_destroy(void)
+{
+	struct birth_ring *ring, *tmp;
+
+	cds_list_for_each_entry_safe(ring, tmp, &birth_rings, node) {
+		cds_list_del(&ring->node);
+		free(ring);
+	}
+	exited_ring = NULL;
+}
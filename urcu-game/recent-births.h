@@ -0,0 +1,56 @@
+#ifndef RECENT_BIRTHS_H
+#define RECENT_BIRTHS_H
+
+/*
+ * recent-births.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+
+/*
+ * Most recent births. Each thread records its births in its own ring,
+ * without lock nor atomic operation, and readers merge the rings by
+ * birth time. The most recent births of exited threads are kept in
+ * a shared ring, so they are still shown.
+ */
+
+#define DEFAULT_RECENT_BIRTHS	3
+#define MAX_RECENT_BIRTHS	64
+
+struct birth_record {
+	uint64_t key;
+	uint64_t time;			/* get_time_ns() */
+	uint32_t species;
+	uint32_t island;
+};
+
+/* Births kept per thread and shown, 0 to disable. Set at startup. */
+extern unsigned int recent_births_depth;
+
+void record_birth(unsigned long island, unsigned int species, uint64_t key);
+/*
+ * Fill "records" with at most "nr" of the most recent births, newest
+ * first. Returns the number of records.
+ */
+unsigned int get_recent_births(struct birth_record *records, unsigned int nr);
+/*
+ * Keep the most recent births of the current thread, and free its ring.
+ * Called by threads exiting before recent_births_destroy(), while still
+ * registered with RCU.
+ */
+void recent_births_thread_exit(void);
+/* Called after all threads recording births have been joined. */
+void recent_births_destroy(void);
+
+#endif /* RECENT_BIRTHS_H */
@@ -0,0 +1,102 @@
+/*
+ * recorder-csv.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+/*
+ * Export a population time series file recorded with "urcu-game -o" to
+ * CSV on standard output, oldest sample first. Rates are per second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "recorder.h"
+
+static
+double rate(uint64_t count, uint64_t period)
+{
+	return period ? count * 1000.0 / period : 0.0;
+}
+
+int main(int argc, char **argv)
+{
+	const struct recorder_header *header;
+	const struct recorder_sample *samples;
+	uint64_t head, first, i;
+	struct stat st;
+	unsigned int j;
+	void *p;
+	int fd;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <file>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	fd = open(argv[1], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	if (st.st_size < RECORDER_HEADER_SIZE)
+		goto invalid;
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	header = p;
+	if (memcmp(header->magic, RECORDER_MAGIC, sizeof(header->magic))
+			|| header->version != RECORDER_VERSION
+			|| header->sample_size != sizeof(struct recorder_sample)
+			|| header->nr_species > MAX_SPECIES
+			|| !header->nr_slots
+			|| st.st_size < RECORDER_HEADER_SIZE
+				+ header->nr_slots * header->sample_size)
+		goto invalid;
+	samples = (const struct recorder_sample *) ((const char *) p
+			+ RECORDER_HEADER_SIZE);
+
+	printf("time_ms");
+	for (j = 0; j < header->nr_species; j++)
+		printf(",%.*s", SPECIES_NAME_LEN, header->species[j]);
+	printf(",flowers,trees,births_per_s,deaths_per_s,queue_depth,"
+		"reclaim_backlog\n");
+
+	head = header->head;
+	first = head > header->nr_slots ? head - header->nr_slots : 0;
+	for (i = first; i < head; i++) {
+		const struct recorder_sample *sample;
+
+		sample = &samples[i % header->nr_slots];
+		printf("%" PRIu64, sample->time);
+		for (j = 0; j < header->nr_species; j++)
+			printf(",%" PRIu64, sample->animals[j]);
+		printf(",%" PRIu64 ",%" PRIu64 ",%.1f,%.1f,%" PRIu64
+			",%" PRIu64 "\n",
+			sample->flowers, sample->trees,
+			rate(sample->nr_births, sample->period),
+			rate(sample->nr_deaths, sample->period),
+			sample->queue_depth, sample->reclaim_backlog);
+	}
+	return EXIT_SUCCESS;
+
+invalid:
+	fprintf(stderr, "%s: not a population time series file\n", argv[1]);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,252 @@
+/*
+ * recorder.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <urcu.h>
+#include <urcu/system.h>
+#include "urcu-game.h"
+#include "worker-thread.h"
+#include "mem-account.h"
+#include "recorder.h"
+#include "rcu-prof.h"
+
+#define RECORDER_FILE_SIZE	(RECORDER_HEADER_SIZE \
+		+ RECORDER_NR_SLOTS * sizeof(struct recorder_sample))
+
+static
+pthread_t recorder_thread_id;
+
+static
+struct recorder_header *header;
+
+static
+struct recorder_sample *samples;
+
+static
+unsigned int recorder_period;
+
+static
+uint64_t get_wall_time_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_REALTIME, &ts))
+		abort();
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Returns 1 if the mapped file was recorded with the same layout and
+ * species.
+ */
+static
+int header_matches(void)
+{
+	unsigned int i;
+
+	if (memcmp(header->magic, RECORDER_MAGIC, sizeof(header->magic))
+			|| header->version != RECORDER_VERSION
+			|| header->sample_size != sizeof(struct recorder_sample)
+			|| header->nr_slots != RECORDER_NR_SLOTS
+			|| header->nr_species != nr_species)
+		return 0;
+	for (i = 0; i < nr_species; i++) {
+		if (strncmp(header->species[i], species_table[i].name,
+				SPECIES_NAME_LEN))
+			return 0;
+	}
+	return 1;
+}
+
+static
+void init_header(void)
+{
+	unsigned int i;
+
+	memset(header, 0, RECORDER_HEADER_SIZE);
+	memcpy(header->magic, RECORDER_MAGIC, sizeof(header->magic));
+	header->version = RECORDER_VERSION;
+	header->sample_size = sizeof(struct recorder_sample);
+	header->nr_slots = RECORDER_NR_SLOTS;
+	header->nr_species = nr_species;
+	for (i = 0; i < nr_species; i++)
+		memcpy(header->species[i], species_table[i].name,
+			SPECIES_NAME_LEN);
+}
+
+static
+int map_file(const char *path)
+{
+	struct stat st;
+	void *p;
+	int fd, reset = 0;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+	if (fstat(fd, &st))
+		goto error;
+	if (st.st_size != RECORDER_FILE_SIZE) {
+		if (ftruncate(fd, 0) || ftruncate(fd, RECORDER_FILE_SIZE))
+			goto error;
+		reset = 1;
+	}
+	p = mmap(NULL, RECORDER_FILE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		goto error;
+	close(fd);
+	header = p;
+	samples = (struct recorder_sample *) ((char *) p
+			+ RECORDER_HEADER_SIZE);
+	if (reset || !header_matches()) {
+		memset(samples, 0,
+			RECORDER_NR_SLOTS * sizeof(struct recorder_sample));
+		init_header();
+	}
+	return 0;
+
+error:
+	perror(path);
+	close(fd);
+	return -1;
+}
+
+static
+uint64_t get_queue_depth(void)
+{
+	struct worker_pool *pool;
+	uint64_t depth = 0;
+	unsigned long i;
+
+	prof_rcu_read_lock();
+	pool = get_worker_pool();
+	for (i = 0; i < pool->nr_workers; i++)
+		depth += get_worker_q_len(pool->workers[i]);
+	prof_rcu_read_unlock();
+	return depth;
+}
+
+/*
+ * Deaths in encounters, of exhaustion found by the sweep, and by
+ * eviction. God creations and apocalypses are not accounted.
+ */
+static
+void get_births_deaths(uint64_t *nr_births, uint64_t *nr_deaths)
+{
+	struct worker_stats stats;
+	unsigned long i;
+
+	get_worker_stats(&stats);
+	*nr_births = stats.nr_births;
+	*nr_deaths = stats.nr_deaths;
+	for (i = 0; i < nr_islands; i++) {
+		uint64_t evicted, rehomed, key_limit;
+
+		get_island_resize_stats(&islands[i], &evicted, &rehomed,
+			&key_limit);
+		*nr_deaths += evicted + CMM_LOAD_SHARED(islands[i].nr_exhausted);
+	}
+}
+
+static
+void record_sample(uint64_t period, uint64_t nr_births, uint64_t nr_deaths)
+{
+	struct recorder_sample *sample;
+	struct island_census census;
+	struct mem_stats mem;
+	uint64_t head = header->head;
+
+	get_census(&census);
+	get_mem_stats(&mem);
+
+	sample = &samples[head % RECORDER_NR_SLOTS];
+	sample->time = get_wall_time_ms();
+	sample->period = period;
+	memcpy(sample->animals, census.animals, sizeof(sample->animals));
+	sample->flowers = census.flowers;
+	sample->trees = census.trees;
+	sample->nr_births = nr_births;
+	sample->nr_deaths = nr_deaths;
+	sample->queue_depth = get_queue_depth();
+	sample->reclaim_backlog = mem.bytes[MEM_ANIMALS_RECLAIM] > 0 ?
+		mem.bytes[MEM_ANIMALS_RECLAIM] / sizeof(struct animal) : 0;
+	/* Publish the sample after writing it. */
+	cmm_smp_wmb();
+	CMM_STORE_SHARED(header->head, head + 1);
+}
+
+static
+void *recorder_thread_fct(void *data)
+{
+	uint64_t last_time, last_births, last_deaths;
+
+	DBG("In recorder thread.");
+	rcu_register_thread();
+
+	last_time = get_time_ns();
+	get_births_deaths(&last_births, &last_deaths);
+	while (!CMM_LOAD_SHARED(exit_program)) {
+		uint64_t now, nr_births, nr_deaths;
+
+		exit_wait(recorder_period);
+		now = get_time_ns();
+		get_births_deaths(&nr_births, &nr_deaths);
+		record_sample((now - last_time) / 1000000,
+			nr_births - last_births, nr_deaths - last_deaths);
+		last_time = now;
+		last_births = nr_births;
+		last_deaths = nr_deaths;
+	}
+
+	rcu_unregister_thread();
+	DBG("Recorder thread exiting.");
+	return NULL;
+}
+
+int create_recorder_thread(const char *path, unsigned int period)
+{
+	int err;
+
+	if (map_file(path))
+		return -1;
+	recorder_period = period;
+	err = pthread_create(&recorder_thread_id, NULL,
+		recorder_thread_fct, NULL);
+	if (err)
+		abort();
+	return 0;
+}
+
+int join_recorder_thread(void)
+{
+	int ret;
+	void *tret;
+
+	ret = pthread_join(recorder_thread_id, &tret);
+	if (ret)
+		abort();
+	if (msync(header, RECORDER_FILE_SIZE, MS_SYNC)
+			|| munmap(header, RECORDER_FILE_SIZE))
+		abort();
+	return 0;
+}
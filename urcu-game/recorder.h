@@ -0,0 +1,69 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+/*
+ * recorder.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+#include "species.h"
+
+/*
+ * Population time series, recorded to a memory-mapped ring file. The
+ * file is a header followed by RECORDER_NR_SLOTS fixed-size samples,
+ * sample i being stored in slot i % RECORDER_NR_SLOTS. A game started
+ * on an existing file with the same layout and species appends to it;
+ * otherwise the file is reset.
+ *
+ * The file is shared with the recorder-csv reader: it only depends on
+ * this header.
+ */
+
+#define RECORDER_MAGIC			"URCUGTS1"
+#define RECORDER_VERSION		1
+#define RECORDER_NR_SLOTS		16384
+#define RECORDER_HEADER_SIZE		4096	/* samples offset */
+#define DEFAULT_RECORDER_PERIOD		1000	/* ms */
+
+struct recorder_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t sample_size;
+	uint64_t nr_slots;
+	uint64_t head;			/* samples written */
+	uint32_t nr_species;
+	uint32_t pad;
+	char species[MAX_SPECIES][SPECIES_NAME_LEN];
+};
+
+struct recorder_sample {
+	uint64_t time;			/* wall clock, in ms since epoch */
+	uint64_t period;		/* since previous sample, in ms */
+	uint64_t animals[MAX_SPECIES];	/* by species id */
+	uint64_t flowers;
+	uint64_t trees;
+	uint64_t nr_births;		/* during period */
+	uint64_t nr_deaths;		/* during period */
+	uint64_t queue_depth;		/* work items queued */
+	uint64_t reclaim_backlog;	/* killed animals awaiting call_rcu */
+};
+
+/*
+ * Record a sample every "period" ms to "path". Returns 0 on success, -1
+ * if the file cannot be mapped.
+ */
+int create_recorder_thread(const char *path, unsigned int period);
+int join_recorder_thread(void);
+
+#endif /* RECORDER_H */
@@ -0,0 +1,216 @@
+/*
+ * resize-thread.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <urcu.h>
+#include <urcu/system.h>
+#include "urcu-game.h"
+#include "urcu-game-config.h"
+#include "occupancy-map.h"
+#include "animal-array.h"
+#include "mem-account.h"
+#include "animal-arena.h"
+#include "rcu-prof.h"
+
+/* Keys scanned per RCU read-side critical section when evicting. */
+#define EVICT_CHUNK		1024
+/* Pause between eviction chunks, in ms. */
+#define EVICT_DELAY		1
+/* Polling period for resize requests, in ms. */
+#define RESIZE_POLL_DELAY	100
+
+static
+pthread_t resize_thread_id;
+
+void island_resize_request(struct island *island)
+{
+	CMM_STORE_SHARED(island->resize_requested, 1);
+}
+
+void get_island_resize_stats(struct island *island, uint64_t *evicted,
+		uint64_t *rehomed, uint64_t *key_limit)
+{
+	*evicted = CMM_LOAD_SHARED(island->nr_evicted);
+	*rehomed = CMM_LOAD_SHARED(island->nr_rehomed);
+	*key_limit = CMM_LOAD_SHARED(island->live_animals.key_limit);
+}
+
+static
+uint64_t get_island_size(struct island *island)
+{
+	uint64_t size;
+
+	prof_rcu_read_lock();
+	size = urcu_game_config_get(island)->island_size;
+	prof_rcu_read_unlock();
+	return size;
+}
+
+static
+uint64_t key_limit_for(struct island *island, uint64_t size)
+{
+	uint64_t max_size = island_max_size(island);
+
+	return size > max_size ? max_size : size;
+}
+
+/*
+ * Called with RCU read-side lock held.
+ */
+static
+void evict_key(struct island *island, uint64_t key, uint64_t limit)
+{
+	struct animal *animal;
+
+	if (!occupancy_map_test(island, key))
+		return;
+	animal = find_animal(island, key);
+	if (!animal)
+		return;
+	switch (evict_animal(island, animal, limit)) {
+	case 1:
+		CMM_STORE_SHARED(island->nr_rehomed, island->nr_rehomed + 1);
+		break;
+	case 0:
+		CMM_STORE_SHARED(island->nr_evicted, island->nr_evicted + 1);
+		break;
+	}
+}
+
+/*
+ * Shrinking: births beyond the new limit fail once the limit is
+ * published and a grace period has elapsed. Animals living beyond it
+ * are then evicted in small chunks, leaving the game running, before
+ * shrinking the key-indexed structures.
+ */
+static
+void shrink_island(struct island *island, uint64_t new_size)
+{
+	uint64_t limit, old_limit, key;
+
+	limit = key_limit_for(island, new_size);
+	old_limit = key_limit_for(island, island->resize_size);
+	CMM_STORE_SHARED(island->live_animals.key_limit, limit);
+	prof_synchronize_rcu();
+
+	for (key = limit; key < old_limit; key += EVICT_CHUNK) {
+		uint64_t i;
+
+		if (CMM_LOAD_SHARED(exit_program))
+			return;
+		prof_rcu_read_lock();
+		for (i = key; i < key + EVICT_CHUNK && i < old_limit; i++)
+			evict_key(island, i, limit);
+		prof_rcu_read_unlock();
+		poll(NULL, 0, EVICT_DELAY);
+	}
+
+	if (island->live_animals.index == ANIMAL_INDEX_ARRAY)
+		animal_array_resize(island, new_size);
+	occupancy_map_resize(island, new_size);
+	island->resize_size = new_size;
+}
+
+/*
+ * Growing: the key-indexed structures cover the new keys before
+ * births are allowed there.
+ */
+static
+void grow_island(struct island *island, uint64_t new_size)
+{
+	if (island->live_animals.index == ANIMAL_INDEX_ARRAY)
+		animal_array_resize(island, new_size);
+	occupancy_map_resize(island, new_size);
+	island->resize_size = new_size;
+	CMM_STORE_SHARED(island->live_animals.key_limit,
+		key_limit_for(island, new_size));
+}
+
+/*
+ * Returns 1 if the island had a pending resize request.
+ */
+static
+int resize_island(struct island *island)
+{
+	uint64_t new_size;
+
+	if (!uatomic_xchg(&island->resize_requested, 0))
+		return 0;
+	/* Always apply the latest island size. */
+	new_size = get_island_size(island);
+	DBG("Resizing island %lu from %" PRIu64 " to %" PRIu64 ".",
+		island->id, island->resize_size, new_size);
+	if (new_size < island->resize_size)
+		shrink_island(island, new_size);
+	else if (new_size > island->resize_size)
+		grow_island(island, new_size);
+	return 1;
+}
+
+static
+void *resize_thread_fct(void *data)
+{
+	DBG("In resize thread.");
+	rcu_register_thread();
+	thread_rand_init(RAND_STREAM_RESIZE, 0);
+
+	while (!CMM_LOAD_SHARED(exit_program)) {
+		unsigned long i;
+		int resized = 0;
+
+		for (i = 0; i < nr_islands; i++)
+			resized |= resize_island(&islands[i]);
+		if (!resized)
+			poll(NULL, 0, RESIZE_POLL_DELAY);
+	}
+
+	mem_account_flush();
+	animal_arena_flush();
+	rcu_unregister_thread();
+	DBG("Resize thread exiting.");
+	return NULL;
+}
+
+int create_resize_thread(void)
+{
+	unsigned long i;
+	int err;
+
+	for (i = 0; i < nr_islands; i++) {
+		struct island *island = &islands[i];
+
+		island->resize_size = get_island_size(island);
+		CMM_STORE_SHARED(island->live_animals.key_limit,
+			key_limit_for(island, island->resize_size));
+	}
+	err = pthread_create(&resize_thread_id, NULL,
+		resize_thread_fct, NULL);
+	if (err)
+		abort();
+	return 0;
+}
+
+int join_resize_thread(void)
+{
+	int ret;
+	void *tret;
+
+	ret = pthread_join(resize_thread_id, &tret);
+	if (ret)
+		abort();
+	return 0;
+}
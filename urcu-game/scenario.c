@@ -0,0 +1,598 @@
+/*
+ * scenario.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+/*
+ * Headless scenario replay. A scenario file contains one event per
+ * line, sorted by time:
+ *
+ *   <time_ms> <command> [arguments]
+ *
+ * where time_ms is the delay from the scenario start, and command is
+ * one of:
+ *
+ *   phase <name>                   Start a new measurement phase
+ *   island_size <n>                Grow or shrink island
+ *   step_delay <ms>                Set dispatch step delay
+ *   stamina <animal> <n>           Set max birth stamina of an animal
+ *   create <animal> <n>            Try creating n animals
+ *   cull <animal>                  Kill all animals of a species
+ *   flowers <n>                    Set number of flowers
+ *   trees <n>                      Set number of trees
+ *   workers <n>                    Resize the worker pool
+ *   end                            End of scenario
+ *
+ * where <animal> is a species name. Text following a '#' is
+ * a comment. Events apply to each island, except worker pool resize.
+ * The end of each phase prints one line of statistics in "key=value"
+ * format, so results of different builds can be compared against the
+ * same scenario. Memory accounting (mem_<category>=) is the current
+ * value, and its high-water mark (mem_<category>_high=) is since the
+ * program start. With -P, counters counted by the workers are added as
+ * <counter>_per_encounter=, with -L, the lock profile as
+ * lock_<class>_<stat>= and lock_hot_keys=, and with -G, the RCU
+ * profile as rcu_<stat>=.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <inttypes.h>
+#include <urcu.h>
+#include <urcu/system.h>
+#include "urcu-game.h"
+#include "urcu-game-config.h"
+#include "worker-thread.h"
+#include "dispatch-thread.h"
+#include "mem-account.h"
+#include "animal-arena.h"
+#include "perf-counters.h"
+#include "lock-prof.h"
+#include "rcu-prof.h"
+
+#define SCENARIO_NAME_LEN	64
+
+enum scenario_op {
+	SCENARIO_PHASE,
+	SCENARIO_ISLAND_SIZE,
+	SCENARIO_STEP_DELAY,
+	SCENARIO_STAMINA,
+	SCENARIO_CREATE,
+	SCENARIO_CULL,
+	SCENARIO_FLOWERS,
+	SCENARIO_TREES,
+	SCENARIO_WORKERS,
+	SCENARIO_END,
+};
+
+struct scenario_event {
+	uint64_t time;			/* ms from scenario start */
+	enum scenario_op op;
+	unsigned int type;		/* species id */
+	uint64_t value;
+	char name[SCENARIO_NAME_LEN];
+	unsigned int line;
+};
+
+static const
+struct scenario_command {
+	const char *name;
+	enum scenario_op op;
+	int has_type;
+	int has_value;
+} scenario_commands[] = {
+	{ "phase",	 SCENARIO_PHASE,	0, 0 },
+	{ "island_size", SCENARIO_ISLAND_SIZE,	0, 1 },
+	{ "step_delay",	 SCENARIO_STEP_DELAY,	0, 1 },
+	{ "stamina",	 SCENARIO_STAMINA,	1, 1 },
+	{ "create",	 SCENARIO_CREATE,	1, 1 },
+	{ "cull",	 SCENARIO_CULL,		1, 0 },
+	{ "flowers",	 SCENARIO_FLOWERS,	0, 1 },
+	{ "trees",	 SCENARIO_TREES,	0, 1 },
+	{ "workers",	 SCENARIO_WORKERS,	0, 1 },
+	{ "end",	 SCENARIO_END,		0, 0 },
+};
+
+struct scenario_phase {
+	char name[SCENARIO_NAME_LEN];
+	uint64_t start_time;		/* ns */
+	struct worker_stats start_stats;
+	struct dispatch_state start_dispatch;
+	uint64_t start_evicted, start_rehomed;
+	struct island_census start_census;
+	struct lock_prof_stats start_lock_prof;
+	struct rcu_prof_stats start_rcu_prof;
+};
+
+static
+int parse_animal(const char *str, unsigned int *type)
+{
+	int id;
+
+	id = species_lookup(str);
+	if (id < 0)
+		return -1;
+	*type = id;
+	return 0;
+}
+
+static
+int parse_value(const char *str, uint64_t *value)
+{
+	char *endptr;
+
+	errno = 0;
+	*value = strtoull(str, &endptr, 10);
+	if (errno || endptr == str || *endptr != '\0')
+		return -1;
+	return 0;
+}
+
+/*
+ * Parse one line. Returns 1 if an event is read, 0 on empty line, -1
+ * on error.
+ */
+static
+int parse_line(char *line, struct scenario_event *event)
+{
+	const struct scenario_command *cmd = NULL;
+	char *args[4], *saveptr, *p;
+	unsigned int nr_args = 0, i, arg;
+
+	p = strchr(line, '#');
+	if (p)
+		*p = '\0';
+	for (p = strtok_r(line, " \t\r\n", &saveptr); p;
+			p = strtok_r(NULL, " \t\r\n", &saveptr)) {
+		if (nr_args == 4)
+			return -1;
+		args[nr_args++] = p;
+	}
+	if (!nr_args)
+		return 0;
+	if (nr_args < 2 || parse_value(args[0], &event->time))
+		return -1;
+	for (i = 0; i < sizeof(scenario_commands) / sizeof(*scenario_commands);
+			i++) {
+		if (!strcmp(args[1], scenario_commands[i].name)) {
+			cmd = &scenario_commands[i];
+			break;
+		}
+	}
+	if (!cmd)
+		return -1;
+	event->op = cmd->op;
+	arg = 2;
+	if (cmd->op == SCENARIO_PHASE) {
+		if (nr_args != 3 || strlen(args[2]) >= SCENARIO_NAME_LEN)
+			return -1;
+		strcpy(event->name, args[2]);
+		return 1;
+	}
+	if (nr_args != 2 + cmd->has_type + cmd->has_value)
+		return -1;
+	if (cmd->has_type && parse_animal(args[arg++], &event->type))
+		return -1;
+	if (cmd->has_value && parse_value(args[arg++], &event->value))
+		return -1;
+	if (cmd->op == SCENARIO_STAMINA && !event->value)
+		return -1;
+	if (cmd->op == SCENARIO_STEP_DELAY && event->value > INT_MAX)
+		return -1;
+	return 1;
+}
+
+static
+int load_scenario(const char *path, struct scenario_event **_events,
+		unsigned int *_nr_events)
+{
+	struct scenario_event *events = NULL;
+	unsigned int nr_events = 0, alloc_events = 0, lineno = 0;
+	char line[4096];
+	FILE *fp;
+	int ret = 0;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror("fopen");
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		struct scenario_event event;
+
+		lineno++;
+		memset(&event, 0, sizeof(event));
+		ret = parse_line(line, &event);
+		if (ret < 0) {
+			fprintf(stderr, "%s:%u: invalid scenario event\n",
+				path, lineno);
+			goto error;
+		}
+		if (!ret)
+			continue;
+		if (nr_events && event.time < events[nr_events - 1].time) {
+			fprintf(stderr, "%s:%u: events are not sorted by time\n",
+				path, lineno);
+			ret = -1;
+			goto error;
+		}
+		event.line = lineno;
+		if (nr_events == alloc_events) {
+			struct scenario_event *new_events;
+
+			alloc_events = alloc_events ? 2 * alloc_events : 64;
+			new_events = realloc(events,
+				alloc_events * sizeof(*events));
+			if (!new_events)
+				abort();
+			events = new_events;
+		}
+		events[nr_events++] = event;
+	}
+	if (ferror(fp)) {
+		perror("fgets");
+		ret = -1;
+		goto error;
+	}
+	fclose(fp);
+	*_events = events;
+	*_nr_events = nr_events;
+	return 0;
+
+error:
+	fclose(fp);
+	free(events);
+	return -1;
+}
+
+/*
+ * Sum of the resize statistics of all islands.
+ */
+static
+void get_resize_stats(uint64_t *evicted, uint64_t *rehomed,
+		uint64_t *key_limit)
+{
+	unsigned long i;
+
+	*evicted = *rehomed = *key_limit = 0;
+	for (i = 0; i < nr_islands; i++) {
+		uint64_t ievicted, irehomed, ikey_limit;
+
+		get_island_resize_stats(&islands[i], &ievicted, &irehomed,
+			&ikey_limit);
+		*evicted += ievicted;
+		*rehomed += irehomed;
+		*key_limit += ikey_limit;
+	}
+}
+
+static
+void begin_phase(struct scenario_phase *phase, const char *name)
+{
+	uint64_t key_limit;
+
+	strcpy(phase->name, name);
+	phase->start_time = get_time_ns();
+	get_worker_stats(&phase->start_stats);
+	get_dispatch_state(&phase->start_dispatch);
+	get_resize_stats(&phase->start_evicted, &phase->start_rehomed,
+		&key_limit);
+	get_census(&phase->start_census);
+	if (lock_prof_enable)
+		get_lock_prof_stats(&phase->start_lock_prof);
+	if (rcu_prof_enable)
+		get_rcu_prof_stats(&phase->start_rcu_prof);
+}
+
+/*
+ * RCU read-side critical sections and grace periods of the phase.
+ * Maxima are since the program start.
+ */
+static
+void print_phase_rcu_prof(struct scenario_phase *phase)
+{
+	struct rcu_prof_stats prof;
+
+	get_rcu_prof_stats(&prof);
+	rcu_prof_stats_sub(&prof, &phase->start_rcu_prof);
+	printf(" rcu_sections=%" PRIu64 " rcu_section_ns=%" PRIu64
+		" rcu_section_p99_ns=%" PRIu64 " rcu_section_max_ns=%" PRIu64
+		" rcu_synchronize=%" PRIu64 " rcu_synchronize_ns=%" PRIu64
+		" rcu_synchronize_max_ns=%" PRIu64 " rcu_gp_ns=%" PRIu64
+		" rcu_gp_max_ns=%" PRIu64 " rcu_stalls=%" PRIu64,
+		prof.nr_sections, prof.nr_sections ?
+			prof.section_time / prof.nr_sections : 0,
+		rcu_section_percentile(&prof, 99), prof.max_section,
+		prof.nr_synchronize, prof.nr_synchronize ?
+			prof.synchronize_time / prof.nr_synchronize : 0,
+		prof.max_synchronize, prof.nr_probes ?
+			prof.probe_time / prof.nr_probes : 0,
+		prof.max_probe, prof.nr_stalls);
+}
+
+/*
+ * Lock profile of the phase, per acquisition. Hottest animal keys are
+ * since the program start, as island:key:contended.
+ */
+static
+void print_phase_lock_prof(struct scenario_phase *phase)
+{
+	struct lock_prof_stats prof;
+	unsigned int i;
+
+	get_lock_prof_stats(&prof);
+	lock_prof_stats_sub(&prof, &phase->start_lock_prof);
+	for (i = 0; i < NR_LOCK_CLASSES; i++) {
+		struct lock_class_stats *cs = &prof.classes[i];
+		const char *name = lock_class_name(i);
+		uint64_t nr_acquire = cs->nr_acquire ? cs->nr_acquire : 1;
+
+		printf(" lock_%s_acquire=%" PRIu64 " lock_%s_try_fail=%"
+			PRIu64 " lock_%s_wait_ns=%" PRIu64
+			" lock_%s_wait_p99_ns=%" PRIu64
+			" lock_%s_hold_ns=%" PRIu64,
+			name, cs->nr_acquire, name, cs->nr_try_fail,
+			name, cs->wait_time / nr_acquire,
+			name, lock_wait_percentile(cs, 99),
+			name, cs->hold_time / nr_acquire);
+	}
+	printf(" lock_hot_keys=");
+	if (!prof.nr_hot_keys)
+		printf("-");
+	for (i = 0; i < prof.nr_hot_keys; i++)
+		printf("%s%lu:%" PRIu64 ":%" PRIu64, i ? "," : "",
+			prof.hot_keys[i].island, prof.hot_keys[i].key,
+			prof.hot_keys[i].nr_contended);
+}
+
+static
+void end_phase(struct scenario_phase *phase)
+{
+	struct worker_stats stats;
+	struct dispatch_state dispatch;
+	struct island_census census;
+	struct mem_stats mem;
+	struct animal_arena_stats arena;
+	uint64_t duration, evicted, rehomed, key_limit;
+	unsigned int i;
+
+	duration = get_time_ns() - phase->start_time;
+	get_worker_stats(&stats);
+	stats.nr_work -= phase->start_stats.nr_work;
+	stats.latency_sum -= phase->start_stats.latency_sum;
+	stats.nr_lookup -= phase->start_stats.nr_lookup;
+	stats.nr_lookup_skip -= phase->start_stats.nr_lookup_skip;
+	stats.nr_lookup_hit -= phase->start_stats.nr_lookup_hit;
+	stats.nr_maintenance -= phase->start_stats.nr_maintenance;
+	stats.lock.nr_acquire -= phase->start_stats.lock.nr_acquire;
+	stats.lock.nr_contended -= phase->start_stats.lock.nr_contended;
+	stats.lock.nr_park -= phase->start_stats.lock.nr_park;
+	for (i = 0; i < NR_LATENCY_BUCKETS; i++)
+		stats.latency[i] -= phase->start_stats.latency[i];
+	for (i = 0; i < NR_PERF_COUNTERS; i++) {
+		stats.perf.count[i] -= phase->start_stats.perf.count[i];
+		stats.perf.nr_ops[i] -= phase->start_stats.perf.nr_ops[i];
+	}
+	get_dispatch_state(&dispatch);
+	get_resize_stats(&evicted, &rehomed, &key_limit);
+	get_census(&census);
+	get_mem_stats(&mem);
+	get_animal_arena_stats(&arena);
+
+	printf("phase=%s duration_ms=%" PRIu64 " encounters=%" PRIu64
+		" encounters_per_s=%.1f latency_avg_ns=%" PRIu64
+		" latency_p50_ns=%" PRIu64 " latency_p99_ns=%" PRIu64,
+		phase->name, duration / 1000000, stats.nr_work,
+		duration ? (double) stats.nr_work * 1e9 / duration : 0.0,
+		stats.nr_work ? stats.latency_sum / stats.nr_work : 0,
+		worker_stats_latency_percentile(&stats, 50),
+		worker_stats_latency_percentile(&stats, 99));
+	/* Plural species names, e.g. "gerbils=". */
+	for (i = 0; i < nr_species; i++)
+		printf(" %ss=%" PRIu64, species_table[i].name,
+			census.animals[i]);
+	printf(" flowers=%" PRIu64 " trees=%" PRIu64
+		" shed=%" PRIu64 " batch=%lu delay_ms=%u"
+		" service_ns=%" PRIu64 " dispatchers=%lu workers=%lu"
+		" maintenance=%" PRIu64
+		" lookups=%" PRIu64 " lookup_skip=%" PRIu64
+		" lookup_hit=%" PRIu64 " index=%s"
+		" key_limit=%" PRIu64 " evicted=%" PRIu64
+		" rehomed=%" PRIu64 " islands=%lu migrated=%" PRIu64
+		" migrate_lost=%" PRIu64 " exhausted=%" PRIu64
+		" lock_acquire=%" PRIu64
+		" lock_contended=%" PRIu64 " lock_park=%" PRIu64
+		" lock_max_contended=%u lock_per_encounter=%.2f"
+		" animal_bytes=%zu arena=%s arena_used=%" PRIu64
+		" arena_fallback=%" PRIu64,
+		census.flowers, census.trees,
+		dispatch.nr_shed - phase->start_dispatch.nr_shed,
+		dispatch.batch, dispatch.delay, dispatch.service_time,
+		get_nr_dispatch_threads(), get_nr_worker_threads(),
+		stats.nr_maintenance,
+		stats.nr_lookup, stats.nr_lookup_skip, stats.nr_lookup_hit,
+		islands[0].live_animals.index == ANIMAL_INDEX_ARRAY ?
+			"array" : "lfht",
+		key_limit, evicted - phase->start_evicted,
+		rehomed - phase->start_rehomed, nr_islands,
+		census.nr_immigrated - phase->start_census.nr_immigrated,
+		census.nr_migrate_lost - phase->start_census.nr_migrate_lost,
+		census.nr_exhausted - phase->start_census.nr_exhausted,
+		stats.lock.nr_acquire, stats.lock.nr_contended,
+		stats.lock.nr_park, census.max_lock_contended,
+		stats.nr_work ?
+			(double) stats.lock.nr_acquire / stats.nr_work : 0.0,
+		sizeof(struct animal),
+		animal_arena_type_name(animal_arena.type), arena.used,
+		arena.nr_fallback);
+	for (i = 0; i < NR_MEM_CATEGORIES; i++)
+		printf(" mem_%s=%" PRId64 " mem_%s_high=%" PRId64,
+			mem_category_name(i), mem.bytes[i],
+			mem_category_name(i), mem.high[i]);
+	for (i = 0; perf_counters_enable && i < NR_PERF_COUNTERS; i++) {
+		const char *name = perf_counter_name(i);
+
+		if (!name)
+			continue;
+		printf(" %s_per_encounter=%.2f", name,
+			perf_stats_per_op(&stats.perf, i));
+	}
+	if (lock_prof_enable)
+		print_phase_lock_prof(phase);
+	if (rcu_prof_enable)
+		print_phase_rcu_prof(phase);
+	printf("\n");
+	fflush(stdout);
+}
+
+static
+void wait_until(uint64_t deadline)
+{
+	for (;;) {
+		uint64_t now = get_time_ns();
+
+		if (now >= deadline)
+			return;
+		/* sleep number of ms, rounded up */
+		poll(NULL, 0, (deadline - now + 999999) / 1000000);
+	}
+}
+
+static
+void apply_island_event(struct island *island,
+		const struct scenario_event *event)
+{
+	struct urcu_game_config *new_config;
+
+	switch (event->op) {
+	case SCENARIO_ISLAND_SIZE:
+	case SCENARIO_STEP_DELAY:
+	case SCENARIO_STAMINA:
+		new_config = urcu_game_config_update_begin(island);
+		if (!new_config)
+			abort();
+		switch (event->op) {
+		case SCENARIO_ISLAND_SIZE:
+			new_config->island_size = event->value;
+			break;
+		case SCENARIO_STEP_DELAY:
+			new_config->step_delay = (int) event->value;
+			break;
+		case SCENARIO_STAMINA:
+			new_config->kind[event->type].max_birth_stamina =
+				event->value;
+			break;
+		default:
+			abort();
+		}
+		urcu_game_config_update_end(island, new_config);
+		break;
+	case SCENARIO_CREATE:
+		run_maintenance(WORK_CREATE, island, 0, event->value,
+			event->type);
+		break;
+	case SCENARIO_CULL:
+		run_maintenance(WORK_CULL, island, 0,
+			CMM_LOAD_SHARED(island->live_animals.key_limit),
+			event->type);
+		break;
+	case SCENARIO_FLOWERS:
+		prof_mutex_lock(&island->vegetation.lock,
+			LOCK_VEGETATION);
+		island->vegetation.flowers = event->value;
+		prof_mutex_unlock(&island->vegetation.lock,
+			LOCK_VEGETATION);
+		break;
+	case SCENARIO_TREES:
+		prof_mutex_lock(&island->vegetation.lock,
+			LOCK_VEGETATION);
+		island->vegetation.trees = event->value;
+		prof_mutex_unlock(&island->vegetation.lock,
+			LOCK_VEGETATION);
+		break;
+	default:
+		abort();
+	}
+}
+
+static
+void apply_event(const struct scenario_event *event)
+{
+	unsigned long i;
+
+	DBG("Scenario event at line %u", event->line);
+
+	if (event->op == SCENARIO_ISLAND_SIZE && !event->value) {
+		fprintf(stderr, "line %u: Island size cannot be zero.\n",
+			event->line);
+		return;
+	}
+	/* All islands use the same animal index. */
+	if (event->op == SCENARIO_ISLAND_SIZE
+			&& event->value > island_max_size(&islands[0])) {
+		fprintf(stderr, "line %u: Island size cannot exceed %" PRIu64
+			" with this animal index.\n", event->line,
+			island_max_size(&islands[0]));
+		return;
+	}
+	if (event->op == SCENARIO_WORKERS) {
+		if (resize_worker_pool(event->value))
+			fprintf(stderr, "line %u: Cannot resize worker pool "
+				"to %" PRIu64 " threads.\n", event->line,
+				event->value);
+		return;
+	}
+	for (i = 0; i < nr_islands; i++)
+		apply_island_event(&islands[i], event);
+}
+
+/*
+ * Run the scenario, and request program exit when it completes.
+ * Called from a registered RCU thread.
+ */
+int run_scenario(const char *path)
+{
+	struct scenario_event *events;
+	struct scenario_phase phase;
+	unsigned int nr_events, i;
+	uint64_t start_time;
+	int ret;
+
+	ret = load_scenario(path, &events, &nr_events);
+	if (ret)
+		goto end;
+
+	start_time = get_time_ns();
+	begin_phase(&phase, "init");
+	for (i = 0; i < nr_events; i++) {
+		const struct scenario_event *event = &events[i];
+
+		wait_until(start_time + event->time * 1000000);
+		if (event->op == SCENARIO_END)
+			break;
+		if (event->op == SCENARIO_PHASE) {
+			end_phase(&phase);
+			begin_phase(&phase, event->name);
+			continue;
+		}
+		apply_event(event);
+	}
+	end_phase(&phase);
+	free(events);
+end:
+	request_exit();
+	return ret;
+}
@@ -0,0 +1,19 @@
+#!/bin/sh
+#
+# Report encounter throughput scaling as dispatch threads are added.
+#
+# Usage: dispatch-scaling.sh [nr_workers] [scenario]
+
+NR_WORKERS=${1:-64}
+SCENARIO=${2:-$(dirname $0)/saturate.txt}
+GAME=$(dirname $0)/../urcu-game
+
+echo "dispatchers encounters_per_s"
+for d in 1 2 4 8 16 32 64; do
+	if [ ${d} -gt ${NR_WORKERS} ]; then
+		break
+	fi
+	${GAME} -w ${NR_WORKERS} -d ${d} -f ${SCENARIO} | \
+		grep "^phase=saturate " | \
+		sed -e "s/.* encounters_per_s=\([^ ]*\) .*/${d} \1/"
+done
@@ -0,0 +1,20 @@
+#!/bin/sh
+#
+# Report encounter throughput scaling as islands are added, with one
+# dispatch thread per island.
+#
+# Usage: island-scaling.sh [nr_workers] [scenario]
+
+NR_WORKERS=${1:-64}
+SCENARIO=${2:-$(dirname $0)/saturate.txt}
+GAME=$(dirname $0)/../urcu-game
+
+echo "islands encounters_per_s migrated"
+for n in 1 2 4 8 16 32 64; do
+	if [ ${n} -gt ${NR_WORKERS} ]; then
+		break
+	fi
+	${GAME} -w ${NR_WORKERS} -d ${n} -n ${n} -f ${SCENARIO} | \
+		grep "^phase=saturate " | \
+		sed -e "s/.* encounters_per_s=\([^ ]*\) .* migrated=\([^ ]*\) .*/${n} \1 \2/"
+done
@@ -0,0 +1,216 @@
+/*
+ * species.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+/*
+ * Species file format, one species per line:
+ *
+ *   <name> <max birth stamina> <max pregnant> [diet...]
+ *
+ * where each diet item is "flowers", "trees", or the name of a species
+ * of the file, in any order. Text following a '#' is a comment.
+ * Stamina is in stamina decay periods (-e): an animal which does not
+ * eat lives at most <max birth stamina> periods.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "species.h"
+
+#define SPECIES_MAX_ARGS	(3 + MAX_SPECIES + 2)
+
+struct species species_table[MAX_SPECIES];
+unsigned int nr_species;
+
+static const
+char *default_species[] = {
+	"gerbil	70	10	flowers trees",
+	"cat	80	4	gerbil flowers",
+	"snake	30	1	gerbil cat",
+};
+
+int species_lookup(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_species; i++) {
+		if (!strcmp(species_table[i].name, name))
+			return i;
+	}
+	return -1;
+}
+
+static
+int parse_value(const char *str, uint64_t *value)
+{
+	char *endptr;
+
+	errno = 0;
+	*value = strtoull(str, &endptr, 10);
+	if (errno || endptr == str || *endptr != '\0' || !*value)
+		return -1;
+	return 0;
+}
+
+/*
+ * Split a line in arguments. Returns the number of arguments, or -1 on
+ * error.
+ */
+static
+int split_line(char *line, char **args)
+{
+	char *saveptr, *p;
+	int nr_args = 0;
+
+	p = strchr(line, '#');
+	if (p)
+		*p = '\0';
+	for (p = strtok_r(line, " \t\r\n", &saveptr); p;
+			p = strtok_r(NULL, " \t\r\n", &saveptr)) {
+		if (nr_args == SPECIES_MAX_ARGS)
+			return -1;
+		args[nr_args++] = p;
+	}
+	return nr_args;
+}
+
+/*
+ * First pass: register the species name, so diets can refer to species
+ * declared later.
+ */
+static
+int parse_name(char *line)
+{
+	char *args[SPECIES_MAX_ARGS];
+	struct species *species;
+	int nr_args;
+
+	nr_args = split_line(line, args);
+	if (nr_args <= 0)
+		return nr_args;
+	if (nr_species == MAX_SPECIES
+			|| strlen(args[0]) >= SPECIES_NAME_LEN
+			|| species_lookup(args[0]) >= 0)
+		return -1;
+	species = &species_table[nr_species++];
+	memset(species, 0, sizeof(*species));
+	strcpy(species->name, args[0]);
+	return 1;
+}
+
+/* Second pass: traits and diet of species "id". */
+static
+int parse_traits(char *line, unsigned int id)
+{
+	char *args[SPECIES_MAX_ARGS];
+	struct species *species = &species_table[id];
+	int nr_args, i;
+
+	nr_args = split_line(line, args);
+	if (nr_args <= 0)
+		return nr_args;
+	if (nr_args < 3
+			|| parse_value(args[1], &species->max_birth_stamina)
+			|| parse_value(args[2], &species->max_pregnant))
+		return -1;
+	for (i = 3; i < nr_args; i++) {
+		int prey;
+
+		if (!strcmp(args[i], "flowers")) {
+			species->vegetation |= DIET_FLOWERS;
+			continue;
+		}
+		if (!strcmp(args[i], "trees")) {
+			species->vegetation |= DIET_TREES;
+			continue;
+		}
+		prey = species_lookup(args[i]);
+		if (prey < 0)
+			return -1;
+		species->prey |= 1ULL << prey;
+	}
+	return 1;
+}
+
+static
+int load_default(void)
+{
+	char line[256];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(default_species) / sizeof(*default_species);
+			i++) {
+		strcpy(line, default_species[i]);
+		if (parse_name(line) != 1)
+			abort();
+	}
+	for (i = 0; i < nr_species; i++) {
+		strcpy(line, default_species[i]);
+		if (parse_traits(line, i) != 1)
+			abort();
+	}
+	return 0;
+}
+
+int species_load(const char *path)
+{
+	unsigned int lineno, id;
+	char line[4096];
+	FILE *fp;
+	int ret;
+
+	nr_species = 0;
+	if (!path)
+		return load_default();
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror("fopen");
+		return -1;
+	}
+	for (lineno = 1; fgets(line, sizeof(line), fp); lineno++) {
+		if (parse_name(line) < 0) {
+			fprintf(stderr, "%s:%u: invalid or duplicate species\n",
+				path, lineno);
+			goto error;
+		}
+	}
+	rewind(fp);
+	for (lineno = 1, id = 0; fgets(line, sizeof(line), fp); lineno++) {
+		ret = parse_traits(line, id);
+		if (ret < 0) {
+			fprintf(stderr, "%s:%u: invalid species traits\n",
+				path, lineno);
+			goto error;
+		}
+		id += ret;
+	}
+	if (ferror(fp)) {
+		perror("fgets");
+		goto error;
+	}
+	fclose(fp);
+	if (!nr_species) {
+		fprintf(stderr, "%s: no species\n", path);
+		return -1;
+	}
+	return 0;
+
+error:
+	fclose(fp);
+	nr_species = 0;
+	return -1;
+}
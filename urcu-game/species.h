@@ -0,0 +1,60 @@
+#ifndef SPECIES_H
+#define SPECIES_H
+
+/*
+ * species.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+
+/* Species are numbered from 0, each is a bit of the prey mask. */
+#define MAX_SPECIES		64
+#define SPECIES_NAME_LEN	32
+
+enum diet_mask {
+	DIET_FLOWERS =	(1U << 0),
+	DIET_TREES =	(1U << 1),
+};
+
+struct species {
+	char name[SPECIES_NAME_LEN];
+	uint64_t prey;			/* mask of species eaten */
+	unsigned int vegetation;	/* diet_mask */
+	uint64_t max_birth_stamina;	/* default, per island config */
+	uint64_t max_pregnant;		/* default, per island config */
+};
+
+/*
+ * Species registry. Filled before any island is created, then only
+ * read: diet lookups need no synchronization.
+ */
+extern struct species species_table[MAX_SPECIES];
+extern unsigned int nr_species;
+
+/*
+ * Load the registry from "path", or the built-in gerbil, cat and snake
+ * if "path" is NULL. Returns 0 on success, -1 on error.
+ */
+int species_load(const char *path);
+
+/* Returns the species id of "name", or -1 if unknown. */
+int species_lookup(const char *name);
+
+static inline
+int species_eats(unsigned int predator, unsigned int prey)
+{
+	return (species_table[predator].prey >> prey) & 1;
+}
+
+#endif /* SPECIES_H */
@@ -0,0 +1,138 @@
+/*
+ * sweep-thread.c
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <urcu.h>
+#include <urcu/system.h>
+#include "urcu-game.h"
+#include "mem-account.h"
+#include "animal-arena.h"
+#include "worker-thread.h"
+
+/* Sweeps to cover all keys of an island. */
+#define SWEEP_PASS_EPOCHS	16
+/* Maximum keys swept per island and per sweep. */
+#define SWEEP_MAX_SLICE		(1UL << 16)
+
+unsigned int stamina_decay_period = DEFAULT_STAMINA_DECAY_PERIOD;
+uint32_t stamina_epoch;
+
+static
+pthread_t sweep_thread_id, epoch_thread_id;
+
+/*
+ * Sweep the next slice of keys, so animals which are never met are
+ * reaped within SWEEP_PASS_EPOCHS sweeps of exhaustion, or
+ * key_limit / SWEEP_MAX_SLICE sweeps on large islands. The slice is
+ * swept by the worker pool, as maintenance: a sweep may take longer
+ * than an epoch when workers are saturated.
+ */
+static
+void sweep_island(struct island *island)
+{
+	uint64_t limit, slice, start, end, nr;
+
+	limit = CMM_LOAD_SHARED(island->live_animals.key_limit);
+	slice = (limit + SWEEP_PASS_EPOCHS - 1) / SWEEP_PASS_EPOCHS;
+	if (slice > SWEEP_MAX_SLICE)
+		slice = SWEEP_MAX_SLICE;
+	start = island->sweep_cursor;
+	if (start >= limit)
+		start = 0;
+	end = start + slice < limit ? start + slice : limit;
+
+	nr = run_maintenance(WORK_SWEEP, island, start, end, 0);
+	island->sweep_cursor = end;
+	if (nr)
+		CMM_STORE_SHARED(island->nr_exhausted,
+			island->nr_exhausted + nr);
+}
+
+/*
+ * The epoch follows the clock, and does not wait on the sweep: sweep
+ * slices queue behind other maintenance when workers are saturated.
+ * Epochs missed while the thread was not scheduled are caught up.
+ */
+static
+void *epoch_thread_fct(void *data)
+{
+	uint64_t base, period_ns, elapsed;
+
+	DBG("In epoch thread.");
+	base = get_time_ns();
+	period_ns = (uint64_t) stamina_decay_period * 1000000;
+	while (!CMM_LOAD_SHARED(exit_program)) {
+		elapsed = get_time_ns() - base;
+		CMM_STORE_SHARED(stamina_epoch,
+			(uint32_t) (elapsed / period_ns + 1));
+		exit_wait((period_ns - elapsed % period_ns + 999999)
+			/ 1000000);
+	}
+	DBG("Epoch thread exiting.");
+	return NULL;
+}
+
+static
+void *sweep_thread_fct(void *data)
+{
+	DBG("In sweep thread.");
+	rcu_register_thread();
+
+	while (!CMM_LOAD_SHARED(exit_program)) {
+		uint64_t start, elapsed_ms;
+		unsigned long i;
+
+		start = get_time_ns();
+		for (i = 0; i < nr_islands; i++)
+			sweep_island(&islands[i]);
+		elapsed_ms = (get_time_ns() - start) / 1000000;
+		if (elapsed_ms < stamina_decay_period)
+			exit_wait(stamina_decay_period - elapsed_ms);
+	}
+
+	mem_account_flush();
+	animal_arena_flush();
+	rcu_unregister_thread();
+	DBG("Sweep thread exiting.");
+	return NULL;
+}
+
+int create_sweep_thread(void)
+{
+	int err;
+
+	err = pthread_create(&epoch_thread_id, NULL,
+		epoch_thread_fct, NULL);
+	if (err)
+		abort();
+	err = pthread_create(&sweep_thread_id, NULL,
+		sweep_thread_fct, NULL);
+	if (err)
+		abort();
+	return 0;
+}
+
+int join_sweep_thread(void)
+{
+	int ret;
+	void *tret;
+
+	ret = pthread_join(sweep_thread_id, &tret);
+	if (ret)
+		abort();
+	ret = pthread_join(epoch_thread_id, &tret);
+	if (ret)
+		abort();
+	return 0;
+}
@@ -20,23 +20,20 @@
 #include <urcu/compiler.h>
 
 #include "urcu-game-config.h"
+#include "mem-account.h"
+#include "lock-prof.h"
+#include "rcu-prof.h"
 
 /*
- * Game configuration is protected against concurrent updates using a
- * mutex. It is read by many concurrent threads, using RCU to
- * synchronize.
+ * Island configuration is protected against concurrent updates using
+ * the island config_mutex. It is read by many concurrent threads, using
+ * RCU to synchronize.
  */
-static
-struct urcu_game_config *current_config;
-
-static
-pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-struct urcu_game_config *urcu_game_config_get(void)
+struct urcu_game_config *urcu_game_config_get(struct island *island)
 {
 	assert(rcu_read_ongoing());
 
-	return rcu_dereference(current_config);
+	return rcu_dereference(island->config);
 }
 
 /*
@@ -45,7 +42,7 @@ struct urcu_game_config *urcu_game_config_get(void)
  * Holding the mutex across begin and end ensures the configuration is
  * not modified concurrently.
  */
-struct urcu_game_config *urcu_game_config_update_begin(void)
+struct urcu_game_config *urcu_game_config_update_begin(struct island *island)
 {
 	struct urcu_game_config *new_config;
 
@@ -53,57 +50,58 @@ struct urcu_game_config *urcu_game_config_update_begin(void)
 	if (!new_config) {
 		return NULL;
 	}
-	pthread_mutex_lock(&config_mutex);
-	if (current_config)
-		memcpy(new_config, current_config, sizeof(*new_config));
+	mem_account_sync(MEM_CONFIG, sizeof(*new_config));
+	prof_mutex_lock(&island->config_mutex, LOCK_CONFIG);
+	if (island->config)
+		memcpy(new_config, island->config, sizeof(*new_config));
 	else
 		memset(new_config, 0, sizeof(*new_config));
 	return new_config;
 }
 
-void urcu_game_config_update_end(struct urcu_game_config *new_config)
+void urcu_game_config_update_end(struct island *island,
+		struct urcu_game_config *new_config)
 {
 	struct urcu_game_config *old_config;
 
-	old_config = current_config;
-	rcu_set_pointer(&current_config, new_config);
-	pthread_mutex_unlock(&config_mutex);
+	old_config = island->config;
+	rcu_set_pointer(&island->config, new_config);
+	prof_mutex_unlock(&island->config_mutex, LOCK_CONFIG);
 	if (old_config) {
-		synchronize_rcu();
+		if (new_config->island_size != old_config->island_size)
+			island_resize_request(island);
+		mem_account_sync(MEM_CONFIG, -(long) sizeof(*old_config));
+		mem_account_sync(MEM_CONFIG_RECLAIM, sizeof(*old_config));
+		prof_synchronize_rcu();
+		mem_account_sync(MEM_CONFIG_RECLAIM,
+			-(long) sizeof(*old_config));
 		free(old_config);
 	}
 }
 
-void urcu_game_config_update_abort(struct urcu_game_config *new_config)
+void urcu_game_config_update_abort(struct island *island,
+		struct urcu_game_config *new_config)
 {
-	pthread_mutex_unlock(&config_mutex);
+	prof_mutex_unlock(&island->config_mutex, LOCK_CONFIG);
+	mem_account_sync(MEM_CONFIG, -(long) sizeof(*new_config));
 	free(new_config);
 }
 
-void init_game_config(void)
+void init_game_config(struct island *island)
 {
 	struct urcu_game_config *new_config;
+	unsigned int i;
 
-	new_config = urcu_game_config_update_begin();
+	new_config = urcu_game_config_update_begin(island);
 	new_config->island_size = DEFAULT_ISLAND_SIZE;
 	new_config->step_delay = DEFAULT_STEP_DELAY;
-	new_config->gerbil.max_birth_stamina =
-			DEFAULT_GERBIL_MAX_BIRTH_STAMINA;
-	new_config->gerbil.animal = GERBIL;
-	new_config->gerbil.diet = DIET_FLOWERS | DIET_TREES;
-	new_config->gerbil.max_pregnant = 10;
+	for (i = 0; i < nr_species; i++) {
+		struct animal_kind *kind = &new_config->kind[i];
 
-	new_config->cat.max_birth_stamina =
-			DEFAULT_CAT_MAX_BIRTH_STAMINA;
-	new_config->cat.animal = CAT;
-	new_config->cat.diet = DIET_GERBIL | DIET_FLOWERS;
-	new_config->cat.max_pregnant = 4;
-
-	new_config->snake.max_birth_stamina =
-			DEFAULT_SNAKE_MAX_BIRTH_STAMINA;
-	new_config->snake.animal = SNAKE;
-	new_config->snake.diet = DIET_GERBIL | DIET_CAT;
-	new_config->snake.max_pregnant = 1;
+		kind->max_birth_stamina = species_table[i].max_birth_stamina;
+		kind->max_pregnant = species_table[i].max_pregnant;
+		kind->animal = i;
+	}
 
-	urcu_game_config_update_end(new_config);
+	urcu_game_config_update_end(island, new_config);
 }
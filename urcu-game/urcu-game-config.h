@@ -20,11 +20,13 @@
 #include "urcu-game.h"
 
 /*
+ * Each island has its own configuration.
+ *
  * urcu_game_config_get needs to be called within RCU read-side
  * critical section, and the returned pointer needs to be used within
  * that same RCU read-side critical section.
  */
-struct urcu_game_config *urcu_game_config_get(void);
+struct urcu_game_config *urcu_game_config_get(struct island *island);
 
 /*
  * An internal mutex is held if urcu_game_config_update_begin() returns
@@ -34,10 +36,12 @@ struct urcu_game_config *urcu_game_config_get(void);
  * urcu_game_config_update_abort() can be called to abort an update
  * (instead of calling "end").
  */
-struct urcu_game_config *urcu_game_config_update_begin(void);
-void urcu_game_config_update_end(struct urcu_game_config *new_config);
-void urcu_game_config_update_abort(struct urcu_game_config *new_config);
+struct urcu_game_config *urcu_game_config_update_begin(struct island *island);
+void urcu_game_config_update_end(struct island *island,
+		struct urcu_game_config *new_config);
+void urcu_game_config_update_abort(struct island *island,
+		struct urcu_game_config *new_config);
 
-void init_game_config(void);
+void init_game_config(struct island *island);
 
 #endif /* URCU_GAME_CONFIG_H */
@@ -20,127 +20,110 @@
 #include "urcu-game.h"
 #include "urcu-game-config.h"
 #include "ht-hash.h"
+#include "occupancy-map.h"
+#include "animal-array.h"
+#include "mem-account.h"
+#include "animal-arena.h"
+#include "recent-births.h"
+#include "lock-prof.h"
+#include "rcu-prof.h"
 
-/*
- * Lock and test for existence pair of nodes.
- *
- * Returns 1 on success, or 0 (error) if either of the nodes don't
- * exist. Returns with both locks held on success, or no lock held on
- * error.
- * Always grab the locks in increasing order of key to ensure there are
- * no deadlocks.
- */
 static
-int lock_test_pair(struct animal *first, struct animal *second)
+void lock_pair(struct island *island, struct animal *first,
+		struct animal *second)
 {
+	struct animal_lock *first_lock, *second_lock;
 	struct animal *tmp;
 
-	if (first->key > second->key) {
+	if (animal_get_lock(first) > animal_get_lock(second)) {
 		tmp = first;
 		first = second;
 		second = tmp;
 	}
-	pthread_mutex_lock(&first->lock);
-	if (cds_lfht_is_node_deleted(&first->all_node))
-		goto error_first;
-	pthread_mutex_lock(&second->lock);
-	if (cds_lfht_is_node_deleted(&second->all_node))
-		goto error_second;
-	/* ok */
-	return 1;
-
-error_second:
-	pthread_mutex_unlock(&second->lock);
-error_first:
-	pthread_mutex_unlock(&first->lock);
-	return 0;	/* error */
-}
-
-static
-void lock_pair(struct animal *first, struct animal *second)
-{
-	struct animal *tmp;
-
-	if (first->key > second->key) {
-		tmp = first;
-		first = second;
-		second = tmp;
+	first_lock = animal_get_lock(first);
+	second_lock = animal_get_lock(second);
+	if (caa_unlikely(lock_prof_enable)) {
+		lock_prof_animal_pair(island->id, first_lock, first->key,
+			second_lock, second->key);
+		return;
 	}
-	pthread_mutex_lock(&first->lock);
-	pthread_mutex_lock(&second->lock);
+	animal_lock(first_lock);
+	if (second_lock != first_lock)
+		animal_lock(second_lock);
 }
 
 static
 void unlock_pair(struct animal *first, struct animal *second)
 {
-	pthread_mutex_unlock(&second->lock);
-	pthread_mutex_unlock(&first->lock);
+	struct animal_lock *first_lock = animal_get_lock(first);
+	struct animal_lock *second_lock = animal_get_lock(second);
+
+	if (caa_unlikely(lock_prof_enable))
+		lock_prof_release(LOCK_ANIMAL_PAIR);
+	if (second_lock != first_lock)
+		animal_unlock(second_lock);
+	animal_unlock(first_lock);
 }
 
+/*
+ * Lock and test for existence pair of nodes.
+ *
+ * Returns 1 on success, or 0 (error) if either of the nodes don't
+ * exist. Returns with both locks held on success, or no lock held on
+ * error.
+ * Always grab the locks in increasing order of address to ensure there
+ * are no deadlocks. An animal meeting itself is only locked once.
+ */
 static
-int lock_test_single(struct animal *first)
+int lock_test_pair(struct island *island, struct animal *first,
+		struct animal *second)
 {
-	pthread_mutex_lock(&first->lock);
-	if (cds_lfht_is_node_deleted(&first->all_node))
-		goto error_first;
+	lock_pair(island, first, second);
+	if (first->dead || second->dead) {
+		unlock_pair(first, second);
+		return 0;	/* error */
+	}
 	/* ok */
 	return 1;
-
-error_first:
-	pthread_mutex_unlock(&first->lock);
-	return 0;	/* error */
 }
 
 static
-void lock_single(struct animal *first)
+void lock_single(struct island *island, struct animal *first)
 {
-	pthread_mutex_lock(&first->lock);
+	if (caa_unlikely(lock_prof_enable))
+		lock_prof_animal_single(island->id, animal_get_lock(first),
+			first->key);
+	else
+		animal_lock(animal_get_lock(first));
 }
 
 
 static
 void unlock_single(struct animal *first)
 {
-	pthread_mutex_unlock(&first->lock);
+	if (caa_unlikely(lock_prof_enable))
+		lock_prof_release(LOCK_ANIMAL_SINGLE);
+	animal_unlock(animal_get_lock(first));
 }
 
-/*
- * Called with RCU read-side lock held.
- */
-int try_mate(struct animal *first, struct animal *second)
+static
+int lock_test_single(struct island *island, struct animal *first)
 {
-	struct animal *female;
-	int ret = 0;
+	lock_single(island, first);
+	if (first->dead)
+		goto error_first;
+	/* ok */
+	return 1;
 
-	/*
-	 * We can test a variety of conditions without holding the lock.
-	 */
-	if (!second)
-		return 0;
-	if (first->kind.animal != second->kind.animal)
-		return 0;
-	if (first->animal_sex == second->animal_sex)
-		return 0;
-	if (first->animal_sex == ANIMAL_FEMALE)
-		female = first;
-	else
-		female = second;
-
-	if (lock_test_pair(first, second)) {
-		if (!first->nr_pregnant && !second->nr_pregnant) {
-			/*
-			 * We check if already pregnant with locks held,
-			 * since pregnancy state could otherwise change
-			 * concurrently.
-			 */
-			female->nr_pregnant =
-				rand_r(&thread_rand_seed)
-					% female->kind.max_pregnant;
-			ret = 1;
-		}
-		unlock_pair(first, second);
-	}
-	return ret;
+error_first:
+	unlock_single(first);
+	return 0;	/* error */
+}
+
+static
+struct cds_lfht *get_kind_ht(struct island *island, unsigned int type)
+{
+	return island->live_animals.kind[type];
 }
 
 static
@@ -149,7 +132,8 @@ void free_animal(struct rcu_head *head)
 	struct animal *animal;
 
 	animal = caa_container_of(head, struct animal, rcu_head);
-	free(animal);
+	mem_account(MEM_ANIMALS_RECLAIM, -(long) sizeof(*animal));
+	animal_arena_free(animal);
 }
 
 /*
@@ -157,157 +141,42 @@ void free_animal(struct rcu_head *head)
  * Needs to be called with animal lock held, or as single thread during
  * apocalypse.
  */
-void kill_animal(struct animal *animal)
+void kill_animal(struct island *island, struct animal *animal)
 {
 	int delret;
 	struct cds_lfht *ht;
 
-	switch (animal->kind.animal) {
-	case GERBIL:
-		ht = live_animals.gerbil;
-		break;
-	case CAT:
-		ht = live_animals.cat;
-		break;
-	case SNAKE:
-		ht = live_animals.snake;
-		break;
-	default:
-		abort();
-	}
-	delret = cds_lfht_del(ht, &animal->kind_node);
-	assert(delret == 0);
 	/*
-	 * We need to remove animal from "all" hash table _after_
-	 * removing it from the kind hash table, to match the fact that
-	 * existence in the "all" hash table defines the life-time of
-	 * the object. Removing in the reverse order can trigger an
-	 * abort() in the check for the ht_kind add_unique.
+	 * Clear occupancy before removing from the "all" hash table: a
+	 * new animal can only be born at this key after removal, so its
+	 * occupancy bit is set after being cleared here.
 	 */
-	delret = cds_lfht_del(live_animals.all, &animal->all_node);
-	assert(delret == 0);
-	call_rcu(&animal->rcu_head, free_animal);
-}
+	occupancy_map_clear(island, animal->key);
 
-/*
- * Called with RCU read-side lock held.
- */
-int try_eat(struct animal *first, struct animal *second)
-{
-	int ret = 0;
-
-	if (!second) {
-		if (first->kind.diet & DIET_FLOWERS) {
-			if (lock_test_single(first)) {
-				pthread_mutex_lock(&vegetation.lock);
-				if (vegetation.flowers) {
-					first->stamina++;
-					vegetation.flowers--;
-					ret = 1;
-				}
-				pthread_mutex_unlock(&vegetation.lock);
-				unlock_single(first);
-			}
-		}
-		if (!ret && first->kind.diet & DIET_TREES) {
-			if (lock_test_single(first)) {
-				pthread_mutex_lock(&vegetation.lock);
-				if (vegetation.trees) {
-					first->stamina++;
-					vegetation.trees--;
-					ret = 1;
-				}
-				pthread_mutex_unlock(&vegetation.lock);
-				unlock_single(first);
-			}
-		}
-	} else {
-		/* First animal has effect of surprise */
-		switch (second->kind.animal) {
-		case GERBIL:
-			if (first->kind.diet & DIET_GERBIL) {
-				if (lock_test_pair(first, second)) {
-					kill_animal(second);
-					first->stamina++;
-					ret = 1;
-					unlock_pair(first, second);
-				}
-			}
-			break;
-		case CAT:
-			if (first->kind.diet & DIET_CAT) {
-				if (lock_test_pair(first, second)) {
-					kill_animal(second);
-					first->stamina++;
-					ret = 1;
-					unlock_pair(first, second);
-				}
-			}
-			break;
-		case SNAKE:
-			if (first->kind.diet & DIET_SNAKE) {
-				if (lock_test_pair(first, second)) {
-					kill_animal(second);
-					first->stamina++;
-					ret = 1;
-					unlock_pair(first, second);
-				}
-			}
-			break;
-		}
-
-		switch (first->kind.animal) {
-		case GERBIL:
-			if (second->kind.diet & DIET_GERBIL) {
-				if (lock_test_pair(first, second)) {
-					kill_animal(first);
-					second->stamina++;
-					ret = 1;
-					unlock_pair(first, second);
-				}
-			}
-			break;
-		case CAT:
-			if (second->kind.diet & DIET_CAT) {
-				if (lock_test_pair(first, second)) {
-					kill_animal(first);
-					second->stamina++;
-					ret = 1;
-					unlock_pair(first, second);
-				}
-			}
-			break;
-		case SNAKE:
-			if (second->kind.diet & DIET_SNAKE) {
-				if (lock_test_pair(first, second)) {
-					kill_animal(first);
-					second->stamina++;
-					ret = 1;
-					unlock_pair(first, second);
-				}
-			}
-			break;
-		}
-	}
+	ht = get_kind_ht(island, animal->kind.animal);
+	delret = cds_lfht_del(ht, &animal->kind_node);
+	assert(delret == 0);
 	/*
-	 * If none of the animals involved in the encounter can eat,
-	 * decrement their stamina.
+	 * We need to remove animal from "all" index _after_ removing it
+	 * from the kind hash table, to match the fact that existence in
+	 * the "all" index defines the life-time of the object. Removing
+	 * in the reverse order can trigger an abort() in the check for
+	 * the ht_kind add_unique.
 	 */
-	if (!ret) {
-		if (lock_test_single(first)) {
-			first->stamina--;
-			if (!first->stamina)
-				kill_animal(first);
-			unlock_single(first);
-		}
-		if (second && lock_test_single(second)) {
-			second->stamina--;
-			if (!second->stamina)
-				kill_animal(second);
-			unlock_single(second);
-		}
+	switch (island->live_animals.index) {
+	case ANIMAL_INDEX_LFHT:
+		delret = cds_lfht_del(island->live_animals.all,
+				&animal->all_node);
+		assert(delret == 0);
+		break;
+	case ANIMAL_INDEX_ARRAY:
+		animal_array_del(island, animal->key, animal);
+		break;
 	}
-	return ret;
+	animal->dead = 1;
+	mem_account(MEM_ANIMALS, -(long) sizeof(*animal));
+	mem_account(MEM_ANIMALS_RECLAIM, sizeof(*animal));
+	call_rcu(&animal->rcu_head, free_animal);
 }
 
 static
@@ -335,107 +204,178 @@ int animal_match_kind(struct cds_lfht_node *node, const void *_key)
 }
 
 static
-unsigned long animal_hash(uint64_t key)
+unsigned long animal_hash(struct island *island, uint64_t key)
 {
 	unsigned long ret;
 
-	ret = hash_u64(&key, live_animals.ht_seed);
+	ret = hash_u64(&key, island->live_animals.ht_seed);
 	DBG("hash: %" PRIu64 " with seed %lu, result: %lu",
-		key, live_animals.ht_seed, ret);
+		key, island->live_animals.ht_seed, ret);
 	return ret;
 }
 
 /*
- * If "god" is non-zero, the animal is spontaneously created.
- * Called with RCU read-side lock held.
+ * Returns 1 if the animal is added into the "all" index, 0 if another
+ * animal already has this key.
  */
-int try_birth(struct animal *parent, uint64_t new_key, int god)
+static
+int add_unique_all(struct island *island, struct animal *animal)
 {
 	struct cds_lfht_node *node;
-	struct animal *child;
-	struct urcu_game_config *config;
-	struct cds_lfht *kind_ht;
 
-	if (!god && !parent->nr_pregnant)
-		return 0;
+	switch (island->live_animals.index) {
+	case ANIMAL_INDEX_LFHT:
+		node = cds_lfht_add_unique(island->live_animals.all,
+			animal_hash(island, animal->key),
+			animal_match_all,
+			&animal->key,
+			&animal->all_node);
+		return node == &animal->all_node;
+	case ANIMAL_INDEX_ARRAY:
+		return animal_array_add_unique(island, animal->key, animal);
+	}
+	abort();
+}
 
-	child = calloc(1, sizeof(*child));
-	if (!child)
+/*
+ * Add an animal into the island "all" index and kind hash table.
+ * Returns 1 on success, 0 if another animal already has this key.
+ *
+ * Called with RCU read-side lock held and animal lock held: this
+ * ensures that adding into the kind hash table will always succeed
+ * whenever adding into the "all" index did succeed, by blocking any
+ * "kill" action on the animal while being added only to one of them.
+ */
+static
+int settle_animal(struct island *island, struct animal *animal)
+{
+	struct cds_lfht_node *node;
+
+	if (!add_unique_all(island, animal))
+		return 0;
+	node = cds_lfht_add_unique(get_kind_ht(island, animal->kind.animal),
+		animal_hash(island, animal->key),
+		animal_match_kind,
+		&animal->key,
+		&animal->kind_node);
+	if (node != &animal->kind_node)
 		abort();
+	occupancy_map_set(island, animal->key);
+	return 1;
+}
 
-	config = urcu_game_config_get();
+/*
+ * Keys beyond the island size can be found in work queued before the
+ * island shrinks, and beyond the key limit while the island is being
+ * resized. Called with RCU read-side lock held.
+ */
+static
+int key_in_island(struct island *island, struct urcu_game_config *config,
+		uint64_t key)
+{
+	return key < config->island_size
+		&& key < CMM_LOAD_SHARED(island->live_animals.key_limit);
+}
 
-	/*
-	 * Update child kind with current configuration.
-	 */
-	switch (parent->kind.animal) {
-	case GERBIL:
-		memcpy(&child->kind, &config->gerbil, sizeof(child->kind));
-		kind_ht = live_animals.gerbil;
-		break;
-	case CAT:
-		memcpy(&child->kind, &config->cat, sizeof(child->kind));
-		kind_ht = live_animals.cat;
-		break;
-	case SNAKE:
-		memcpy(&child->kind, &config->snake, sizeof(child->kind));
-		kind_ht = live_animals.snake;
-		break;
-	default:
+static
+struct animal *alloc_animal(const struct animal_kind *kind,
+		enum animal_sex animal_sex, uint64_t key, uint64_t stamina,
+		uint64_t nr_pregnant)
+{
+	struct animal *animal;
+
+	animal = animal_arena_alloc(sizeof(*animal));
+	if (!animal)
 		abort();
-	}
+	memcpy(&animal->kind, kind, sizeof(animal->kind));
+	animal->animal_sex = animal_sex;
+	animal->key = key;
+	animal->stamina = stamina;
+	animal->stamina_epoch = CMM_LOAD_SHARED(stamina_epoch);
+	animal->nr_pregnant = nr_pregnant;
+	animal_init_lock(animal);
+	mem_account(MEM_ANIMALS, sizeof(*animal));
+	return animal;
+}
+
+/* Free an animal which was never settled into an island. */
+static
+void discard_animal(struct animal *animal)
+{
+	mem_account(MEM_ANIMALS, -(long) sizeof(*animal));
+	animal_arena_free(animal);
+}
 
-	child->animal_sex = (rand_r(&thread_rand_seed) & 1) ?
-		ANIMAL_FEMALE : ANIMAL_MALE;
-	child->key = new_key;
-	child->stamina = rand_r(&thread_rand_seed)
-		% child->kind.max_birth_stamina;
-	child->nr_pregnant = 0;
-	pthread_mutex_init(&child->lock, NULL);
+/*
+ * Allocate a newborn of type "type" at "new_key", with traits of the
+ * current configuration. Returns NULL if the key is not in the island.
+ * Called with RCU read-side lock held.
+ */
+static
+struct animal *alloc_child(struct island *island, unsigned int type,
+		uint64_t new_key)
+{
+	struct urcu_game_config *config;
+	const struct animal_kind *kind;
+	struct animal *child;
 
+	config = urcu_game_config_get(island);
+	if (!key_in_island(island, config, new_key))
+		return NULL;
+
+	kind = &config->kind[type];
+	child = alloc_animal(kind,
+		(urcu_game_rand_u64(&thread_rand) >> 63) ?
+			ANIMAL_FEMALE : ANIMAL_MALE,
+		new_key,
+		urcu_game_rand_bounded(&thread_rand, kind->max_birth_stamina),
+		0);
 	assert(child->kind.max_pregnant > 0);
+	return child;
+}
+
+/*
+ * If "god" is non-zero, the animal is spontaneously created.
+ * Called with RCU read-side lock held.
+ */
+int try_birth(struct island *island, struct animal *parent,
+		uint64_t new_key, int god)
+{
+	struct animal *child;
+
+	if (!god && !parent->nr_pregnant)
+		return 0;
+
+	child = alloc_child(island, parent->kind.animal, new_key);
+	if (!child)
+		return 0;
 
 	/*
 	 * We need to lock the parent to ensure it is not killed
 	 * concurrently before giving birth.
 	 *
-	 * We hold the child lock while adding into the hash tables to
-	 * ensure that adding into the kind hash table will always
-	 * succeed whenever adding into the "all" hash table did
-	 * succeed. This blocks any "kill" action on the child while
-	 * being added only to one hash table, therefore ensuring
-	 * consistency.
+	 * We hold the child lock while adding into the hash tables, as
+	 * required by settle_animal().
 	 */
 	if (!god) {
-		lock_pair(parent, child);
-		if (cds_lfht_is_node_deleted(&parent->all_node)) {
+		lock_pair(island, parent, child);
+		if (parent->dead) {
 			unlock_pair(parent, child);
-			free(child);
+			discard_animal(child);
 			return 0;
 		}
 	} else {
-		lock_single(child);
+		lock_single(island, child);
 	}
 
-	node = cds_lfht_add_unique(live_animals.all,
-		animal_hash(new_key),
-		animal_match_all,
-		&new_key,
-		&child->all_node);
-	if (node == &child->all_node) {
-		node = cds_lfht_add_unique(kind_ht,
-			animal_hash(new_key),
-			animal_match_kind,
-			&new_key,
-			&child->kind_node);
-		if (node != &child->kind_node)
-			abort();
+	if (settle_animal(island, child)) {
 		/* Successfully added */
 		parent->nr_pregnant--;
 		if (!god)
 			unlock_pair(parent, child);
 		else
 			unlock_single(child);
+		record_birth(island->id, child->kind.animal, child->key);
 		return 1;
 	} else {
 		/* Another node already present */
@@ -443,23 +383,402 @@ int try_birth(struct animal *parent, uint64_t new_key, int god)
 			unlock_pair(parent, child);
 		else
 			unlock_single(child);
-		free(child);
+		discard_animal(child);
+		return 0;
+	}
+}
+
+/*
+ * Animals lose one stamina per epoch. Stamina is only written when it
+ * increases, so encounters without food cost no write.
+ */
+static
+uint64_t current_stamina(const struct animal *animal, uint32_t epoch)
+{
+	uint32_t elapsed = epoch - animal->stamina_epoch;
+
+	return animal->stamina > elapsed ? animal->stamina - elapsed : 0;
+}
+
+/*
+ * Kill the animal if exhausted. Returns its current stamina.
+ * Called with RCU read-side lock held and animal lock held.
+ */
+static
+uint64_t decay_animal(struct island *island, struct animal *animal)
+{
+	uint64_t stamina;
+
+	stamina = current_stamina(animal, CMM_LOAD_SHARED(stamina_epoch));
+	if (!stamina)
+		kill_animal(island, animal);
+	return stamina;
+}
+
+/*
+ * Called with animal lock held, on an animal which is not exhausted.
+ */
+static
+void feed_animal(struct animal *animal)
+{
+	uint32_t epoch = CMM_LOAD_SHARED(stamina_epoch);
+
+	animal->stamina = current_stamina(animal, epoch) + 1;
+	animal->stamina_epoch = epoch;
+}
+
+/*
+ * Eat vegetation. Returns 1 if something was eaten.
+ * Called with animal lock held.
+ */
+static
+int graze(struct island *island, struct animal *animal)
+{
+	struct vegetation *vegetation = &island->vegetation;
+	unsigned int diet = species_table[animal->kind.animal].vegetation;
+	int ret = 0;
+
+	if (!(diet & (DIET_FLOWERS | DIET_TREES)))
+		return 0;
+	prof_mutex_lock(&vegetation->lock, LOCK_VEGETATION);
+	if ((diet & DIET_FLOWERS) && vegetation->flowers) {
+		vegetation->flowers--;
+		ret = 1;
+	} else if ((diet & DIET_TREES) && vegetation->trees) {
+		vegetation->trees--;
+		ret = 1;
+	}
+	prof_mutex_unlock(&vegetation->lock, LOCK_VEGETATION);
+	return ret;
+}
+
+/*
+ * A lone animal gives birth at the empty key it met, if pregnant, then
+ * eats vegetation. Parent and child are locked once for the whole
+ * encounter.
+ */
+static
+unsigned int lone_encounter(struct island *island, struct animal *animal,
+		uint64_t new_key)
+{
+	struct animal *child = NULL;
+	unsigned int ret = 0;
+	int settled = 0;
+
+	/* Pregnancy is checked again with the lock held. */
+	if (CMM_LOAD_SHARED(animal->nr_pregnant) && new_key != animal->key)
+		child = alloc_child(island, animal->kind.animal, new_key);
+
+	if (child) {
+		if (!lock_test_pair(island, animal, child)) {
+			discard_animal(child);
+			return 0;
+		}
+	} else if (!lock_test_single(island, animal)) {
+		return 0;
+	}
+
+	if (!decay_animal(island, animal)) {
+		ret |= ENCOUNTER_DEATH;
+		goto end;
+	}
+	if (child && animal->nr_pregnant && settle_animal(island, child)) {
+		animal->nr_pregnant--;
+		settled = 1;
+		ret |= ENCOUNTER_BIRTH;
+	}
+	if (graze(island, animal)) {
+		feed_animal(animal);
+		ret |= ENCOUNTER_EAT;
+	}
+end:
+	if (child) {
+		unlock_pair(animal, child);
+		/* The child cannot be reclaimed before RCU read unlock. */
+		if (settled)
+			record_birth(island->id, child->kind.animal,
+				child->key);
+		else
+			discard_animal(child);
+	} else {
+		unlock_single(animal);
+	}
+	return ret;
+}
+
+enum pair_action {
+	PAIR_IGNORE,		/* nothing happens */
+	PAIR_FIRST_EATS,
+	PAIR_SECOND_EATS,
+	PAIR_MATE,		/* may mate */
+};
+
+#define PAIR_FIRST_CAN_EAT	(1U << 0)
+#define PAIR_SECOND_CAN_EAT	(1U << 1)
+#define PAIR_SAME_KIND		(1U << 2)
+
+/*
+ * Outcome of a pair encounter, indexed by PAIR_* flags. The first
+ * animal has the effect of surprise.
+ */
+static
+const enum pair_action pair_actions[] = {
+	[0] = PAIR_IGNORE,
+	[PAIR_FIRST_CAN_EAT] = PAIR_FIRST_EATS,
+	[PAIR_SECOND_CAN_EAT] = PAIR_SECOND_EATS,
+	[PAIR_FIRST_CAN_EAT | PAIR_SECOND_CAN_EAT] = PAIR_FIRST_EATS,
+	[PAIR_SAME_KIND] = PAIR_MATE,
+	[PAIR_SAME_KIND | PAIR_FIRST_CAN_EAT] = PAIR_FIRST_EATS,
+	[PAIR_SAME_KIND | PAIR_SECOND_CAN_EAT] = PAIR_SECOND_EATS,
+	[PAIR_SAME_KIND | PAIR_FIRST_CAN_EAT | PAIR_SECOND_CAN_EAT] =
+		PAIR_FIRST_EATS,
+};
+
+/*
+ * Diets are in the species registry, which is never modified: the
+ * outcome is decided before taking the locks, without branches.
+ */
+static
+unsigned int pair_flags(const struct animal *first,
+		const struct animal *second)
+{
+	unsigned int a = first->kind.animal, b = second->kind.animal;
+
+	return species_eats(a, b)
+		| species_eats(b, a) << 1
+		| (a == b) << 2;
+}
+
+/*
+ * Called with animal locks held.
+ */
+static
+int mate(struct animal *first, struct animal *second)
+{
+	struct animal *female;
+
+	if (first->dead || second->dead)
+		return 0;
+	if (first->animal_sex == second->animal_sex)
+		return 0;
+	if (first->nr_pregnant || second->nr_pregnant)
+		return 0;
+	female = first->animal_sex == ANIMAL_FEMALE ? first : second;
+	female->nr_pregnant = urcu_game_rand_bounded(&thread_rand,
+		female->kind.max_pregnant);
+	return 1;
+}
+
+static
+unsigned int pair_encounter(struct island *island, struct animal *first,
+		struct animal *second)
+{
+	unsigned int ret = 0;
+
+	if (!lock_test_pair(island, first, second))
+		return 0;
+	/* Exhausted animals die before anything else happens. */
+	if (!decay_animal(island, first) || !decay_animal(island, second)) {
+		ret |= ENCOUNTER_DEATH;
+		goto end;
+	}
+	switch (pair_actions[pair_flags(first, second)]) {
+	case PAIR_FIRST_EATS:
+		kill_animal(island, second);
+		feed_animal(first);
+		ret |= ENCOUNTER_EAT | ENCOUNTER_DEATH;
+		break;
+	case PAIR_SECOND_EATS:
+		kill_animal(island, first);
+		feed_animal(second);
+		ret |= ENCOUNTER_EAT | ENCOUNTER_DEATH;
+		break;
+	case PAIR_MATE:
+		if (mate(first, second))
+			ret |= ENCOUNTER_MATE;
+		break;
+	case PAIR_IGNORE:
+		break;
+	}
+end:
+	unlock_pair(first, second);
+	return ret;
+}
+
+/*
+ * Resolve the encounter of "first" with "second", or with the empty
+ * key "second_key" if "second" is NULL, within a single critical
+ * section. Returns a mask of ENCOUNTER_* outcomes.
+ * Called with RCU read-side lock held.
+ */
+unsigned int resolve_encounter(struct island *island, struct animal *first,
+		struct animal *second, uint64_t second_key)
+{
+	if (!second)
+		return lone_encounter(island, first, second_key);
+	return pair_encounter(island, first, second);
+}
+
+/* Rehome attempts before an evicted animal is killed. */
+#define EVICT_REHOME_ATTEMPTS	8
+
+/*
+ * Move an animal to a random key below "limit", or kill it if no free
+ * key is found within a few attempts. Returns 1 if rehomed, 0 if
+ * killed, -1 if it was already dead.
+ * Called with RCU read-side lock held.
+ */
+int evict_animal(struct island *island, struct animal *animal,
+		uint64_t limit)
+{
+	int i;
+
+	for (i = 0; i < EVICT_REHOME_ATTEMPTS; i++) {
+		struct animal *copy;
+
+		/*
+		 * The copy is not visible yet, but may share its lock
+		 * with any animal: lock both in order.
+		 */
+		copy = alloc_animal(&animal->kind, animal->animal_sex,
+			urcu_game_rand_bounded(&thread_rand, limit), 0, 0);
+		if (!lock_test_pair(island, animal, copy)) {
+			discard_animal(copy);
+			return -1;
+		}
+		copy->stamina = animal->stamina;
+		copy->stamina_epoch = animal->stamina_epoch;
+		copy->nr_pregnant = animal->nr_pregnant;
+		if (settle_animal(island, copy)) {
+			kill_animal(island, animal);
+			unlock_pair(animal, copy);
+			return 1;
+		}
+		unlock_pair(animal, copy);
+		discard_animal(copy);
+	}
+	if (!lock_test_single(island, animal))
+		return -1;
+	kill_animal(island, animal);
+	unlock_single(animal);
+	return 0;
+}
+
+/*
+ * Remove a live animal from its island. Returns the migrant to queue
+ * into the destination island, or NULL if the animal died
+ * concurrently or of exhaustion.
+ * Called with RCU read-side lock held.
+ */
+struct migrant *emigrate_animal(struct island *island, struct animal *animal)
+{
+	struct migrant *migrant;
+	uint64_t stamina;
+
+	if (!lock_test_single(island, animal))
+		return NULL;
+	stamina = decay_animal(island, animal);
+	if (!stamina) {
+		unlock_single(animal);
+		return NULL;
+	}
+	migrant = malloc(sizeof(*migrant));
+	if (!migrant)
+		abort();
+	mem_account(MEM_MIGRANTS, sizeof(*migrant));
+	memcpy(&migrant->kind, &animal->kind, sizeof(migrant->kind));
+	migrant->animal_sex = animal->animal_sex;
+	migrant->stamina = stamina;
+	migrant->nr_pregnant = animal->nr_pregnant;
+	kill_animal(island, animal);
+	unlock_single(animal);
+	return migrant;
+}
+
+/* Random keys tried before a migrant is lost on arrival. */
+#define IMMIGRATE_ATTEMPTS	8
+
+/*
+ * Settle a migrant at a random free key of the island. The migrant
+ * keeps the traits of its island of origin. Returns 1 on success, 0 if
+ * no free key was found.
+ * Called with RCU read-side lock held.
+ */
+int immigrate_animal(struct island *island, const struct migrant *migrant)
+{
+	struct urcu_game_config *config;
+	uint64_t limit;
+	int i;
+
+	config = urcu_game_config_get(island);
+	limit = CMM_LOAD_SHARED(island->live_animals.key_limit);
+	if (limit > config->island_size)
+		limit = config->island_size;
+	if (!limit)
 		return 0;
+	for (i = 0; i < IMMIGRATE_ATTEMPTS; i++) {
+		struct animal *animal;
+
+		animal = alloc_animal(&migrant->kind, migrant->animal_sex,
+			urcu_game_rand_bounded(&thread_rand, limit),
+			migrant->stamina, migrant->nr_pregnant);
+		lock_single(island, animal);
+		if (settle_animal(island, animal)) {
+			unlock_single(animal);
+			return 1;
+		}
+		unlock_single(animal);
+		discard_animal(animal);
+	}
+	return 0;
+}
+
+/*
+ * Kill the animals of keys [start, end) which died of exhaustion.
+ * Returns the number of animals killed.
+ * Called with RCU read-side lock held.
+ */
+uint64_t reap_exhausted(struct island *island, uint64_t start,
+		uint64_t end)
+{
+	uint32_t epoch = CMM_LOAD_SHARED(stamina_epoch);
+	uint64_t key, nr = 0;
+
+	for (key = start; key < end; key++) {
+		struct animal *animal;
+
+		if (!occupancy_map_test(island, key))
+			continue;
+		animal = find_animal(island, key);
+		if (!animal)
+			continue;
+		/* Unlocked hint: only lock animals which look exhausted. */
+		if (current_stamina(animal, epoch))
+			continue;
+		if (!lock_test_single(island, animal))
+			continue;
+		if (!decay_animal(island, animal))
+			nr++;
+		unlock_single(animal);
 	}
+	return nr;
 }
 
 /*
  * Called from RCU read-side critical section. RCU read-side critical
  * section should encompass use of returned struct animal pointer.
  */
-struct animal *find_animal(uint64_t key)
+struct animal *find_animal(struct island *island, uint64_t key)
 {
 	struct cds_lfht_iter iter;
 	struct cds_lfht_node *node;
 	struct animal *animal = NULL;
 
-	cds_lfht_lookup(live_animals.all,
-			animal_hash(key),
+	if (island->live_animals.index == ANIMAL_INDEX_ARRAY)
+		return animal_array_lookup(island, key);
+
+	cds_lfht_lookup(island->live_animals.all,
+			animal_hash(island, key),
 			animal_match_all,
 			&key,
 			&iter);
@@ -470,35 +789,80 @@ struct animal *find_animal(uint64_t key)
 	return animal;
 }
 
-void apocalypse(void)
+static
+void kill_all_kind(struct island *island, struct cds_lfht *ht)
 {
-	struct cds_lfht *ht = live_animals.all;
 	struct cds_lfht_iter iter;
 	struct animal *animal;
 
-	DBG("Apocalypse");
-	rcu_read_lock();
-	cds_lfht_for_each_entry(ht, &iter, animal, all_node) {
+	cds_lfht_for_each_entry(ht, &iter, animal, kind_node) {
 		DBG("Kill animal %" PRIu64, animal->key);
-		pthread_mutex_lock(&animal->lock);
-		if (!cds_lfht_is_node_deleted(&animal->all_node))
-			kill_animal(animal);
-		pthread_mutex_unlock(&animal->lock);
+		if (lock_test_single(island, animal)) {
+			kill_animal(island, animal);
+			unlock_single(animal);
+		}
+	}
+}
+
+/*
+ * Every live animal is in exactly one kind hash table, whatever the
+ * "all" index used.
+ */
+void apocalypse(struct island *island)
+{
+	unsigned int i;
+
+	DBG("Apocalypse on island %lu", island->id);
+	prof_rcu_read_lock();
+	for (i = 0; i < nr_species; i++)
+		kill_all_kind(island, island->live_animals.kind[i]);
+	prof_rcu_read_unlock();
+	/* Rare bulk operation: publish the accounting now. */
+	mem_account_flush();
+}
+
+/*
+ * Kill the animals of species "type", or of all species if type is
+ * MAX_SPECIES, within keys [start, end). Returns the number of animals
+ * killed. Called with RCU read-side lock held.
+ */
+uint64_t cull_animals(struct island *island, uint64_t start, uint64_t end,
+		unsigned int type)
+{
+	uint64_t key, nr = 0;
+
+	for (key = start; key < end; key++) {
+		struct animal *animal;
+
+		if (!occupancy_map_test(island, key))
+			continue;
+		animal = find_animal(island, key);
+		if (!animal)
+			continue;
+		if (type != MAX_SPECIES && animal->kind.animal != type)
+			continue;
+		if (!lock_test_single(island, animal))
+			continue;
+		kill_animal(island, animal);
+		unlock_single(animal);
+		nr++;
 	}
-	rcu_read_unlock();
+	return nr;
 }
 
 /*
  * Try to create at most "nr" animals. No guarantee of success.
+ * Returns the number of animals created.
  */
-void create_animals(enum animal_types type, uint64_t nr)
+uint64_t create_animals(struct island *island, unsigned int type,
+		uint64_t nr)
 {
-	uint64_t i;
+	uint64_t i, nr_created = 0;
 	struct animal parent;
 	struct urcu_game_config *config;
 
-	rcu_read_lock();
-	config = urcu_game_config_get();
+	prof_rcu_read_lock();
+	config = urcu_game_config_get(island);
 	/*
 	 * When we create animal as god, we only care about animal type.
 	 * The rest is derived from the current configuration.
@@ -507,12 +871,16 @@ void create_animals(enum animal_types type, uint64_t nr)
 
 	for (i = 0; i < nr; i++) {
 		uint64_t child_key =
-			rand_r(&thread_rand_seed) % config->island_size;
+			urcu_game_rand_bounded(&thread_rand,
+				config->island_size);
 		int ret;
 
-		ret = try_birth(&parent, child_key, 1);
+		ret = try_birth(island, &parent, child_key, 1);
 		DBG("God create animal %d, return: %d",
 			type, ret);
+		nr_created += ret;
 	}
-	rcu_read_unlock();
+	prof_rcu_read_unlock();
+	mem_account_flush();
+	return nr_created;
 }
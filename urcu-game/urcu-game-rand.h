@@ -0,0 +1,112 @@
+#ifndef URCU_GAME_RAND_H
+#define URCU_GAME_RAND_H
+
+/*
+ * urcu-game-rand.h
+ *
+ * Copyright (C) 2013  Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED
+ * OR IMPLIED.  ANY USE IS AT YOUR OWN RISK.
+ *
+ * Permission is hereby granted to use or copy this program for any
+ * purpose,  provided the above notices are retained on all copies.
+ * Permission to modify the code and to distribute modified code is
+ * granted, provided the above notices are retained, and a notice that
+ * the code was modified is included with the above copyright notice.
+ */
+
+#include <stdint.h>
+#include <urcu/compiler.h>
+
+/*
+ * Pseudo-random number generator: xoshiro256**
+ * Source: http://prng.di.unimi.it/xoshiro256starstar.c
+ * Originally Public Domain (David Blackman and Sebastiano Vigna)
+ *
+ * Seeded with splitmix64, as recommended by the authors. Not
+ * thread-safe: each thread uses its own state.
+ */
+
+struct urcu_game_rand {
+	uint64_t s[4];
+};
+
+static inline
+uint64_t urcu_game_rand_rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline
+uint64_t urcu_game_rand_splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline
+void urcu_game_rand_seed(struct urcu_game_rand *r, uint64_t seed)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		r->s[i] = urcu_game_rand_splitmix64(&seed);
+}
+
+static inline
+uint64_t urcu_game_rand_u64(struct urcu_game_rand *r)
+{
+	uint64_t *s = r->s;
+	const uint64_t result = urcu_game_rand_rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = urcu_game_rand_rotl(s[3], 45);
+	return result;
+}
+
+/*
+ * Map a 64-bit random value to [0, bound) with a single multiplication.
+ * Returns 0 if the value has to be rejected to keep the result
+ * unbiased, 1 otherwise.
+ * Source: Daniel Lemire, "Fast Random Integer Generation in an
+ * Interval", ACM Transactions on Modeling and Computer Simulation, 2019.
+ */
+static inline
+int urcu_game_rand_reduce(uint64_t x, uint64_t bound, uint64_t *result)
+{
+	unsigned __int128 m = (unsigned __int128) x * bound;
+	uint64_t l = (uint64_t) m;
+
+	if (caa_unlikely(l < bound)) {
+		uint64_t threshold = -bound % bound;
+
+		if (l < threshold)
+			return 0;
+	}
+	*result = (uint64_t) (m >> 64);
+	return 1;
+}
+
+/*
+ * Unbiased random value within [0, bound). bound must be non-zero.
+ */
+static inline
+uint64_t urcu_game_rand_bounded(struct urcu_game_rand *r, uint64_t bound)
+{
+	uint64_t result;
+
+	while (!urcu_game_rand_reduce(urcu_game_rand_u64(r), bound, &result))
+		;
+	return result;
+}
+
+#endif /* URCU_GAME_RAND_H */
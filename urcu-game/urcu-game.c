@@ -17,35 +17,140 @@
 #include <urcu.h>
 #include <time.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
 #include "urcu-game.h"
 #include "urcu-game-config.h"
 #include "worker-thread.h"
+#include "dispatch-thread.h"
+#include "animal-arena.h"
+#include "recent-births.h"
+#include "recorder.h"
+#include "perf-counters.h"
+#include "lock-prof.h"
+#include "rcu-prof.h"
 
 static
 long nr_worker_threads = 8;
 
-__thread unsigned int thread_rand_seed;
+static
+unsigned long nr_islands_opt = 1;
 
-int verbose, exit_program, clear_screen_enable = 1;
+static
+enum animal_index animal_index;
+
+static
+const char *scenario_path;
+
+static
+const char *species_path;
 
-struct live_animals live_animals;
-struct vegetation vegetation = {
-	.flowers = DEFAULT_VEGETATION_FLOWERS,
-	.trees = DEFAULT_VEGETATION_TREES,
-	.lock = PTHREAD_MUTEX_INITIALIZER,
+static
+const char *recorder_path;
+
+static
+unsigned int recorder_period = DEFAULT_RECORDER_PERIOD;
+
+static
+struct worker_attr worker_attr;
+
+static
+int occupancy_map_enable = 1;
+
+static
+enum animal_arena_type arena_type;
+
+static
+uint64_t arena_nr_animals = ANIMAL_ARENA_DEFAULT_NR;
+
+static
+int ht_mmap;
+
+static
+struct dispatch_attr dispatch_attr = {
+	.nr_threads = 1,
+	.target_q_len = DEFAULT_TARGET_Q_LEN,
 };
 
+uint64_t rand_base_seed;
+__thread struct urcu_game_rand thread_rand;
+
+int verbose, exit_program, clear_screen_enable = 1;
+
+void thread_rand_init(enum rand_stream stream, unsigned long id)
+{
+	uint64_t x = ((uint64_t) stream << 56) ^ id;
+
+	urcu_game_rand_seed(&thread_rand,
+		rand_base_seed ^ urcu_game_rand_splitmix64(&x));
+}
+
 void show_usage(int argc, char **argv)
 {
 	printf("Usage: %s <OPTIONS>\n", argv[0]);
 	printf("OPTIONS:\n");
         printf("        [-v]             Verbose output.\n");
         printf("        [-c]             Disable clear screen.\n");
-        printf("        [-w nr_threads]  Number of worker threads.\n");
+        printf("        [-u period]      Screen refresh period, in ms (default: %d).\n",
+		DEFAULT_REFRESH_PERIOD);
+        printf("        [-w nr_threads]  Number of worker threads, resizable at runtime.\n");
+        printf("        [-d nr_threads]  Number of dispatch threads.\n");
+        printf("        [-n nr_islands]  Number of islands.\n");
+        printf("        [-m rate]        Migrations between islands, per million encounters.\n");
+        printf("        [-i index]       All animals index: lfht (default) or array.\n");
+        printf("        [-b]             Disable occupancy map (hash lookup of empty keys).\n");
+        printf("        [-H arena]       Animal arena pages: none (default), thp or hugetlb.\n");
+        printf("        [-A nr_animals]  Animal arena capacity (default: %lu).\n",
+		ANIMAL_ARENA_DEFAULT_NR);
+        printf("        [-T]             Hash table buckets from the liburcu mmap backend.\n");
+        printf("        [-R depth]       Recent births shown, 0 to disable (default: %d, max %d).\n",
+		DEFAULT_RECENT_BIRTHS, MAX_RECENT_BIRTHS);
+        printf("        [-r seed]        Random number generator base seed.\n");
+        printf("        [-e period]      Stamina decay period, in ms (default: %d).\n",
+		DEFAULT_STAMINA_DECAY_PERIOD);
+        printf("        [-s rate]        Self-driving workers, without dispatch thread,\n");
+        printf("                         at rate encounters/s per worker (0: unbounded).\n");
+        printf("        [-f scenario]    Run scenario file headless, then exit.\n");
+        printf("        [-k species]     Load species file (default: gerbil, cat, snake).\n");
+        printf("        [-o file]        Record population time series to file.\n");
+        printf("        [-p period]      Time series sampling period, in ms (default: %d).\n",
+		DEFAULT_RECORDER_PERIOD);
+        printf("        [-a]             Adaptive dispatch rate control.\n");
+        printf("        [-q q_len]       Adaptive dispatch target queue depth.\n");
+        printf("        [-l]             Drop encounters when worker queues are full.\n");
+        printf("        [-P]             Worker performance counters, per encounter.\n");
+        printf("        [-L]             Lock contention profiler.\n");
+        printf("        [-G threshold]   RCU read-side profiler, warn on grace periods over\n");
+        printf("                         threshold ms (default: %d).\n",
+		DEFAULT_RCU_STALL_THRESHOLD);
 	printf("        [-h]             Show this help.\n");
 	printf("\n");
 }
 
+static
+int rand_seed_set;
+
+/*
+ * Parse a decimal option value within [min, max]. Returns 0 on
+ * success, -1 on trailing characters, sign or out of range value.
+ */
+static
+int parse_option_u64(const char *str, uint64_t min, uint64_t max,
+		uint64_t *value)
+{
+	char *endptr;
+
+	if (*str == '-')
+		return -1;
+	errno = 0;
+	*value = strtoull(str, &endptr, 10);
+	if (errno || endptr == str || *endptr != '\0'
+			|| *value < min || *value > max)
+		return -1;
+	return 0;
+}
+
 int parse_args(int argc, char **argv)
 {
 	int i, err = 0;
@@ -67,6 +172,238 @@ int parse_args(int argc, char **argv)
 				err = -1;
 				goto end;
 			}
+			if (nr_worker_threads > MAX_WORKER_THREADS) {
+				printf("At most %d worker threads.\n",
+					MAX_WORKER_THREADS);
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'd':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			dispatch_attr.nr_threads = atol(argv[++i]);
+			if (!dispatch_attr.nr_threads
+					|| dispatch_attr.nr_threads > LONG_MAX) {
+				printf("Please specify a positive and non-zero number of dispatch threads.\n");
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'n':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			nr_islands_opt = atol(argv[++i]);
+			if (!nr_islands_opt || nr_islands_opt > LONG_MAX) {
+				printf("Please specify a positive and non-zero number of islands.\n");
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'm':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			migration_rate = strtoull(argv[++i], NULL, 10);
+			if (migration_rate > MIGRATION_RATE_SCALE) {
+				printf("Migration rate must be within 0 and %d.\n",
+					MIGRATION_RATE_SCALE);
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'i':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			i++;
+			if (!strcmp(argv[i], "lfht")) {
+				animal_index = ANIMAL_INDEX_LFHT;
+			} else if (!strcmp(argv[i], "array")) {
+				animal_index = ANIMAL_INDEX_ARRAY;
+			} else {
+				printf("Unknown index type %s\n", argv[i]);
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'b':
+			occupancy_map_enable = 0;
+			break;
+		case 'H':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			i++;
+			if (!strcmp(argv[i], "none")) {
+				arena_type = ANIMAL_ARENA_NONE;
+			} else if (!strcmp(argv[i], "thp")) {
+				arena_type = ANIMAL_ARENA_THP;
+			} else if (!strcmp(argv[i], "hugetlb")) {
+				arena_type = ANIMAL_ARENA_HUGETLB;
+			} else {
+				printf("Unknown arena type %s\n", argv[i]);
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'A':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			if (parse_option_u64(argv[++i], 1,
+					ANIMAL_ARENA_MAX_NR,
+					&arena_nr_animals)) {
+				printf("Arena capacity must be within 1 and %llu animals.\n",
+					ANIMAL_ARENA_MAX_NR);
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'T':
+			ht_mmap = 1;
+			break;
+		case 'R':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			recent_births_depth = strtoul(argv[++i], NULL, 10);
+			if (recent_births_depth > MAX_RECENT_BIRTHS) {
+				printf("Recent births depth must be within 0 and %d.\n",
+					MAX_RECENT_BIRTHS);
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'r':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			rand_base_seed = strtoull(argv[++i], NULL, 0);
+			rand_seed_set = 1;
+			break;
+		case 'e':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			stamina_decay_period = strtoul(argv[++i], NULL, 10);
+			if (!stamina_decay_period
+					|| stamina_decay_period > INT_MAX) {
+				printf("Please specify a positive and non-zero stamina decay period.\n");
+				err = -1;
+				goto end;
+			}
+			break;
+		case 's':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			worker_attr.self_driving = 1;
+			if (parse_option_u64(argv[++i], 0,
+					MAX_SELF_DRIVING_RATE,
+					&worker_attr.rate)) {
+				printf("Self-driving rate must be within 0 and %llu encounters/s.\n",
+					MAX_SELF_DRIVING_RATE);
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'f':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			scenario_path = argv[++i];
+			break;
+		case 'k':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			species_path = argv[++i];
+			break;
+		case 'o':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			recorder_path = argv[++i];
+			break;
+		case 'p':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			recorder_period = strtoul(argv[++i], NULL, 10);
+			if (!recorder_period || recorder_period > INT_MAX) {
+				printf("Please specify a positive and non-zero sampling period.\n");
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'u':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			refresh_period = strtoul(argv[++i], NULL, 10);
+			if (!refresh_period || refresh_period > INT_MAX) {
+				printf("Please specify a positive and non-zero refresh period.\n");
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'a':
+			dispatch_attr.adaptive = 1;
+			break;
+		case 'q':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			dispatch_attr.target_q_len = atol(argv[++i]);
+			if (!dispatch_attr.target_q_len
+					|| dispatch_attr.target_q_len > MAX_WQ_LEN) {
+				printf("Target queue depth must be within 1 and %d.\n",
+					MAX_WQ_LEN);
+				err = -1;
+				goto end;
+			}
+			break;
+		case 'l':
+			dispatch_attr.load_shedding = 1;
+			break;
+		case 'P':
+			perf_counters_enable = 1;
+			break;
+		case 'L':
+			lock_prof_enable = 1;
+			break;
+		case 'G':
+			if (argc < i + 2) {
+				err = -1;
+				goto end;
+			}
+			rcu_stall_threshold = strtoul(argv[++i], NULL, 10);
+			if (!rcu_stall_threshold
+					|| rcu_stall_threshold > INT_MAX) {
+				printf("Please specify a positive and non-zero stall threshold.\n");
+				err = -1;
+				goto end;
+			}
+			rcu_prof_enable = 1;
 			break;
 		case 'v':
 			verbose = 1;
@@ -83,6 +420,14 @@ int parse_args(int argc, char **argv)
 			goto end;
 		}
 	}
+	if (dispatch_attr.nr_threads > nr_worker_threads) {
+		printf("Cannot have more dispatch threads than worker threads.\n");
+		err = -1;
+	}
+	if (nr_islands_opt > nr_worker_threads) {
+		printf("Cannot have more islands than worker threads.\n");
+		err = -1;
+	}
 end:
 	if (err)
 		show_usage(argc, argv);
@@ -105,84 +450,144 @@ int main(int argc, char **argv)
 
 	printf("Welcome to the Island of RCU\n\n");
 
-	printf("Spawning %ld worker threads.\n",
-		nr_worker_threads);
-
-	init_game_config();
-
-	live_animals.ht_seed = time(NULL);
-
-	live_animals.all = cds_lfht_new(4096, 1, 0,
-		CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING, NULL);
-	if (!live_animals.all)
-		abort();
-	live_animals.gerbil = cds_lfht_new(4096, 1, 0,
-		CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING, NULL);
-	if (!live_animals.gerbil)
-		abort();
-	live_animals.cat = cds_lfht_new(4096, 1, 0,
-		CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING, NULL);
-	if (!live_animals.cat)
-		abort();
-	live_animals.snake = cds_lfht_new(4096, 1, 0,
-		CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING, NULL);
-	if (!live_animals.snake)
-		abort();
-
-	err = create_worker_threads(nr_worker_threads);
+	err = init_exit_event();
 	if (err)
 		goto end;
 
-	err = create_input_thread();
+	err = species_load(species_path);
 	if (err)
 		goto end;
+	printf("Species: %u\n", nr_species);
 
-	err = create_output_thread();
-	if (err)
+	if (!rand_seed_set)
+		rand_base_seed = time(NULL);
+	printf("Random seed: %" PRIu64 "\n", rand_base_seed);
+	thread_rand_init(RAND_STREAM_MAIN, 0);
+
+	if (worker_attr.self_driving)
+		printf("Spawning %ld self-driving worker threads, %lu islands.\n",
+			nr_worker_threads, nr_islands_opt);
+	else
+		printf("Spawning %ld worker threads, %lu dispatch threads, "
+			"%lu islands.\n", nr_worker_threads,
+			dispatch_attr.nr_threads, nr_islands_opt);
+
+	printf("Animal size: %zu bytes, %zu bytes lock per animal.\n",
+		sizeof(struct animal), sizeof(struct animal_lock));
+
+	err = animal_arena_init(arena_type, sizeof(struct animal),
+		arena_nr_animals);
+	if (err) {
+		fprintf(stderr, "Cannot map %s animal arena.\n",
+			animal_arena_type_name(arena_type));
 		goto end;
+	}
+	if (arena_type != ANIMAL_ARENA_NONE)
+		printf("Animal arena: %s, %" PRIu64 " animals of %zu bytes.\n",
+			animal_arena_type_name(arena_type), arena_nr_animals,
+			animal_arena.obj_size);
 
-	err = create_dispatch_thread();
+	err = create_islands(nr_islands_opt, animal_index,
+		occupancy_map_enable, ht_mmap);
 	if (err)
 		goto end;
 
-	err = join_dispatch_thread();
+	if (rcu_prof_enable) {
+		err = create_rcu_watchdog_thread();
+		if (err)
+			goto end;
+	}
+
+	err = create_resize_thread();
 	if (err)
 		goto end;
 
-	err = join_output_thread();
+	err = create_migration_thread();
 	if (err)
 		goto end;
 
-	err = join_input_thread();
+	err = create_sweep_thread();
 	if (err)
 		goto end;
 
-	err = join_worker_threads();
+	if (perf_counters_enable)
+		perf_counters_init();
+
+	/* Each dispatch thread keeps at least one worker. */
+	if (!worker_attr.self_driving)
+		worker_attr.min_threads = dispatch_attr.nr_threads;
+	err = create_worker_threads(nr_worker_threads, &worker_attr);
 	if (err)
 		goto end;
 
-	/*
-	 * Kill all animals. After all threads have been joined.
-	 */
-	apocalypse();
+	if (recorder_path) {
+		err = create_recorder_thread(recorder_path, recorder_period);
+		if (err)
+			goto end;
+	}
+
+	/* Self-driving workers don't need dispatch threads. */
+	if (!worker_attr.self_driving) {
+		err = create_dispatch_threads(&dispatch_attr);
+		if (err)
+			goto end;
+	}
+
+	if (scenario_path) {
+		/* Headless: ensure the dispatcher is stopped on error. */
+		err = run_scenario(scenario_path);
+		if (!worker_attr.self_driving && join_dispatch_threads())
+			err = -1;
+		if (err)
+			goto end;
+	} else {
+		/* Stops the dispatcher on return. */
+		err = run_event_loop();
+		if (!worker_attr.self_driving && join_dispatch_threads())
+			err = -1;
+		if (err)
+			goto end;
+	}
 
-	err = cds_lfht_destroy(live_animals.snake, NULL);
+	/* Samples worker statistics. */
+	if (recorder_path) {
+		err = join_recorder_thread();
+		if (err)
+			goto end;
+	}
+
+	err = join_worker_threads();
 	if (err)
 		goto end;
-	err = cds_lfht_destroy(live_animals.cat, NULL);
+
+	err = join_migration_thread();
 	if (err)
 		goto end;
-	err = cds_lfht_destroy(live_animals.gerbil, NULL);
+
+	err = join_sweep_thread();
 	if (err)
 		goto end;
-	err = cds_lfht_destroy(live_animals.all, NULL);
+
+	err = join_resize_thread();
 	if (err)
 		goto end;
 
+	if (rcu_prof_enable) {
+		err = join_rcu_watchdog_thread();
+		if (err)
+			goto end;
+	}
+
 	/*
-	 * Clean exit: ensure in-flight call_rcu() work is completed.
+	 * Kill all animals. After all threads have been joined.
 	 */
-	rcu_barrier();
+	err = destroy_islands();
+	if (err)
+		goto end;
+	animal_arena_destroy();
+	recent_births_destroy();
+	lock_prof_destroy();
+	rcu_prof_destroy();
 
 	printf("Goodbye!\n");
 
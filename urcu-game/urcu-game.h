@@ -18,39 +18,30 @@
 
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
 #include <urcu/rculfhash.h>
+#include <urcu/wfcqueue.h>
+#include <urcu/compiler.h>
 #include <urcu-call-rcu.h>
+#include "urcu-game-rand.h"
+#include "animal-lock.h"
+#include "species.h"
 
-#define URCU_GAME_REFRESH_PERIOD	1	/* seconds */
-
-enum animal_types {
-	GERBIL = 	0,
-	CAT = 		1,
-	SNAKE = 	2,
-};
-
-enum diet_mask {
-	DIET_GERBIL =	(1U << GERBIL),
-	DIET_CAT =	(1U << CAT),
-	DIET_SNAKE =	(1U << SNAKE),
-
-	DIET_FLOWERS =	(1U << 3),
-	DIET_TREES =	(1U << 4),
-};
-
+/*
+ * The diet is a trait of the species, in the species registry. Other
+ * traits are per island, and copied into each newborn.
+ */
 struct animal_kind {
 	uint64_t max_birth_stamina;	/* Animal healtiness on birth */
 	uint64_t max_pregnant;
-	enum animal_types animal;
-	unsigned int diet;
+	unsigned int animal;		/* species id */
 };
 
 #define DEFAULT_ISLAND_SIZE			\
 	2 * (DEFAULT_VEGETATION_FLOWERS + DEFAULT_VEGETATION_TREES)
 #define DEFAULT_STEP_DELAY			1000
-#define DEFAULT_GERBIL_MAX_BIRTH_STAMINA	70
-#define DEFAULT_CAT_MAX_BIRTH_STAMINA		80
-#define DEFAULT_SNAKE_MAX_BIRTH_STAMINA		30
 #define DEFAULT_VEGETATION_FLOWERS		1000
 #define DEFAULT_VEGETATION_TREES		200
 
@@ -58,10 +49,8 @@ struct urcu_game_config {
 	uint64_t island_size;		/* max number of animals on the island */
 	unsigned int step_delay;	/* game step delay, in ms */
 
-	/* configuration for each animal type newborn */
-	struct animal_kind gerbil;
-	struct animal_kind cat;
-	struct animal_kind snake;
+	/* configuration for newborns of each species, by species id */
+	struct animal_kind kind[MAX_SPECIES];
 };
 
 enum animal_sex {
@@ -72,35 +61,63 @@ enum animal_sex {
 /*
  * Animal struct existence is guaranteed by RCU. Mutual exclusion
  * against concurrent updaters is done by holding the lock. Holding the
- * lock and testing whether the structure is still within the "all
- * animals" hash table ensures we don't touch a dead animal.
+ * lock and testing whether the animal is still alive (it is flagged
+ * dead when removed from the "all animals" index) ensures we don't
+ * touch a dead animal.
  */
 struct animal {
 	struct animal_kind kind;
 
 	enum animal_sex animal_sex;
+	uint32_t stamina_epoch;		/* stamina_epoch of last update */
 	uint64_t key;			/* animal key in hash table */
-	uint64_t stamina;
+	uint64_t stamina;		/* at stamina_epoch, see
+					 * current_stamina() */
 
 	uint64_t nr_pregnant;
+	int dead;			/* removed from all animals index */
 
-	pthread_mutex_t lock;		/* mutual exclusion on animal */
+	struct animal_lock lock;	/* mutual exclusion on animal */
 	struct cds_lfht_node kind_node;	/* node in kind hash table */
-	struct cds_lfht_node all_node;	/* node in all animals hash table */
+	struct cds_lfht_node all_node;	/* node in all animals hash table,
+					 * unused with the array index */
 	struct rcu_head rcu_head;	/* Delayed reclaim */
 };
 
+static inline
+struct animal_lock *animal_get_lock(struct animal *animal)
+{
+	return &animal->lock;
+}
+
+static inline
+void animal_init_lock(struct animal *animal)
+{
+	animal_lock_init(&animal->lock);
+}
+
+enum animal_index {
+	ANIMAL_INDEX_LFHT,		/* "all animals" hash table */
+	ANIMAL_INDEX_ARRAY,		/* dense array indexed by key */
+};
+
 /*
  * Data structure containing live animals.
- * Nodes are "owned" by the "all animals" hash table, and have an extra
+ * Nodes are "owned" by the "all animals" index, and have an extra
  * reference from the per-kind hash table.
  */
 struct live_animals {
-	struct cds_lfht *gerbil;
-	struct cds_lfht *cat;
-	struct cds_lfht *snake;
+	struct cds_lfht *kind[MAX_SPECIES];	/* by species id */
 
-	struct cds_lfht *all;
+	enum animal_index index;
+	struct cds_lfht *all;		/* ANIMAL_INDEX_LFHT only */
+
+	/*
+	 * Keys covered by the key-indexed structures (occupancy map,
+	 * array index). Births at keys beyond the limit fail. Updated by
+	 * the resize thread.
+	 */
+	uint64_t key_limit;
 
 	unsigned long ht_seed;
 };
@@ -111,32 +128,204 @@ struct vegetation {
 	pthread_mutex_t lock;
 };
 
+/*
+ * Animal travelling between islands, queued in the destination island
+ * migration queue.
+ */
+struct migrant {
+	struct cds_wfcq_node q_node;
+	struct animal_kind kind;
+	enum animal_sex animal_sex;
+	uint64_t stamina;
+	uint64_t nr_pregnant;
+};
+
+struct occupancy_map;
+struct animal_array;
+
+/*
+ * Islands are independent: each one has its own animals, vegetation,
+ * configuration and range of worker threads. Animals only move between
+ * islands through the migration queues.
+ */
+struct island {
+	unsigned long id;
+	struct live_animals live_animals;
+	struct vegetation vegetation;
+
+	struct urcu_game_config *config;	/* RCU-published */
+	pthread_mutex_t config_mutex;		/* serialize config updates */
+
+	struct occupancy_map *occupancy_map;	/* RCU-published, or NULL */
+	struct animal_array *animal_array;	/* ANIMAL_INDEX_ARRAY only */
+
+	/* Resize thread state. */
+	int resize_requested;
+	uint64_t resize_size;		/* size of key-indexed structures */
+	uint64_t nr_evicted;
+	uint64_t nr_rehomed;
+
+	/* Animals arriving from other islands. */
+	struct cds_wfcq_head migrate_head;
+	struct cds_wfcq_tail migrate_tail;
+	uint64_t nr_emigrated;		/* updated by workers */
+	uint64_t nr_immigrated;		/* updated by migration thread */
+	uint64_t nr_migrate_lost;	/* no free key on arrival */
+
+	/* Sweep thread state. */
+	uint64_t sweep_cursor;		/* next key to sweep */
+	uint64_t nr_exhausted;		/* reaped by the sweep thread */
+
+	/*
+	 * Align island structures on cache line size to eliminate
+	 * false-sharing.
+	 */
+} __attribute__((aligned(CAA_CACHE_LINE_SIZE)));
+
+extern struct island *islands;
+extern unsigned long nr_islands;
+
+/*
+ * If ht_mmap is non-zero, hash table buckets are allocated with the
+ * liburcu mmap backend, contiguous in address space.
+ */
+int create_islands(unsigned long nr, enum animal_index index,
+		int occupancy_map_enable, int ht_mmap);
+/* Called after all threads using the islands have been joined. */
+int destroy_islands(void);
+/* Largest island size supported by the animal index of "island". */
+uint64_t island_max_size(struct island *island);
+
+struct island_census {
+	uint64_t animals[MAX_SPECIES];	/* by species id */
+	uint64_t flowers;
+	uint64_t trees;
+	uint64_t nr_emigrated;
+	uint64_t nr_immigrated;
+	uint64_t nr_migrate_lost;
+	uint64_t nr_exhausted;
+	uint32_t max_lock_contended;	/* most contended live animal */
+};
+
+void get_island_census(struct island *island, struct island_census *census);
+/* Sum over all islands. */
+void get_census(struct island_census *census);
+
 /* Game logic */
-extern struct live_animals live_animals;
-extern struct vegetation vegetation;
-
-int try_birth(struct animal *parent, uint64_t new_key, int god);
-void kill_animal(struct animal *animal);
-int try_eat(struct animal *first, struct animal *second);
-int try_birth(struct animal *parent, uint64_t new_key, int god);
-int try_mate(struct animal *first, struct animal *second);
-struct animal *find_animal(uint64_t key);
-void apocalypse(void);
-void create_animals(enum animal_types type, uint64_t nr);
+void kill_animal(struct island *island, struct animal *animal);
+/* Outcomes of an encounter. */
+enum encounter_result {
+	ENCOUNTER_BIRTH =	(1U << 0),
+	ENCOUNTER_EAT =		(1U << 1),
+	ENCOUNTER_MATE =	(1U << 2),
+	ENCOUNTER_DEATH =	(1U << 3),	/* eaten or exhausted */
+};
+
+unsigned int resolve_encounter(struct island *island, struct animal *first,
+		struct animal *second, uint64_t second_key);
+int try_birth(struct island *island, struct animal *parent,
+		uint64_t new_key, int god);
+struct animal *find_animal(struct island *island, uint64_t key);
+int evict_animal(struct island *island, struct animal *animal,
+		uint64_t limit);
+struct migrant *emigrate_animal(struct island *island, struct animal *animal);
+int immigrate_animal(struct island *island, const struct migrant *migrant);
+uint64_t reap_exhausted(struct island *island, uint64_t start,
+		uint64_t end);
+uint64_t cull_animals(struct island *island, uint64_t start, uint64_t end,
+		unsigned int type);
+void apocalypse(struct island *island);
+uint64_t create_animals(struct island *island, unsigned int type,
+		uint64_t nr);
 
 /* Threads */
 extern int exit_program;
-extern int hide_output;
-extern pthread_mutex_t print_output_mutex;
 
-extern __thread unsigned int thread_rand_seed;
+/*
+ * Each thread uses its own random number generator, seeded from
+ * rand_base_seed and from its stream and id, so runs using the same
+ * base seed (-r) replay the same per-thread random sequences.
+ */
+enum rand_stream {
+	RAND_STREAM_MAIN,
+	RAND_STREAM_INPUT,
+	RAND_STREAM_DISPATCH,
+	RAND_STREAM_WORKER,
+	RAND_STREAM_RESIZE,
+	RAND_STREAM_MIGRATION,
+};
+
+extern uint64_t rand_base_seed;
+extern __thread struct urcu_game_rand thread_rand;
+
+void thread_rand_init(enum rand_stream stream, unsigned long id);
+
+/*
+ * Exit is requested by setting exit_program through request_exit(),
+ * which also wakes up threads sleeping in exit_wait().
+ */
+int init_exit_event(void);
+void request_exit(void);
+void exit_wait(unsigned int ms);
+
+/*
+ * Interactive mode: an epoll loop, in the calling thread, handles the
+ * keys typed by the user and refreshes the screen every refresh_period
+ * ms. Returns once exit is requested.
+ */
+#define DEFAULT_REFRESH_PERIOD	1000	/* ms */
+
+extern unsigned int refresh_period;
 
-int create_input_thread(void);
-int join_input_thread(void);
-int create_output_thread(void);
-int join_output_thread(void);
-int create_dispatch_thread(void);
-int join_dispatch_thread(void);
+int run_event_loop(void);
+
+/* Event loop handlers. handle_input() returns -1 on end of input. */
+void input_begin(void);
+void input_end(void);
+int handle_input(void);
+void print_output(void);
+
+/*
+ * Resize thread: applies island size changes to the key-indexed
+ * structures, evicting animals beyond the island size when it shrinks.
+ */
+int create_resize_thread(void);
+int join_resize_thread(void);
+void island_resize_request(struct island *island);
+void get_island_resize_stats(struct island *island, uint64_t *nr_evicted,
+		uint64_t *nr_rehomed, uint64_t *key_limit);
+
+/*
+ * Migration thread: settles the animals queued in the island migration
+ * queues. Workers send animals of lone encounters to another island at
+ * migration_rate per MIGRATION_RATE_SCALE encounters.
+ */
+#define MIGRATION_RATE_SCALE	1000000
+#define DEFAULT_MIGRATION_RATE	1000
+
+extern uint64_t migration_rate;
+
+int create_migration_thread(void);
+/* Called after worker threads have been joined. */
+int join_migration_thread(void);
+void migrate_enqueue(struct island *dest, struct migrant *migrant);
+
+/*
+ * Epoch thread: advances stamina_epoch every stamina_decay_period ms.
+ * Animals lose one stamina per epoch, computed when they are accessed,
+ * and the sweep thread reaps those exhausted over a slice of each
+ * island per decay period.
+ */
+#define DEFAULT_STAMINA_DECAY_PERIOD	100	/* ms */
+
+extern unsigned int stamina_decay_period;
+extern uint32_t stamina_epoch;
+
+int create_sweep_thread(void);
+int join_sweep_thread(void);
+
+/* Headless scenario, run from the main thread */
+int run_scenario(const char *path);
 
 /* Helpers */
 
@@ -155,6 +344,17 @@ void clear_screen(void)
 		printf("%c[2J%c[;H", (char) 27, (char) 27);
 }
 
+/* Monotonic time, in nanoseconds. */
+static inline
+uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		abort();
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 #define DBG(fmt, args...)						\
 	do {								\
 		if (verbose)						\
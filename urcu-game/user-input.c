@@ -23,9 +23,12 @@
 #include <urcu/system.h>
 #include "urcu-game.h"
 #include "urcu-game-config.h"
+#include "worker-thread.h"
+#include "lock-prof.h"
 
+/* Island modified by the configuration and god menus. */
 static
-pthread_t input_thread_id;
+struct island *current_island;
 
 /*
  * Read characters from terminal, without awaiting for newline and
@@ -149,20 +152,45 @@ void get_config_entry_uint64(const char *name,
 	*value = new_size;
 }
 
+/*
+ * Returns the species id entered, or -1 on error.
+ */
+static
+int get_species_entry(void)
+{
+	char read_buf[4096];
+	int id;
+
+	printf("Enter species name\n");
+	if (readline_unbuf(0, read_buf, sizeof(read_buf)) < 0)
+		goto error;
+	id = species_lookup(read_buf);
+	if (id < 0)
+		goto error;
+	return id;
+
+error:
+	fprintf(stderr, "Error: expected a species name\n");
+	wait_for_key();
+	return -1;
+}
+
 static
 void do_config(void)
 {
 	struct urcu_game_config *new_config;
+	unsigned int i;
 	char key;
 	int ret;
 
-	new_config = urcu_game_config_update_begin();
+	new_config = urcu_game_config_update_begin(current_island);
 	if (!new_config)
 		abort();
 
 	for (;;) {
 		clear_screen();
-		printf("[ root > configuration ]\n");
+		printf("[ root > configuration (island %lu) ]\n",
+			current_island->id);
 		printf("Enter the config field you wish to update:\n");
 		printf(" key	Description\n");
 		printf("---------------------------------\n");
@@ -170,12 +198,10 @@ void do_config(void)
 		printf("  x	Save update and exit configuration menu\n");
 		printf("  i	Island size (%" PRIu64 ")\n", new_config->island_size);
 		printf("  d	Step delay (%d ms)\n", new_config->step_delay);
-		printf("  g	Gerbil max birth stamina (%" PRIu64 ")\n",
-				new_config->gerbil.max_birth_stamina);
-		printf("  c	Cat max birth stamina (%" PRIu64 ")\n",
-				new_config->cat.max_birth_stamina);
-		printf("  s	Snake max birth stamina (%" PRIu64 ")\n",
-				new_config->snake.max_birth_stamina);
+		printf("  s	Species max birth stamina\n");
+		for (i = 0; i < nr_species; i++)
+			printf("	  %s (%" PRIu64 ")\n", species_table[i].name,
+				new_config->kind[i].max_birth_stamina);
 
 		ret = getch(&key);
 		if (ret < 0)
@@ -186,22 +212,29 @@ void do_config(void)
 		switch(key) {
 		case 'x':	/* save and quit */
 			printf("Configuration saved.\n");
-			urcu_game_config_update_end(new_config);
+			urcu_game_config_update_end(current_island, new_config);
 			wait_for_key();
 			goto end;
 		case 'q':	/* cancel and quit */
 			printf("Configuration update cancelled.\n");
-			urcu_game_config_update_abort(new_config);
+			urcu_game_config_update_abort(current_island,
+				new_config);
 			wait_for_key();
 			goto end;
 		case 'i':	/* island size */
 		{
 			uint64_t new_size;
 
-			get_config_entry_uint64("island size (increase only)",
-				&new_size);
-			if (new_size <= new_config->island_size) {
-				printf("Error: Island size can only be increased.\n");
+			get_config_entry_uint64("island size", &new_size);
+			if (!new_size) {
+				printf("Error: Island size cannot be zero.\n");
+				break;
+			}
+			if (new_size > island_max_size(current_island)) {
+				printf("Error: Island size cannot exceed %"
+					PRIu64 " with this animal index.\n",
+					island_max_size(current_island));
+				wait_for_key();
 				break;
 			}
 			new_config->island_size = new_size;
@@ -221,18 +254,17 @@ void do_config(void)
 			new_config->step_delay = (int) new_delay;
 			break;
 		}
-		case 'g':	/* gerbil stamina */
-			get_config_entry_uint64("gerbil stamina",
-				&new_config->gerbil.max_birth_stamina);
-			break;
-		case 'c':	/* cat stamina */
-			get_config_entry_uint64("cat stamina",
-				&new_config->cat.max_birth_stamina);
-			break;
-		case 's':	/* snake stamina */
-			get_config_entry_uint64("snake stamina",
-				&new_config->snake.max_birth_stamina);
+		case 's':	/* species stamina */
+		{
+			int id;
+
+			id = get_species_entry();
+			if (id < 0)
+				break;
+			get_config_entry_uint64("max birth stamina",
+				&new_config->kind[id].max_birth_stamina);
 			break;
+		}
 		default:
 			printf("Unknown key: \'%c\'\n", key);
 			wait_for_key();
@@ -251,7 +283,7 @@ void do_god(void)
 
 	for (;;) {
 		clear_screen();
-		printf("[ root > god ]\n");
+		printf("[ root > god (island %lu) ]\n", current_island->id);
 		printf("Enter the animal or vegetation you wish to modify:\n");
 		printf("Modifications take effect immediately.\n");
 		printf(" key	Description\n");
@@ -259,9 +291,8 @@ void do_god(void)
 		printf("  x	Exit menu\n");
 		printf("  f	Number of flowers\n");
 		printf("  t	Number of trees\n");
-		printf("  g	Create gerbils\n");
-		printf("  c	Create cats\n");
-		printf("  s	Create snakes\n");
+		printf("  a	Create animals\n");
+		printf("  k	Cull animals of a species\n");
 
 		ret = getch(&key);
 		if (ret < 0)
@@ -278,9 +309,11 @@ void do_god(void)
 
 			get_config_entry_uint64("number of flowers",
 				&value);
-			pthread_mutex_lock(&vegetation.lock);
-			vegetation.flowers = value;
-			pthread_mutex_unlock(&vegetation.lock);
+			prof_mutex_lock(&current_island->vegetation.lock,
+				LOCK_VEGETATION);
+			current_island->vegetation.flowers = value;
+			prof_mutex_unlock(&current_island->vegetation.lock,
+				LOCK_VEGETATION);
 			break;
 		}
 		case 't':	/* trees */
@@ -289,36 +322,38 @@ void do_god(void)
 
 			get_config_entry_uint64("number of trees",
 				&value);
-			pthread_mutex_lock(&vegetation.lock);
-			vegetation.trees = value;
-			pthread_mutex_unlock(&vegetation.lock);
-			break;
-		}
-		case 'g':	/* create gerbils */
-		{
-			uint64_t value;
-
-			get_config_entry_uint64("amount of gerbils to try creating",
-				&value);
-			create_animals(GERBIL, value);
+			prof_mutex_lock(&current_island->vegetation.lock,
+				LOCK_VEGETATION);
+			current_island->vegetation.trees = value;
+			prof_mutex_unlock(&current_island->vegetation.lock,
+				LOCK_VEGETATION);
 			break;
 		}
-		case 'c':	/* create cats */
+		case 'a':	/* create animals */
 		{
 			uint64_t value;
+			int id;
 
-			get_config_entry_uint64("amount of cats to try creating",
+			id = get_species_entry();
+			if (id < 0)
+				break;
+			get_config_entry_uint64("amount of animals to try creating",
 				&value);
-			create_animals(CAT, value);
+			run_maintenance(WORK_CREATE, current_island, 0, value,
+				id);
 			break;
 		}
-		case 's':	/* create snakes */
+		case 'k':	/* cull animals */
 		{
-			uint64_t value;
+			int id;
 
-			get_config_entry_uint64("amount of snakes to try creating",
-				&value);
-			create_animals(SNAKE, value);
+			id = get_species_entry();
+			if (id < 0)
+				break;
+			run_maintenance(WORK_CULL, current_island, 0,
+				CMM_LOAD_SHARED(
+					current_island->live_animals.key_limit),
+				id);
 			break;
 		}
 		default:
@@ -340,18 +375,49 @@ void show_menu(void)
 	printf("---------------------------------\n");
 	printf("  c	Configuration menu\n");
 	printf("  g	Play god\n");
+	if (nr_islands > 1)
+		printf("  i	Select island (%lu)\n", current_island->id);
+	printf("  w	Worker threads (%lu)\n", get_nr_worker_threads());
 	printf("  x	Exit root menu\n");
 }
 
+static
+void do_select_island(void)
+{
+	uint64_t id = current_island->id;
+
+	get_config_entry_uint64("island number", &id);
+	if (id >= nr_islands) {
+		printf("Error: there are %lu islands.\n", nr_islands);
+		wait_for_key();
+		return;
+	}
+	current_island = &islands[id];
+}
+
+/*
+ * Removed workers complete their queued work first, so this can take
+ * a while under load.
+ */
+static
+void do_resize_workers(void)
+{
+	uint64_t nr = get_nr_worker_threads();
+
+	get_config_entry_uint64("number of worker threads", &nr);
+	if (nr > ULONG_MAX || resize_worker_pool(nr)) {
+		printf("Error: cannot resize worker pool to %" PRIu64
+			" threads.\n", nr);
+		wait_for_key();
+	}
+}
+
 static
 void do_root_menu(void)
 {
 	char key;
 	int ret;
 
-	CMM_STORE_SHARED(hide_output, 1);	/* hide normal output */
-	pthread_mutex_lock(&print_output_mutex);
-
 	for (;;) {
 		show_menu();
 
@@ -370,6 +436,15 @@ void do_root_menu(void)
 		case 'g':
 			do_god();
 			break;
+		case 'w':
+			do_resize_workers();
+			break;
+		case 'i':
+			if (nr_islands > 1) {
+				do_select_island();
+				break;
+			}
+			/* Fall-through */
 		default:
 			printf("Unknown key: \'%c\'\n", key);
 			wait_for_key();
@@ -378,66 +453,88 @@ void do_root_menu(void)
 	}
 end:
 	fflush(stdout);
-	pthread_mutex_unlock(&print_output_mutex);
-	CMM_STORE_SHARED(hide_output, 0);	/* show normal output */
 }
 
+/*
+ * Between menus, keys are read one by one without echo, as soon as the
+ * event loop sees them: the terminal is in non-canonical mode.
+ */
 static
-void *input_thread_fct(void *data)
-{
-	DBG("In user input thread.");
-	rcu_register_thread();
-
-	thread_rand_seed = time(NULL);
+struct termios saved_tty;
 
-	/* Read keys typed by the user */
-	for (;;) {
-		char key;
-		int ret;
-
-		ret = getch(&key);
-		if (ret < 0)
-			goto end;
+static
+int tty_saved;
 
-		DBG("User input: \'%c\'", key);
+static
+void tty_set_raw(void)
+{
+	struct termios raw;
 
-		switch(key) {
-		case 'q':	/* quit */
-			CMM_STORE_SHARED(exit_program, 1);
-			goto end;
-		case 'm':	/* show menu */
-			do_root_menu();
-			break;
-		default:
-			printf("Unknown key: \'%c\'\n", key);
-			break;
-		}
-	}
+	/* Not a terminal. */
+	if (tcgetattr(0, &saved_tty) < 0)
+		return;
+	tty_saved = 1;
+	raw = saved_tty;
+	raw.c_lflag &= ~(ICANON | ECHO);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if (tcsetattr(0, TCSANOW, &raw) < 0)
+		perror("tcsetattr ICANON");
+}
 
-end:
-	rcu_unregister_thread();
-	DBG("User input thread exiting.");
-	return NULL;
+static
+void tty_restore(void)
+{
+	if (!tty_saved)
+		return;
+	if (tcsetattr(0, TCSADRAIN, &saved_tty) < 0)
+		perror("tcsetattr ~ICANON");
+	tty_saved = 0;
 }
 
-int create_input_thread(void)
+void input_begin(void)
 {
-	int err;
+	current_island = &islands[0];
+	tty_set_raw();
+}
 
-	err = pthread_create(&input_thread_id, NULL,
-		input_thread_fct, NULL);
-	if (err)
-		abort();
-	return 0;
+void input_end(void)
+{
+	tty_restore();
 }
 
-int join_input_thread(void)
+int handle_input(void)
 {
-	int ret;
-	void *tret;
+	ssize_t len;
+	char key;
 
-	ret = pthread_join(input_thread_id, &tret);
-	if (ret)
-		abort();
+	do {
+		len = read(0, &key, sizeof(key));
+	} while (len < 0 && errno == EINTR);
+	if (len < 0) {
+		perror("read()");
+		return -1;
+	}
+	if (len == 0) {
+		/* End of file */
+		return -1;
+	}
+
+	DBG("User input: \'%c\'", key);
+
+	switch(key) {
+	case 'q':	/* quit */
+		request_exit();
+		break;
+	case 'm':	/* show menu, with line editing */
+		tty_restore();
+		do_root_menu();
+		tty_set_raw();
+		break;
+	default:
+		printf("Unknown key: \'%c\'\n", key);
+		fflush(stdout);
+		break;
+	}
 	return 0;
 }
@@ -20,39 +20,114 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
+#include <errno.h>
 #include <urcu.h>
 #include <urcu/uatomic.h>
 #include "worker-thread.h"
 #include "urcu-game.h"
 #include "urcu-game-config.h"
 #include "ht-hash.h"
+#include "occupancy-map.h"
+#include "mem-account.h"
+#include "animal-arena.h"
+#include "recent-births.h"
+#include "lock-prof.h"
+#include "rcu-prof.h"
 
+/* RCU-published, updates serialized by pool_mutex. */
 static
-struct worker_thread *worker_threads;
+struct worker_pool *worker_pool;
 
 static
-unsigned long nr_worker_threads;
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set once stop messages are sent: no more resize. */
+static
+int pool_stopped;
+
+static
+unsigned long next_worker_id;
+
+static
+struct worker_attr worker_attr;
+
+struct worker_pool *get_worker_pool(void)
+{
+	return rcu_dereference(worker_pool);
+}
 
 unsigned long get_nr_worker_threads(void)
 {
-	return nr_worker_threads;
+	unsigned long nr;
+
+	prof_rcu_read_lock();
+	nr = get_worker_pool()->nr_active;
+	prof_rcu_read_unlock();
+	return nr;
 }
 
+/*
+ * Empty keys are rejected with the occupancy map, without hash table
+ * lookup. Called with RCU read-side lock held.
+ */
 static
-int do_work(struct urcu_game_work *work)
+struct animal *lookup_animal(struct worker_thread *wt, uint64_t key)
 {
-	struct animal *first, *second;
+	struct worker_stats *stats = &wt->stats;
+	struct animal *animal;
 
-	if (work->exit_thread)
-		return 1;
+	CMM_STORE_SHARED(stats->nr_lookup, stats->nr_lookup + 1);
+	if (!occupancy_map_test(wt->island, key)) {
+		CMM_STORE_SHARED(stats->nr_lookup_skip,
+			stats->nr_lookup_skip + 1);
+		return NULL;
+	}
+	animal = find_animal(wt->island, key);
+	if (animal)
+		CMM_STORE_SHARED(stats->nr_lookup_hit,
+			stats->nr_lookup_hit + 1);
+	return animal;
+}
 
-	DBG("do work: key1 %" PRIu64 ", key2 %" PRIu64,
-		work->first_key, work->second_key);
+/*
+ * Send a lone animal to another random island, at migration_rate.
+ * Returns 1 if the animal left. Called with RCU read-side lock held.
+ */
+static
+int try_emigrate(struct worker_thread *wt, struct animal *animal)
+{
+	struct migrant *migrant;
+	unsigned long dest;
 
-	rcu_read_lock();
+	if (nr_islands < 2)
+		return 0;
+	if (urcu_game_rand_bounded(&thread_rand, MIGRATION_RATE_SCALE)
+			>= CMM_LOAD_SHARED(migration_rate))
+		return 0;
+	migrant = emigrate_animal(wt->island, animal);
+	if (!migrant)
+		return 0;
+	/* Any island but ours. */
+	dest = urcu_game_rand_bounded(&thread_rand, nr_islands - 1);
+	if (dest >= wt->island->id)
+		dest++;
+	uatomic_inc(&wt->island->nr_emigrated);
+	migrate_enqueue(&islands[dest], migrant);
+	return 1;
+}
+
+/*
+ * Called with RCU read-side lock held.
+ */
+static
+void do_encounter(struct worker_thread *wt, uint64_t first_key,
+		uint64_t second_key)
+{
+	struct animal *first, *second;
+	unsigned int ret;
 
-	first = find_animal(work->first_key);
-	second = find_animal(work->second_key);
+	first = lookup_animal(wt, first_key);
+	second = lookup_animal(wt, second_key);
 
 	/*
 	 * If only one of the nodes is non-null, it is the first.
@@ -60,7 +135,7 @@ int do_work(struct urcu_game_work *work)
 	if (!first) {
 		first = second;
 		if (!first)
-			goto end;
+			return;
 		/*
 		 * Cannot have twice the same animal.
 		 */
@@ -69,139 +144,700 @@ int do_work(struct urcu_game_work *work)
 		}
 	}
 
-	if (try_birth(first, work->second_key, 0))
+	if (!second && try_emigrate(wt, first)) {
+		DBG("emigrate success");
+		return;
+	}
+	ret = resolve_encounter(wt->island, first, second, second_key);
+	if (ret & ENCOUNTER_BIRTH) {
 		DBG("birth success");
-	if (try_eat(first, second))
+		CMM_STORE_SHARED(wt->stats.nr_births,
+			wt->stats.nr_births + 1);
+	}
+	if (ret & ENCOUNTER_DEATH) {
+		DBG("death");
+		CMM_STORE_SHARED(wt->stats.nr_deaths,
+			wt->stats.nr_deaths + 1);
+	}
+	if (ret & ENCOUNTER_EAT)
 		DBG("eat success");
-	if (try_mate(first, second))
+	if (ret & ENCOUNTER_MATE)
 		DBG("mate success");
+}
 
-end:
-	rcu_read_unlock();
+static
+unsigned int latency_bucket(uint64_t latency)
+{
+	unsigned int bucket = 0;
+
+	while (latency >>= 1)
+		bucket++;
+	return bucket;
+}
+
+/*
+ * Only the worker thread itself updates its statistics.
+ */
+static
+void account_work(struct worker_thread *wt, uint64_t enqueue_time,
+		uint64_t start_time)
+{
+	struct worker_stats *stats = &wt->stats;
+	uint64_t latency, now;
+	unsigned int bucket;
+
+	now = get_time_ns();
+	latency = now - enqueue_time;
+	bucket = latency_bucket(latency);
+	CMM_STORE_SHARED(stats->latency[bucket], stats->latency[bucket] + 1);
+	CMM_STORE_SHARED(stats->latency_sum, stats->latency_sum + latency);
+	CMM_STORE_SHARED(stats->busy_time,
+		stats->busy_time + now - start_time);
+	CMM_STORE_SHARED(stats->nr_work, stats->nr_work + 1);
+}
+
+/*
+ * Called before each encounter: the counters are read when a batch
+ * starts, and when it is full.
+ */
+static
+void perf_batch_add(struct worker_thread *wt)
+{
+	if (!perf_counters_enable)
+		return;
+	if (wt->perf_batch == PERF_BATCH) {
+		perf_counters_read(&wt->perf, &wt->stats.perf, wt->perf_batch);
+		wt->perf_batch = 0;
+	} else if (!wt->perf_batch) {
+		perf_counters_read(&wt->perf, NULL, 0);
+	}
+	wt->perf_batch++;
+}
+
+/* Called when idle, and before maintenance. */
+static
+void perf_batch_end(struct worker_thread *wt)
+{
+	if (!wt->perf_batch)
+		return;
+	perf_counters_read(&wt->perf, &wt->stats.perf, wt->perf_batch);
+	wt->perf_batch = 0;
+}
+
+/*
+ * Run one maintenance slice. Returns the number of animals created,
+ * culled or reaped.
+ */
+static
+uint64_t run_slice(enum work_op op, struct island *island, uint64_t start,
+		uint64_t end, unsigned int type)
+{
+	uint64_t nr;
+
+	if (op == WORK_CREATE)
+		return create_animals(island, type, end - start);
+
+	prof_rcu_read_lock();
+	switch (op) {
+	case WORK_CULL:
+		nr = cull_animals(island, start, end, type);
+		break;
+	case WORK_SWEEP:
+		nr = reap_exhausted(island, start, end);
+		break;
+	default:
+		abort();
+	}
+	prof_rcu_read_unlock();
+	return nr;
+}
+
+/*
+ * The submitter frees the batch as soon as it sees nr_pending reach 0:
+ * it is not accessed after batch->lock is released.
+ */
+static
+void do_maintenance(struct worker_thread *wt, struct urcu_game_work *work)
+{
+	struct work_batch *batch = work->u.slice.batch;
+	uint64_t nr;
+
+	/* Lock statistics are per encounter: maintenance is left out. */
+	animal_lock_stats = NULL;
+	nr = run_slice(work->op, work->u.slice.island, work->u.slice.start,
+		work->u.slice.end, work->u.slice.type);
+	animal_lock_stats = &wt->stats.lock;
+	pthread_mutex_lock(&batch->lock);
+	batch->result += nr;
+	batch->nr_pending--;
+	pthread_cond_signal(&batch->cond);
+	pthread_mutex_unlock(&batch->lock);
+	CMM_STORE_SHARED(wt->stats.nr_maintenance,
+		wt->stats.nr_maintenance + 1);
+}
+
+/*
+ * Returns 1 if the worker thread should exit.
+ */
+static
+int do_work(struct worker_thread *wt, struct urcu_game_work *work)
+{
+	uint64_t start_time;
+
+	switch (work->op) {
+	case WORK_EXIT:
+		return 1;
+	case WORK_ENCOUNTER:
+		DBG("do work: key1 %" PRIu64 ", key2 %" PRIu64,
+			work->u.encounter.first_key,
+			work->u.encounter.second_key);
+		perf_batch_add(wt);
+		start_time = get_time_ns();
+		prof_rcu_read_lock();
+		do_encounter(wt, work->u.encounter.first_key,
+			work->u.encounter.second_key);
+		prof_rcu_read_unlock();
+		account_work(wt, work->enqueue_time, start_time);
+		break;
+	default:
+		perf_batch_end(wt);
+		do_maintenance(wt, work);
+		break;
+	}
 	return 0;
 }
 
 static
-void *worker_thread_fct(void *data)
+void free_work(struct urcu_game_work *work)
 {
-	struct worker_thread *wt = data;
-	int exit_thread = 0;
+	mem_account(MEM_WORK, -(long) sizeof(*work));
+	free(work);
+}
 
-	DBG("In worker thread id=%lu.", wt->id);
+static
+struct urcu_game_work *dequeue(struct cds_wfcq_head *head,
+		struct cds_wfcq_tail *tail)
+{
+	struct cds_wfcq_node *node;
 
-	rcu_register_thread();
+	node = __cds_wfcq_dequeue_blocking(head, tail);
+	if (!node)
+		return NULL;
+	return caa_container_of(node, struct urcu_game_work, q_node);
+}
 
-	thread_rand_seed = time(NULL) ^ wt->id;
+/*
+ * Encounters have priority: the maintenance queue is served when the
+ * work queue is empty, or after MAINTENANCE_INTERVAL items taken from
+ * the work queue since the last maintenance slice, counted in nr_work.
+ */
+static
+struct urcu_game_work *dequeue_work(struct worker_thread *wt,
+		unsigned int *nr_work)
+{
+	struct urcu_game_work *work = NULL;
+
+	if (*nr_work >= MAINTENANCE_INTERVAL)
+		work = dequeue(&wt->maint_head, &wt->maint_tail);
+	if (!work) {
+		work = dequeue(&wt->q_head, &wt->q_tail);
+		if (work) {
+			uatomic_dec(&wt->q_len);
+			(*nr_work)++;
+			return work;
+		}
+		work = dequeue(&wt->maint_head, &wt->maint_tail);
+	}
+	if (work)
+		*nr_work = 0;
+	return work;
+}
+
+static
+void work_queue_loop(struct worker_thread *wt)
+{
+	unsigned int nr_work = 0;
+	int exit_thread = 0;
 
 	while (!exit_thread) {
-		struct cds_wfcq_node *node;
 		struct urcu_game_work *work;
 
-		node = __cds_wfcq_dequeue_blocking(&wt->q_head, &wt->q_tail);
-		if (!node) {
+		work = dequeue_work(wt, &nr_work);
+		if (!work) {
+			perf_batch_end(wt);
 			/* Wait for work */
 			poll(NULL, 0, 100);	/* 100ms delay */
 			continue;
 		}
-		uatomic_dec(&wt->q_len);
-		work = caa_container_of(node, struct urcu_game_work, q_node);
-		exit_thread = do_work(work);
-		free(work);
+		exit_thread = do_work(wt, work);
+		free_work(work);
 	}
+}
+
+/*
+ * Self-driving worker: generate random encounters locally, without
+ * dispatch thread nor work queue, paced at worker_attr.rate encounters
+ * per second, or as fast as possible if rate is 0. Latency statistics
+ * only account for the encounter service time. Once exit_program is
+ * set, only serve maintenance until stopped.
+ */
+static
+void self_driving_loop(struct worker_thread *wt)
+{
+	uint64_t period = 0, deadline;
+	unsigned int nr_work = 0;
 
+	if (worker_attr.rate)
+		period = 1000000000ULL / worker_attr.rate;
+	deadline = get_time_ns();
+
+	while (!CMM_LOAD_SHARED(wt->stop)) {
+		struct urcu_game_config *config;
+		struct urcu_game_work *work;
+		uint64_t first_key, second_key, start_time;
+
+		if (CMM_LOAD_SHARED(exit_program)) {
+			perf_batch_end(wt);
+			work = dequeue(&wt->maint_head, &wt->maint_tail);
+			if (!work) {
+				poll(NULL, 0, 10);	/* 10ms delay */
+				continue;
+			}
+			do_maintenance(wt, work);
+			free_work(work);
+			continue;
+		}
+
+		perf_batch_add(wt);
+		start_time = get_time_ns();
+		prof_rcu_read_lock();
+		config = urcu_game_config_get(wt->island);
+		first_key = urcu_game_rand_bounded(&thread_rand,
+				config->island_size);
+		second_key = urcu_game_rand_bounded(&thread_rand,
+				config->island_size);
+		do_encounter(wt, first_key, second_key);
+		prof_rcu_read_unlock();
+		account_work(wt, start_time, start_time);
+
+		if (++nr_work >= MAINTENANCE_INTERVAL) {
+			work = dequeue(&wt->maint_head, &wt->maint_tail);
+			if (work) {
+				perf_batch_end(wt);
+				do_maintenance(wt, work);
+				free_work(work);
+				nr_work = 0;
+			}
+		}
+
+		if (period) {
+			struct timespec ts;
+
+			perf_batch_end(wt);
+			deadline += period;
+			ts.tv_sec = deadline / 1000000000ULL;
+			ts.tv_nsec = deadline % 1000000000ULL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&ts, NULL) == EINTR)
+				;
+		}
+	}
+}
+
+static
+void *worker_thread_fct(void *data)
+{
+	struct worker_thread *wt = data;
+	struct urcu_game_work *work;
+
+	DBG("In worker thread id=%lu.", wt->id);
+
+	rcu_register_thread();
+
+	thread_rand_init(RAND_STREAM_WORKER, wt->id);
+	animal_lock_stats = &wt->stats.lock;
+	if (perf_counters_enable)
+		perf_counters_open(&wt->perf);
+
+	if (worker_attr.self_driving)
+		self_driving_loop(wt);
+	else
+		work_queue_loop(wt);
+	perf_batch_end(wt);
+
+	/* Nothing is queued after the stop: complete maintenance. */
+	while ((work = dequeue(&wt->maint_head, &wt->maint_tail))) {
+		do_maintenance(wt, work);
+		free_work(work);
+	}
+
+	if (perf_counters_enable)
+		perf_counters_close(&wt->perf);
+	/* Workers come and go with pool resizes: free per-thread state. */
+	recent_births_thread_exit();
+	lock_prof_thread_exit();
+	rcu_prof_thread_exit();
+	mem_account_flush();
+	animal_arena_flush();
 	rcu_unregister_thread();
 
 	DBG("Worker thread id=%lu exiting.", wt->id);
 	return NULL;
 }
 
-int create_worker_threads(unsigned long nr_threads)
+/*
+ * Add the statistics of a worker, possibly running, to "stats".
+ */
+static
+void sum_worker_stats(struct worker_stats *stats,
+		struct worker_stats *wstats)
+{
+	unsigned int i;
+
+	stats->nr_work += CMM_LOAD_SHARED(wstats->nr_work);
+	stats->latency_sum += CMM_LOAD_SHARED(wstats->latency_sum);
+	stats->busy_time += CMM_LOAD_SHARED(wstats->busy_time);
+	stats->nr_lookup += CMM_LOAD_SHARED(wstats->nr_lookup);
+	stats->nr_lookup_skip += CMM_LOAD_SHARED(wstats->nr_lookup_skip);
+	stats->nr_lookup_hit += CMM_LOAD_SHARED(wstats->nr_lookup_hit);
+	stats->nr_births += CMM_LOAD_SHARED(wstats->nr_births);
+	stats->nr_deaths += CMM_LOAD_SHARED(wstats->nr_deaths);
+	stats->nr_maintenance += CMM_LOAD_SHARED(wstats->nr_maintenance);
+	for (i = 0; i < NR_LATENCY_BUCKETS; i++)
+		stats->latency[i] += CMM_LOAD_SHARED(wstats->latency[i]);
+	stats->lock.nr_acquire += CMM_LOAD_SHARED(wstats->lock.nr_acquire);
+	stats->lock.nr_contended +=
+		CMM_LOAD_SHARED(wstats->lock.nr_contended);
+	stats->lock.nr_park += CMM_LOAD_SHARED(wstats->lock.nr_park);
+	for (i = 0; i < NR_PERF_COUNTERS; i++) {
+		stats->perf.count[i] += CMM_LOAD_SHARED(wstats->perf.count[i]);
+		stats->perf.nr_ops[i] +=
+			CMM_LOAD_SHARED(wstats->perf.nr_ops[i]);
+	}
+}
+
+static
+struct worker_pool *alloc_worker_pool(unsigned long nr_workers)
 {
-	unsigned long i;
+	struct worker_pool *pool;
+
+	pool = calloc(1, sizeof(*pool)
+			+ nr_workers * sizeof(pool->workers[0]));
+	if (!pool)
+		abort();
+	return pool;
+}
+
+/*
+ * Publish a new pool. Returns the old one, which no reader can see
+ * anymore. Called with pool_mutex held.
+ */
+static
+struct worker_pool *publish_worker_pool(struct worker_pool *pool)
+{
+	struct worker_pool *old = worker_pool;
+
+	pool->generation = old->generation + 1;
+	rcu_set_pointer(&worker_pool, pool);
+	prof_synchronize_rcu();
+	return old;
+}
+
+static
+struct worker_thread *start_worker(struct island *island)
+{
+	struct worker_thread *worker;
 	int err;
 
-	worker_threads = calloc(nr_threads, sizeof(*worker_threads));
-	if (!worker_threads)
+	if (posix_memalign((void **) &worker, CAA_CACHE_LINE_SIZE,
+			sizeof(*worker)))
+		abort();
+	memset(worker, 0, sizeof(*worker));
+	cds_wfcq_init(&worker->q_head, &worker->q_tail);
+	cds_wfcq_init(&worker->maint_head, &worker->maint_tail);
+	worker->id = next_worker_id++;
+	worker->island = island;
+	err = pthread_create(&worker->thread_id, NULL,
+		worker_thread_fct, worker);
+	if (err)
+		abort();
+	return worker;
+}
+
+static
+void join_worker(struct worker_thread *worker)
+{
+	void *tret;
+	int ret;
+
+	ret = pthread_join(worker->thread_id, &tret);
+	if (ret)
+		abort();
+}
+
+int create_worker_threads(unsigned long nr_threads,
+		const struct worker_attr *attr)
+{
+	struct worker_pool *pool;
+	unsigned long i;
+
+	memcpy(&worker_attr, attr, sizeof(worker_attr));
+	if (worker_attr.min_threads < nr_islands)
+		worker_attr.min_threads = nr_islands;
+	if (nr_threads < worker_attr.min_threads
+			|| nr_threads > MAX_WORKER_THREADS)
 		return -1;
-	for (i = 0; i < nr_threads; i++) {
-		struct worker_thread *worker;
 
-		worker = &worker_threads[i];
-		cds_wfcq_init(&worker->q_head, &worker->q_tail);
-		worker->id = i;
-		err = pthread_create(&worker->thread_id, NULL,
-			worker_thread_fct, worker);
-		if (err)
-			abort();
-	}
-	nr_worker_threads = nr_threads;
+	pool = alloc_worker_pool(nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		pool->workers[i] = start_worker(
+			&islands[i * nr_islands / nr_threads]);
+	pool->nr_active = pool->nr_workers = nr_threads;
+	rcu_set_pointer(&worker_pool, pool);
 
 	return 0;
 }
 
+/*
+ * Self-driving workers have no queue: they check their stop flag.
+ */
 static
 void stop_thread(struct worker_thread *thread)
 {
 	struct urcu_game_work *work;
 	int ret;
 
+	if (worker_attr.self_driving) {
+		CMM_STORE_SHARED(thread->stop, 1);
+		return;
+	}
 	work = calloc(1, sizeof(*work));
 	if (!work)
 		abort();
-	work->exit_thread = 1;
-	ret = enqueue_work(thread->id, work);
+	mem_account(MEM_WORK, sizeof(*work));
+	work->op = WORK_EXIT;
+	ret = enqueue_work(thread, work);
 	if (ret)
 		abort();
 }
 
-void stop_worker_threads(void)
+/*
+ * Active workers of each island, counted in island_workers, indexed by
+ * island id.
+ */
+static
+void count_island_workers(struct worker_pool *pool,
+		unsigned long *island_workers)
 {
 	unsigned long i;
 
-	for (i = 0; i < nr_worker_threads; i++) {
-		struct worker_thread *worker;
+	for (i = 0; i < pool->nr_active; i++)
+		island_workers[pool->workers[i]->island->id]++;
+}
 
-		worker = &worker_threads[i];
-		stop_thread(worker);
+/*
+ * New workers are appended to the active ones, on the islands with the
+ * fewest workers. Called with pool_mutex held.
+ */
+static
+void grow_worker_pool(unsigned long nr_threads)
+{
+	struct worker_pool *old = worker_pool, *pool;
+	unsigned long *island_workers, i;
+
+	island_workers = calloc(nr_islands, sizeof(*island_workers));
+	if (!island_workers)
+		abort();
+	count_island_workers(old, island_workers);
+
+	pool = alloc_worker_pool(nr_threads);
+	memcpy(pool->workers, old->workers,
+		old->nr_active * sizeof(pool->workers[0]));
+	pool->retired = old->retired;
+	for (i = old->nr_active; i < nr_threads; i++) {
+		unsigned long j, island = 0;
+
+		for (j = 1; j < nr_islands; j++) {
+			if (island_workers[j] < island_workers[island])
+				island = j;
+		}
+		island_workers[island]++;
+		pool->workers[i] = start_worker(&islands[island]);
 	}
+	pool->nr_active = pool->nr_workers = nr_threads;
+	free(island_workers);
+
+	free(publish_worker_pool(pool));
 }
 
-int join_worker_threads(void)
+/*
+ * Workers are removed from the islands with the most workers: since the
+ * pool has more active workers than islands, these keep at least one.
+ * Removed workers first move to the retiring part of the pool: once no
+ * dispatch thread can see them active, the stop message is the last
+ * item of their queue, so they complete the work already queued before
+ * exiting. Then their statistics move to the retired sum. Called with
+ * pool_mutex held.
+ */
+static
+void shrink_worker_pool(unsigned long nr_threads)
 {
-	unsigned long i;
+	struct worker_pool *old = worker_pool, *pool;
+	unsigned long *island_workers, i;
+
+	island_workers = calloc(nr_islands, sizeof(*island_workers));
+	if (!island_workers)
+		abort();
+	count_island_workers(old, island_workers);
 
-	for (i = 0; i < nr_worker_threads; i++) {
+	pool = alloc_worker_pool(old->nr_workers);
+	memcpy(pool->workers, old->workers,
+		old->nr_workers * sizeof(pool->workers[0]));
+	pool->retired = old->retired;
+	pool->nr_workers = old->nr_workers;
+	for (pool->nr_active = old->nr_active; pool->nr_active > nr_threads;
+			pool->nr_active--) {
 		struct worker_thread *worker;
-		void *tret;
-		int ret;
+		unsigned long j, island = 0;
 
-		worker = &worker_threads[i];
-		ret = pthread_join(worker->thread_id, &tret);
-		if (ret)
-			abort();
+		for (j = 1; j < nr_islands; j++) {
+			if (island_workers[j] > island_workers[island])
+				island = j;
+		}
+		island_workers[island]--;
+		/* Last active worker of the island starts retiring. */
+		for (j = pool->nr_active - 1; ; j--) {
+			if (pool->workers[j]->island == &islands[island])
+				break;
+		}
+		worker = pool->workers[j];
+		memmove(&pool->workers[j], &pool->workers[j + 1],
+			(pool->nr_active - 1 - j) * sizeof(pool->workers[0]));
+		pool->workers[pool->nr_active - 1] = worker;
 	}
-	free(worker_threads);
-	return 0;
+	free(island_workers);
+	free(publish_worker_pool(pool));
+
+	for (i = nr_threads; i < pool->nr_workers; i++)
+		stop_thread(pool->workers[i]);
+	for (i = nr_threads; i < pool->nr_workers; i++)
+		join_worker(pool->workers[i]);
+
+	old = pool;
+	pool = alloc_worker_pool(nr_threads);
+	memcpy(pool->workers, old->workers,
+		nr_threads * sizeof(pool->workers[0]));
+	pool->retired = old->retired;
+	for (i = nr_threads; i < old->nr_workers; i++)
+		sum_worker_stats(&pool->retired, &old->workers[i]->stats);
+	pool->nr_active = pool->nr_workers = nr_threads;
+	publish_worker_pool(pool);
+	for (i = nr_threads; i < old->nr_workers; i++)
+		free(old->workers[i]);
+	free(old);
 }
 
-int enqueue_work(unsigned long thread_nr, struct urcu_game_work *work)
+int resize_worker_pool(unsigned long nr_threads)
 {
-	struct worker_thread *worker;
-	bool was_non_empty;
+	unsigned long nr_active;
+	int ret = 0;
 
-	if (thread_nr >= nr_worker_threads)
+	if (nr_threads < worker_attr.min_threads
+			|| nr_threads > MAX_WORKER_THREADS)
 		return -1;
 
-	worker = &worker_threads[thread_nr];
-	/*
-	 * A single thread is pushing into the queue, this backoff
-	 * mechanism is sufficient.
-	 */
-	while (uatomic_read(&worker->q_len) >= MAX_WQ_LEN) {
-		poll(NULL, 0, 10);	/* sleep 10ms */
+	pthread_mutex_lock(&pool_mutex);
+	if (pool_stopped) {
+		ret = -1;
+		goto end;
+	}
+	nr_active = worker_pool->nr_active;
+	if (nr_threads > nr_active)
+		grow_worker_pool(nr_threads);
+	else if (nr_threads < nr_active)
+		shrink_worker_pool(nr_threads);
+	DBG("Worker pool resized from %lu to %lu threads.",
+		nr_active, nr_threads);
+end:
+	pthread_mutex_unlock(&pool_mutex);
+	return ret;
+}
+
+/*
+ * Maintenance submitted concurrently is either queued before the stop,
+ * or run by its submitter.
+ */
+void stop_worker_threads(void)
+{
+	struct worker_pool *pool;
+	unsigned long i;
+
+	pthread_mutex_lock(&pool_mutex);
+	CMM_STORE_SHARED(pool_stopped, 1);
+	prof_synchronize_rcu();
+	pool = worker_pool;
+	for (i = 0; i < pool->nr_workers; i++)
+		stop_thread(pool->workers[i]);
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+/*
+ * Self-driving workers are stopped here, since they have no dispatch
+ * thread.
+ */
+int join_worker_threads(void)
+{
+	struct worker_pool *pool;
+	unsigned long i;
+
+	if (!CMM_LOAD_SHARED(pool_stopped))
+		stop_worker_threads();
+
+	pthread_mutex_lock(&pool_mutex);
+	pool = worker_pool;
+	for (i = 0; i < pool->nr_workers; i++)
+		join_worker(pool->workers[i]);
+	rcu_set_pointer(&worker_pool, NULL);
+	pthread_mutex_unlock(&pool_mutex);
+
+	prof_synchronize_rcu();
+	for (i = 0; i < pool->nr_workers; i++)
+		free(pool->workers[i]);
+	free(pool);
+	return 0;
+}
+
+/*
+ * Reserve a slot in the worker queue. Several threads can push into
+ * the same queue (dispatch threads, stop messages), so the queue
+ * length is reserved with cmpxchg to never exceed MAX_WQ_LEN.
+ * Returns 0 on success, 1 if the queue is full.
+ */
+static
+int reserve_work_slot(struct worker_thread *worker)
+{
+	unsigned long q_len, old;
+
+	q_len = uatomic_read(&worker->q_len);
+	for (;;) {
+		if (q_len >= MAX_WQ_LEN)
+			return 1;
+		old = uatomic_cmpxchg(&worker->q_len, q_len, q_len + 1);
+		if (old == q_len)
+			return 0;
+		q_len = old;
 	}
+}
 
-	uatomic_inc(&worker->q_len);
+/*
+ * Called after the queue slot has been reserved.
+ */
+static
+void push_work(struct worker_thread *worker, struct urcu_game_work *work)
+{
+	bool was_non_empty;
+
+	work->enqueue_time = get_time_ns();
 	cds_wfcq_node_init(&work->q_node);
 	was_non_empty = cds_wfcq_enqueue(&worker->q_head,
 			&worker->q_tail, &work->q_node);
@@ -211,5 +847,181 @@ int enqueue_work(unsigned long thread_nr, struct urcu_game_work *work)
 		 * wakeup scheme with sys_futex instead.
 		 */
 	}
+}
+
+int enqueue_work(struct worker_thread *worker, struct urcu_game_work *work)
+{
+	while (reserve_work_slot(worker)) {
+		poll(NULL, 0, 10);	/* sleep 10ms */
+	}
+	push_work(worker, work);
+	return 0;
+}
+
+int try_enqueue_work(struct worker_thread *worker,
+		struct urcu_game_work *work)
+{
+	if (reserve_work_slot(worker))
+		return 1;
+	push_work(worker, work);
 	return 0;
 }
+
+static
+void push_maintenance(struct worker_thread *worker,
+		struct urcu_game_work *work)
+{
+	work->enqueue_time = get_time_ns();
+	cds_wfcq_node_init(&work->q_node);
+	(void) cds_wfcq_enqueue(&worker->maint_head, &worker->maint_tail,
+			&work->q_node);
+}
+
+static
+uint64_t slice_end(uint64_t start, uint64_t end)
+{
+	if (end - start > MAINTENANCE_SLICE)
+		return start + MAINTENANCE_SLICE;
+	return end;
+}
+
+/*
+ * Queue slices from "*slice" on the active workers, up to the window
+ * of the current pool. Returns -1 if there is no pool to queue to.
+ */
+static
+int queue_slices(struct work_batch *batch, enum work_op op,
+		struct island *island, uint64_t *slice, uint64_t end,
+		unsigned int type)
+{
+	static unsigned long next_worker;
+	struct worker_pool *pool;
+	unsigned long worker, window, nr;
+
+	/* Workers seen in the pool cannot be stopped until unlock. */
+	prof_rcu_read_lock();
+	pool = get_worker_pool();
+	if (!pool || CMM_LOAD_SHARED(pool_stopped)) {
+		prof_rcu_read_unlock();
+		return -1;
+	}
+	window = MAINTENANCE_WINDOW * pool->nr_active;
+	pthread_mutex_lock(&batch->lock);
+	nr = batch->nr_pending < window ? window - batch->nr_pending : 0;
+	batch->nr_pending += nr;
+	pthread_mutex_unlock(&batch->lock);
+	/* Concurrent operations start on different workers. */
+	worker = uatomic_add_return(&next_worker, 1) % pool->nr_active;
+	for (; nr && *slice < end; nr--) {
+		struct urcu_game_work *work;
+
+		work = calloc(1, sizeof(*work));
+		if (!work)
+			abort();
+		mem_account(MEM_WORK, sizeof(*work));
+		work->op = op;
+		work->u.slice.island = island;
+		work->u.slice.start = *slice;
+		work->u.slice.end = slice_end(*slice, end);
+		work->u.slice.type = type;
+		work->u.slice.batch = batch;
+		push_maintenance(pool->workers[worker], work);
+		if (++worker == pool->nr_active)
+			worker = 0;
+		*slice = slice_end(*slice, end);
+	}
+	prof_rcu_read_unlock();
+	if (nr) {
+		/* Past the end: return the unused window. */
+		pthread_mutex_lock(&batch->lock);
+		batch->nr_pending -= nr;
+		pthread_mutex_unlock(&batch->lock);
+	}
+	return 0;
+}
+
+/*
+ * Without pool, or once it is stopped, the remaining slices are run by
+ * the caller.
+ */
+uint64_t run_maintenance(enum work_op op, struct island *island,
+		uint64_t start, uint64_t end, unsigned int type)
+{
+	struct work_batch batch;
+	uint64_t slice = start, nr = 0;
+
+	if (start >= end)
+		return 0;
+
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.cond, NULL);
+	batch.nr_pending = 0;
+	batch.result = 0;
+	while (slice < end) {
+		if (queue_slices(&batch, op, island, &slice, end, type))
+			break;
+		/* Wait for a slice to complete before queuing more. */
+		pthread_mutex_lock(&batch.lock);
+		if (slice < end && batch.nr_pending)
+			pthread_cond_wait(&batch.cond, &batch.lock);
+		pthread_mutex_unlock(&batch.lock);
+	}
+	for (; slice < end; slice = slice_end(slice, end))
+		nr += run_slice(op, island, slice, slice_end(slice, end), type);
+
+	pthread_mutex_lock(&batch.lock);
+	while (batch.nr_pending)
+		pthread_cond_wait(&batch.cond, &batch.lock);
+	nr += batch.result;
+	pthread_mutex_unlock(&batch.lock);
+	pthread_mutex_destroy(&batch.lock);
+	pthread_cond_destroy(&batch.cond);
+	return nr;
+}
+
+unsigned long get_worker_q_len(struct worker_thread *worker)
+{
+	return uatomic_read(&worker->q_len);
+}
+
+void get_worker_stats(struct worker_stats *stats)
+{
+	struct worker_pool *pool;
+	unsigned long i;
+
+	prof_rcu_read_lock();
+	pool = get_worker_pool();
+	memcpy(stats, &pool->retired, sizeof(*stats));
+	for (i = 0; i < pool->nr_workers; i++)
+		sum_worker_stats(stats, &pool->workers[i]->stats);
+	prof_rcu_read_unlock();
+}
+
+void get_worker_range_stats(struct worker_pool *pool, unsigned long first,
+		unsigned long nr, struct worker_stats *stats)
+{
+	unsigned long i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = first; i < first + nr; i++)
+		sum_worker_stats(stats, &pool->workers[i]->stats);
+}
+
+uint64_t worker_stats_latency_percentile(const struct worker_stats *stats,
+		unsigned int percent)
+{
+	uint64_t total = 0, threshold, count = 0;
+	unsigned int i;
+
+	for (i = 0; i < NR_LATENCY_BUCKETS; i++)
+		total += stats->latency[i];
+	if (!total)
+		return 0;
+	threshold = (total * percent + 99) / 100;
+	for (i = 0; i < NR_LATENCY_BUCKETS - 1; i++) {
+		count += stats->latency[i];
+		if (count >= threshold)
+			break;
+	}
+	return (2ULL << i) - 1;
+}
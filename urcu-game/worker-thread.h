@@ -19,15 +19,70 @@
 #include <urcu/wfcqueue.h>
 #include <urcu/compiler.h>
 #include <pthread.h>
+#include <stdint.h>
+#include "animal-lock.h"
+#include "perf-counters.h"
 
 #define MAX_WQ_LEN	1000
+#define MAX_WORKER_THREADS	4096
+
+/*
+ * Maintenance work is split in slices of MAINTENANCE_SLICE animals
+ * created, or keys culled or swept, each run within a single RCU
+ * read-side critical section. Encounters have priority, but workers
+ * take a maintenance slice at least once every MAINTENANCE_INTERVAL
+ * work items.
+ */
+#define MAINTENANCE_SLICE	1024
+#define MAINTENANCE_INTERVAL	8
+/* Slices of an operation queued at once, per active worker. */
+#define MAINTENANCE_WINDOW	2
+
+/*
+ * With perf_counters_enable, workers read their counters around batches
+ * of up to PERF_BATCH encounters, stopped early when idle or for
+ * maintenance: counts are per encounter.
+ */
+#define PERF_BATCH		64
+
+/* Encounter latency histogram, in power of 2 nanoseconds buckets. */
+#define NR_LATENCY_BUCKETS	64
+
+/*
+ * Statistics are updated by the owner worker thread only, and read
+ * concurrently by other threads, hence CMM_LOAD_SHARED/CMM_STORE_SHARED.
+ */
+struct worker_stats {
+	uint64_t nr_work;		/* work items completed */
+	uint64_t latency_sum;		/* enqueue to completion, in ns */
+	uint64_t busy_time;		/* time spent doing work, in ns */
+	uint64_t nr_lookup;		/* animal lookups */
+	uint64_t nr_lookup_skip;	/* empty per occupancy map */
+	uint64_t nr_lookup_hit;		/* found in hash table */
+	uint64_t nr_births;		/* in encounters */
+	uint64_t nr_deaths;		/* eaten or exhausted in encounters */
+	uint64_t nr_maintenance;	/* maintenance slices completed */
+	uint64_t latency[NR_LATENCY_BUCKETS];
+	struct animal_lock_stats lock;	/* during encounters */
+	struct perf_stats perf;		/* during encounters */
+};
+
+struct island;
 
 struct worker_thread {
 	struct cds_wfcq_tail q_tail;	/* new work enqueued at tail */
 	struct cds_wfcq_head q_head;	/* extracted from head */
 	unsigned long q_len;
+	/* Maintenance queue, unbounded. */
+	struct cds_wfcq_tail maint_tail;
+	struct cds_wfcq_head maint_head;
 	unsigned long id;
+	struct island *island;		/* island of the encounters */
 	pthread_t thread_id;
+	int stop;			/* self-driving worker leaves pool */
+	struct worker_stats stats;
+	struct perf_counters perf;
+	unsigned int perf_batch;	/* encounters in current batch */
 
 	/*
 	 * Align thread structures on cache line size to eliminate
@@ -36,28 +91,149 @@ struct worker_thread {
 } __attribute__((aligned(CAA_CACHE_LINE_SIZE)));
 
 /*
- * Work sent to worker threads.
+ * Worker pool, published with RCU. Dispatch threads send work to the
+ * active workers of the pool they see. Workers removed by a resize are
+ * retiring until their queue is drained, then their statistics are
+ * added to "retired", so that the sum over the pool stays monotonic.
+ */
+struct worker_pool {
+	unsigned long generation;	/* incremented on each update */
+	unsigned long nr_active;	/* receiving work */
+	unsigned long nr_workers;	/* active, then retiring */
+	struct worker_stats retired;	/* of removed workers */
+	struct worker_thread *workers[];
+};
+
+enum work_op {
+	WORK_ENCOUNTER,
+	WORK_EXIT,			/* stop worker thread */
+	/* Maintenance, see run_maintenance(). */
+	WORK_CREATE,			/* try creating end - start animals */
+	WORK_CULL,			/* kill animals of keys [start, end) */
+	WORK_SWEEP,			/* reap exhausted animals, same keys */
+};
+
+/* Slices of a maintenance operation, awaited by the submitter. */
+struct work_batch {
+	pthread_mutex_t lock;		/* protects the fields below */
+	pthread_cond_t cond;		/* signaled on slice completion */
+	unsigned long nr_pending;	/* slices queued, not completed */
+	uint64_t result;		/* sum of slice results */
+};
+
+/*
+ * Work sent to worker threads. Encounters and exit go through the
+ * bounded work queue, maintenance slices through the maintenance queue.
  */
 struct urcu_game_work {
 	struct cds_wfcq_node q_node;	/* work queue node */
 
-	uint64_t first_key;
-	uint64_t second_key;
-
-	int exit_thread;
+	enum work_op op;
+	uint64_t enqueue_time;		/* in ns, for latency statistics */
+	union {
+		struct {
+			uint64_t first_key;
+			uint64_t second_key;
+		} encounter;
+		struct {
+			struct island *island;
+			uint64_t start;
+			uint64_t end;
+			unsigned int type;	/* species, MAX_SPECIES: all */
+			struct work_batch *batch;
+		} slice;
+	} u;
 	/*
 	 * Align work on cache line size to eliminate false-sharing.
 	 */
 } __attribute__((aligned(CAA_CACHE_LINE_SIZE)));
 
-int create_worker_threads(unsigned long nr_threads);
+/* Self-driving rate limit: one encounter per ns. */
+#define MAX_SELF_DRIVING_RATE	1000000000ULL
+
+struct worker_attr {
+	/*
+	 * Self-driving workers generate their own encounters, without
+	 * dispatch thread nor work queue. They stop generating encounters
+	 * on exit_program, and keep serving maintenance until stopped.
+	 */
+	int self_driving;
+	uint64_t rate;			/* encounters/s per worker, 0: unbounded */
+	/* Smallest pool size, raised to the number of islands. */
+	unsigned long min_threads;
+};
+
+/*
+ * Islands need to be created first: they are split in contiguous
+ * ranges of worker threads.
+ */
+int create_worker_threads(unsigned long nr_threads,
+		const struct worker_attr *attr);
+
+/*
+ * Add or remove workers, so nr_threads are active. Added workers go to
+ * the islands with the fewest workers, removed ones are taken from the
+ * islands with the most, after draining their queue. Returns 0 on
+ * success, -1 if nr_threads is out of bounds or the pool is stopped.
+ * Called from a registered RCU thread, outside read-side critical
+ * section.
+ */
+int resize_worker_pool(unsigned long nr_threads);
 
 void stop_worker_threads(void);
 
 int join_worker_threads(void);
 
-int enqueue_work(unsigned long thread_nr, struct urcu_game_work *work);
+/* Called with RCU read-side lock held. */
+struct worker_pool *get_worker_pool(void);
+
+/*
+ * Enqueue into a worker of the pool, waiting for a free queue slot.
+ * Called with RCU read-side lock held. Returns 0.
+ */
+int enqueue_work(struct worker_thread *worker, struct urcu_game_work *work);
+
+/*
+ * Non-blocking enqueue. Returns 1 without enqueuing if the worker queue
+ * is full, 0 on success.
+ */
+int try_enqueue_work(struct worker_thread *worker,
+		struct urcu_game_work *work);
 
+unsigned long get_worker_q_len(struct worker_thread *worker);
+
+/* Number of active workers. */
 unsigned long get_nr_worker_threads(void);
 
+/*
+ * Split a maintenance operation in slices, run by the active workers
+ * between encounters, and wait for their completion. At most
+ * MAINTENANCE_WINDOW slices per active worker are queued at once, and
+ * more are queued as they complete. Keys or animals
+ * are [start, end), and type is the species id for WORK_CREATE, or
+ * which species to cull (MAX_SPECIES: all). Returns the number of
+ * animals created, culled or reaped. Run by the calling thread when
+ * there is no worker pool. Not called from worker threads, nor within
+ * RCU read-side critical section.
+ */
+uint64_t run_maintenance(enum work_op op, struct island *island,
+		uint64_t start, uint64_t end, unsigned int type);
+
+/*
+ * Sum of the statistics of all worker threads, including removed ones.
+ * Counters are monotonic: rates are obtained by subtracting two
+ * samples.
+ */
+void get_worker_stats(struct worker_stats *stats);
+/* Workers [first, first + nr) of the pool, without retired ones. */
+void get_worker_range_stats(struct worker_pool *pool, unsigned long first,
+		unsigned long nr, struct worker_stats *stats);
+
+/*
+ * Approximate latency (upper bound of the histogram bucket, in ns) under
+ * which "percent" of the work items counted in "stats" completed.
+ */
+uint64_t worker_stats_latency_percentile(const struct worker_stats *stats,
+		unsigned int percent);
+
 #endif /* WORKER_THREAD_H */